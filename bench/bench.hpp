@@ -0,0 +1,243 @@
+#ifndef _BENCH_HPP_
+#define _BENCH_HPP_
+
+#include "options.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <enetcpp/enetcpp-shim.hpp>
+#include <enetcpp/enetcpp.hpp>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+namespace bench {
+
+/**
+ * @brief Returns the user and system CPU time used by the process, in seconds.
+ */
+inline double cpu_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+/**
+ * @brief Returns a monotonic time in seconds.
+ */
+inline double wall_seconds() {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief One benchmark result, rendered as a flat JSON object.
+ */
+class Result {
+  private:
+    std::string m_json;
+
+    void key(const char* name) {
+        m_json += m_json.empty() ? "{\"" : ",\"";
+        m_json += name;
+        m_json += "\":";
+    }
+
+  public:
+    Result& add(const char* name, double value) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.9g", value);
+        key(name);
+        m_json += buffer;
+        return *this;
+    }
+
+    Result& add(const char* name, long value) {
+        key(name);
+        m_json += std::to_string(value);
+        return *this;
+    }
+
+    Result& add(const char* name, const char* value) {
+        return add(name, std::string(value));
+    }
+
+    Result& add(const char* name, const std::string& value) {
+        key(name);
+        m_json += '"';
+        for (char c : value) {
+            if (c == '"' || c == '\\')
+                m_json += '\\';
+            m_json += c;
+        }
+        m_json += '"';
+        return *this;
+    }
+
+    std::string json() const { return m_json.empty() ? "{}" : m_json + "}"; }
+};
+
+/**
+ * @brief Collects results and writes them as
+ * `{"benchmark": name, "results": [...]}`.
+ */
+class Report {
+  private:
+    std::string m_name;
+    std::vector<std::string> m_results;
+
+  public:
+    Report(const std::string& name) : m_name(name) {}
+
+    void add(const Result& result) { m_results.push_back(result.json()); }
+
+    /**
+     * @brief Writes the report.
+     * @param path The output file, or an empty string for stdout.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void write(const std::string& path) const {
+        FILE* file = path.empty() ? stdout : fopen(path.c_str(), "w");
+        if (file == NULL)
+            throw std::runtime_error("Failed to open " + path);
+        write(file);
+        if (file != stdout && fclose(file) != 0)
+            throw std::runtime_error("Failed to write " + path);
+    }
+
+    /**
+     * @brief Writes the report to an open file and flushes it.
+     */
+    void write(FILE* file) const {
+        fprintf(file, "{\"benchmark\":\"%s\",\"results\":[", m_name.c_str());
+        for (size_t i = 0; i < m_results.size(); i++)
+            fprintf(file, "%s\n%s", i ? "," : "", m_results[i].c_str());
+        fprintf(file, "\n]}\n");
+        fflush(file);
+    }
+};
+
+/**
+ * @brief Records the first exception thrown on a benchmark's threads, which
+ * would otherwise terminate the process, so the result can report it.
+ */
+class Failure {
+  private:
+    mutable std::mutex m_mutex;
+    std::string m_what;
+    std::atomic<bool> m_failed{false};
+
+  public:
+    /**
+     * @brief Runs `body`, recording anything it throws.
+     * @return `false` if `body` threw.
+     */
+    template <typename Body> bool guard(Body&& body) {
+        try {
+            body();
+            return true;
+        } catch (const std::exception& e) {
+            record(e.what());
+        } catch (...) {
+            record("unknown exception");
+        }
+        return false;
+    }
+
+    /**
+     * @brief Records a failure, unless one was recorded already.
+     */
+    void record(const std::string& what) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_failed.load())
+            m_what = what;
+        m_failed.store(true);
+    }
+
+    bool failed() const { return m_failed.load(); }
+
+    /**
+     * @brief Returns the first failure's message, or an empty string.
+     */
+    std::string what() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_what;
+    }
+
+    /**
+     * @brief Adds the failure to `result` as `"error"`, if there was one.
+     */
+    void report(Result& result) const {
+        if (failed())
+            result.add("error", what());
+    }
+};
+
+/**
+ * @brief A Host that ignores every event and does not log, so benchmarks
+ * keep stdout for their report.
+ */
+class QuietHost : public enetcpp::Host {
+  public:
+    QuietHost(enetcpp::Address address, size_t peer_count,
+              size_t channel_limit = 1)
+        : enetcpp::Host(address, peer_count, channel_limit, 0, 0,
+                        enetcpp::Logger(enetcpp::Logger::NONE)) {}
+
+    QuietHost(size_t peer_count, size_t channel_limit = 1)
+        : enetcpp::Host(peer_count, channel_limit, 0, 0,
+                        enetcpp::Logger(enetcpp::Logger::NONE)) {}
+
+    void on_event(enetcpp::EventConnect&) override {}
+    void on_event(enetcpp::EventDisconnect&) override {}
+    void on_event(enetcpp::EventReceive&) override {}
+};
+
+/**
+ * @brief The network conditions given by `--loss`, `--latency`, `--jitter`
+ * (milliseconds), `--reorder`, `--duplicate` and `--bandwidth` (bytes per
+ * second), and the `--seed` for them.
+ */
+struct ImpairOptions {
+    enetcpp::Impairment impairment;
+    long seed;
+
+    explicit ImpairOptions(const Options& options) {
+        impairment.loss = options.get_double("loss", 0);
+        impairment.latency = options.get_double("latency", 0);
+        impairment.jitter = options.get_double("jitter", 0);
+        impairment.reorder = options.get_double("reorder", 0);
+        impairment.duplicate = options.get_double("duplicate", 0);
+        impairment.bandwidth = options.get_double("bandwidth", 0);
+        seed = options.get_int("seed", 1);
+    }
+};
+
+/**
+ * @brief Attaches an ImpairmentShim to a client host when any impairment
+ * was given.
+ *
+ * Both directions get the same conditions, so the round trip sees twice the
+ * latency. `--seed` plus `index` seeds the shim.
+ *
+ * @return The shim, or NULL if no impairment was requested.
+ */
+inline std::shared_ptr<enetcpp::ImpairmentShim>
+impair(enetcpp::Host& host, const ImpairOptions& options, uint64_t index) {
+    if (!options.impairment.active())
+        return NULL;
+    auto shim = std::make_shared<enetcpp::ImpairmentShim>(
+        options.impairment, options.impairment, options.seed + index);
+    host.add_shim(shim);
+    return shim;
+}
+
+} // namespace bench
+
+#endif // _BENCH_HPP_
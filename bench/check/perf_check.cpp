@@ -0,0 +1,376 @@
+#include "../options.hpp"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Performance regression gate. Compares benchmark reports against the checks
+// in a baseline file and exits with 1 if any metric regressed by more than
+// its tolerance, if a checked result is missing from the reports, or if a
+// check has no baseline yet. With --update the measured values are written
+// into the baseline instead; --update=missing only fills in the checks
+// without one and compares the rest as usual.
+//
+//   perf_check --baseline=bench/baseline.json --reports=a.json,b.json
+//              [--tolerance-scale=1.0] [--update[=missing]]
+//
+// The baseline looks like
+//
+//   {"tolerance": 0.1,
+//    "checks": [{"benchmark": "micro",
+//                "where": {"name": "packet_create_destroy/256"},
+//                "metric": "ns_per_op", "better": "lower",
+//                "tolerance": 0.25, "baseline": 61.2}, ...]}
+//
+// A check matches the result of its benchmark whose fields equal every field
+// of "where". Its own "tolerance" overrides the default. A null "baseline"
+// fails, so that a gate nobody has recorded cannot pass.
+
+// Just enough JSON for the reports and the baseline.
+class Json {
+  public:
+    enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> fields;
+
+    static Json parse(const std::string& text) {
+        size_t at = 0;
+        Json value = parse(text, at);
+        skip(text, at);
+        if (at != text.size())
+            throw std::runtime_error("trailing characters in JSON");
+        return value;
+    }
+
+    const Json* find(const std::string& key) const {
+        for (const auto& field : fields)
+            if (field.first == key)
+                return &field.second;
+        return NULL;
+    }
+
+    Json* find(const std::string& key) {
+        for (auto& field : fields)
+            if (field.first == key)
+                return &field.second;
+        return NULL;
+    }
+
+    bool operator==(const Json& other) const {
+        if (type != other.type)
+            return false;
+        switch (type) {
+        case NUL:
+            return true;
+        case BOOL:
+            return boolean == other.boolean;
+        case NUMBER:
+            return number == other.number;
+        case STRING:
+            return string == other.string;
+        default:
+            return dump() == other.dump();
+        }
+    }
+
+    // Objects are indented when `indent` is set; array items are written one
+    // per line but compactly, so each check is a single line in the baseline.
+    std::string dump(int indent = -1, int depth = 0) const {
+        std::string pad, close;
+        if (indent >= 0) {
+            pad = "\n" + std::string((depth + 1) * indent, ' ');
+            close = "\n" + std::string(depth * indent, ' ');
+        }
+        std::string out;
+        switch (type) {
+        case NUL:
+            return "null";
+        case BOOL:
+            return boolean ? "true" : "false";
+        case NUMBER: {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.9g", number);
+            return buffer;
+        }
+        case STRING:
+            return quote(string);
+        case ARRAY:
+            out = "[";
+            for (size_t i = 0; i < items.size(); i++)
+                out += (i ? "," : "") + pad + items[i].dump();
+            return out + (items.empty() ? "" : close) + "]";
+        case OBJECT:
+            out = "{";
+            for (size_t i = 0; i < fields.size(); i++)
+                out += (i ? (pad.empty() ? ", " : ",") : "") + pad +
+                       quote(fields[i].first) + ": " +
+                       fields[i].second.dump(indent, depth + 1);
+            return out + (fields.empty() ? "" : close) + "}";
+        }
+        return out;
+    }
+
+  private:
+    static std::string quote(const std::string& value) {
+        std::string out = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    static void skip(const std::string& text, size_t& at) {
+        while (at < text.size() && isspace((unsigned char)text[at]))
+            at++;
+    }
+
+    static void expect(const std::string& text, size_t& at, char c) {
+        skip(text, at);
+        if (at >= text.size() || text[at] != c)
+            throw std::runtime_error(std::string("expected '") + c +
+                                     "' in JSON at offset " +
+                                     std::to_string(at));
+        at++;
+    }
+
+    static std::string parse_string(const std::string& text, size_t& at) {
+        expect(text, at, '"');
+        std::string out;
+        while (at < text.size() && text[at] != '"') {
+            if (text[at] == '\\' && at + 1 < text.size()) {
+                at++;
+                char c = text[at];
+                out += c == 'n' ? '\n' : c == 't' ? '\t' : c;
+            } else {
+                out += text[at];
+            }
+            at++;
+        }
+        expect(text, at, '"');
+        return out;
+    }
+
+    static Json parse(const std::string& text, size_t& at) {
+        skip(text, at);
+        if (at >= text.size())
+            throw std::runtime_error("unexpected end of JSON");
+        Json value;
+        char c = text[at];
+        if (c == '{') {
+            value.type = OBJECT;
+            at++;
+            skip(text, at);
+            if (at < text.size() && text[at] == '}') {
+                at++;
+                return value;
+            }
+            while (true) {
+                std::string key = parse_string(text, at);
+                expect(text, at, ':');
+                value.fields.emplace_back(key, parse(text, at));
+                skip(text, at);
+                if (at < text.size() && text[at] == ',') {
+                    at++;
+                    continue;
+                }
+                expect(text, at, '}');
+                return value;
+            }
+        } else if (c == '[') {
+            value.type = ARRAY;
+            at++;
+            skip(text, at);
+            if (at < text.size() && text[at] == ']') {
+                at++;
+                return value;
+            }
+            while (true) {
+                value.items.push_back(parse(text, at));
+                skip(text, at);
+                if (at < text.size() && text[at] == ',') {
+                    at++;
+                    continue;
+                }
+                expect(text, at, ']');
+                return value;
+            }
+        } else if (c == '"') {
+            value.type = STRING;
+            value.string = parse_string(text, at);
+        } else if (text.compare(at, 4, "null") == 0) {
+            at += 4;
+        } else if (text.compare(at, 4, "true") == 0) {
+            value.type = BOOL;
+            value.boolean = true;
+            at += 4;
+        } else if (text.compare(at, 5, "false") == 0) {
+            value.type = BOOL;
+            at += 5;
+        } else {
+            value.type = NUMBER;
+            char* end;
+            value.number = strtod(text.c_str() + at, &end);
+            if (end == text.c_str() + at)
+                throw std::runtime_error("bad JSON value at offset " +
+                                         std::to_string(at));
+            at = end - text.c_str();
+        }
+        return value;
+    }
+};
+
+static std::string read_file(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        throw std::runtime_error("Failed to open " + path);
+    std::string out;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        out.append(buffer, read);
+    fclose(file);
+    return out;
+}
+
+static const Json* find_result(const std::vector<Json>& reports,
+                               const Json& check) {
+    const Json* benchmark = check.find("benchmark");
+    const Json* where = check.find("where");
+    for (const Json& report : reports) {
+        const Json* name = report.find("benchmark");
+        const Json* results = report.find("results");
+        if (!benchmark || !name || !(*name == *benchmark) || !results)
+            continue;
+        for (const Json& result : results->items) {
+            bool match = true;
+            if (where)
+                for (const auto& field : where->fields) {
+                    const Json* value = result.find(field.first);
+                    if (!value || !(*value == field.second)) {
+                        match = false;
+                        break;
+                    }
+                }
+            if (match)
+                return &result;
+        }
+    }
+    return NULL;
+}
+
+static std::string describe(const Json& check) {
+    std::string out = check.find("benchmark")
+                          ? check.find("benchmark")->string
+                          : std::string("?");
+    if (const Json* where = check.find("where"))
+        for (const auto& field : where->fields)
+            out += " " + field.first + "=" +
+                   (field.second.type == Json::STRING ? field.second.string
+                                                      : field.second.dump());
+    if (const Json* metric = check.find("metric"))
+        out += " " + metric->string;
+    return out;
+}
+
+int main(int argc, char** argv) {
+    bench::Options options(argc, argv);
+    std::string baseline_path = options.get("baseline", "");
+    if (baseline_path.empty())
+        throw std::runtime_error("--baseline=<file> is required");
+    double scale = options.get_double("tolerance-scale", 1.0);
+    std::string update_mode = options.get("update", "");
+    if (!update_mode.empty() && update_mode != "1" && update_mode != "missing")
+        throw std::runtime_error("unknown --update=" + update_mode);
+    bool update = !update_mode.empty();
+    std::vector<std::string> report_paths = options.get_strings("reports", {});
+    options.check_unused();
+
+    Json baseline = Json::parse(read_file(baseline_path));
+    std::vector<Json> reports;
+    for (const std::string& path : report_paths)
+        reports.push_back(Json::parse(read_file(path)));
+    const Json* default_tolerance = baseline.find("tolerance");
+    Json* checks = baseline.find("checks");
+    if (!checks)
+        throw std::runtime_error("baseline has no \"checks\"");
+
+    int failures = 0;
+    int unrecorded = 0;
+    for (Json& check : checks->items) {
+        std::string name = describe(check);
+        const Json* result = find_result(reports, check);
+        const Json* metric = check.find("metric");
+        const Json* value =
+            result && metric ? result->find(metric->string) : NULL;
+        if (!value || value->type != Json::NUMBER) {
+            printf("%-9s %s\n", "MISSING", name.c_str());
+            failures++;
+            continue;
+        }
+        Json* expected = check.find("baseline");
+        bool recorded = expected && expected->type == Json::NUMBER;
+        if (update && !(recorded && update_mode == "missing")) {
+            if (expected)
+                *expected = *value;
+            else
+                check.fields.emplace_back("baseline", *value);
+            printf("%-9s %s = %.6g\n", "UPDATED", name.c_str(), value->number);
+            continue;
+        }
+        if (!recorded) {
+            printf("%-9s %s = %.6g (no baseline)\n", "NEW", name.c_str(),
+                   value->number);
+            unrecorded++;
+            failures++;
+            continue;
+        }
+
+        const Json* tolerance_value = check.find("tolerance");
+        if (!tolerance_value)
+            tolerance_value = default_tolerance;
+        double tolerance =
+            (tolerance_value ? tolerance_value->number : 0.1) * scale;
+        const Json* better = check.find("better");
+        bool higher = better && better->string == "higher";
+        double change = expected->number != 0
+                            ? value->number / expected->number - 1
+                            : (value->number == 0 ? 0 : INFINITY);
+        double worse = higher ? -change : change;
+        const char* status = "OK";
+        if (worse > tolerance) {
+            status = "REGRESSED";
+            failures++;
+        } else if (-worse > tolerance) {
+            status = "IMPROVED";
+        }
+        printf("%-9s %s = %.6g (baseline %.6g, %+.1f%%, tolerance %.0f%%)\n",
+               status, name.c_str(), value->number, expected->number,
+               change * 100, tolerance * 100);
+    }
+
+    if (update) {
+        FILE* file = fopen(baseline_path.c_str(), "w");
+        if (file == NULL)
+            throw std::runtime_error("Failed to write " + baseline_path);
+        fprintf(file, "%s\n", baseline.dump(2).c_str());
+        fclose(file);
+        return failures ? 1 : 0;
+    }
+    printf("%d of %zu checks failed\n", failures, checks->items.size());
+    if (unrecorded)
+        printf("%d checks have no baseline: record them on the reference "
+               "machine with the perf_check_record target\n",
+               unrecorded);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <enetcpp/enetcpp-sharded.hpp>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Connection-scale stress test over 127.0.0.1. A few client hosts ramp up to
+// tens of thousands of peers, each sending --rate messages per second, while
+// the server hosts are serviced on a fixed tick. For every step of the ramp
+// the report gives the per-tick service cost against the number of peers.
+//
+// ENet addresses at most 4095 peers per host, so the server is a ShardedHost
+// whose shards listen on consecutive ports, each serviced from its own thread,
+// and the tick cost is per shard. --window-trim=N enables
+// set_window_trim(N) on the shards.
+//
+//   bench_connections [--steps=1000,2500,5000,10000,20000]
+//                     [--client-hosts=8] [--server-hosts=0 (auto)]
+//                     [--rate=1] [--payload=32] [--tick-ms=10] [--hold=3.0]
+//                     [--connects-per-tick=64] [--ramp-timeout=60]
+//                     [--window-trim=0] [--port=23460] [--output=]
+
+static const size_t MAX_PEERS_PER_HOST = 4095;
+
+using Clock = std::chrono::steady_clock;
+
+class StressServer : public enetcpp::ShardedHost {
+  public:
+    StressServer(enetcpp::Address address, size_t shards, size_t peer_count)
+        : enetcpp::ShardedHost(address, shards, peer_count, 1,
+                               enetcpp::ShardMode::PORTS, 0, 0,
+                               enetcpp::Logger(enetcpp::Logger::NONE)) {}
+
+    std::atomic<uint64_t> messages{0};
+
+    void on_event(enetcpp::EventReceive&) override {
+        messages.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+struct Server {
+    enetcpp::Host* host;
+    // one histogram per step, plus a last one for ticks during the ramp
+    std::unique_ptr<enetcpp::LatencyHistogram[]> ticks;
+    std::thread thread;
+};
+
+struct Client {
+    std::unique_ptr<bench::QuietHost> host;
+    std::atomic<size_t> target{0};
+    std::thread thread;
+};
+
+static void sleep_until_next(Clock::time_point& next, Clock::duration tick) {
+    next += tick;
+    Clock::time_point now = Clock::now();
+    if (next < now)
+        next = now;
+    else
+        std::this_thread::sleep_until(next);
+}
+
+static void serve(Server& server, const std::atomic<size_t>& step,
+                  const std::atomic<bool>& stop, Clock::duration tick) {
+    Clock::time_point next = Clock::now();
+    while (!stop.load(std::memory_order_relaxed)) {
+        Clock::time_point start = Clock::now();
+        while (server.host->service(0) > 0) {
+        }
+        server.host->flush();
+        server.ticks[step.load(std::memory_order_relaxed)].record_since(start);
+        sleep_until_next(next, tick);
+    }
+}
+
+// What each client host offers, read before the client threads start.
+struct Load {
+    double rate;
+    size_t connects_per_tick;
+    size_t payload;
+};
+
+static void drive(Client& client, const std::vector<enetcpp::Address>& servers,
+                  size_t client_index, const Load& load,
+                  const std::atomic<bool>& stop, Clock::duration tick) {
+    double rate = load.rate;
+    size_t connects_per_tick = load.connects_per_tick;
+    std::vector<char> payload(load.payload, 'x');
+    double tick_seconds = std::chrono::duration<double>(tick).count();
+
+    ENetHost* host = client.host->get();
+    size_t cursor = 0, connects = 0;
+    double credit = 0;
+    Clock::time_point next = Clock::now();
+    while (!stop.load(std::memory_order_relaxed)) {
+        // the peer array is only touched by this thread, so scan it
+        // directly; peers that time out are replaced on later ticks
+        size_t active = 0, connected = 0;
+        for (size_t i = 0; i < host->peerCount; i++) {
+            ENetPeerState state = host->peers[i].state;
+            active += state != ENET_PEER_STATE_DISCONNECTED;
+            connected += state == ENET_PEER_STATE_CONNECTED;
+        }
+        size_t target = client.target.load(std::memory_order_relaxed);
+        for (size_t i = 0; active < target && i < connects_per_tick;
+             i++, active++, connects++) {
+            size_t server = (client_index + connects) % servers.size();
+            client.host->connect_async(servers[server]);
+        }
+
+        credit += connected * rate * tick_seconds;
+        size_t budget = (size_t)credit;
+        credit -= budget;
+        for (size_t i = 0; budget > 0 && i < host->peerCount; i++) {
+            enetcpp::Peer peer(&host->peers[cursor]);
+            cursor = (cursor + 1) % host->peerCount;
+            if (peer.get()->state != ENET_PEER_STATE_CONNECTED)
+                continue;
+            enetcpp::Packet packet(payload.data(), payload.size());
+            peer.send(packet);
+            budget--;
+        }
+
+        while (client.host->service(0) > 0) {
+        }
+        client.host->flush();
+        sleep_until_next(next, tick);
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Options options(argc, argv);
+    enetcpp::initialize();
+
+    std::vector<long> steps =
+        options.get_ints("steps", {1000, 2500, 5000, 10000, 20000});
+    size_t max_peers = *std::max_element(steps.begin(), steps.end());
+    size_t client_hosts = options.get_int("client-hosts", 8);
+    size_t server_hosts = options.get_int("server-hosts", 0);
+    size_t window_trim = options.get_int("window-trim", 0);
+    if (server_hosts == 0)
+        server_hosts = (max_peers + 3999) / 4000;
+    size_t client_peers = (max_peers + client_hosts - 1) / client_hosts;
+    size_t server_peers = std::min(MAX_PEERS_PER_HOST * server_hosts,
+                                   max_peers + 64 * server_hosts);
+    if (client_peers > MAX_PEERS_PER_HOST)
+        throw std::runtime_error("too many peers per host, raise "
+                                 "--client-hosts");
+    double hold = options.get_double("hold", 3.0);
+    double ramp_timeout = options.get_double("ramp-timeout", 60.0);
+    double rate = options.get_double("rate", 1.0);
+    Clock::duration tick = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(
+            options.get_double("tick-ms", 10)));
+    long port = options.get_int("port", 23460);
+    Load load{rate, (size_t)options.get_int("connects-per-tick", 64),
+              (size_t)options.get_int("payload", 32)};
+    std::string output = options.get("output", "");
+    options.check_unused();
+
+    std::atomic<bool> stop_servers{false}, stop_clients{false};
+    std::atomic<size_t> step{steps.size()};
+    StressServer sharded(enetcpp::Address("127.0.0.1", port), server_hosts,
+                         server_peers);
+    sharded.set_window_trim(window_trim);
+    const std::vector<enetcpp::Address>& addresses = sharded.addresses();
+    std::vector<std::unique_ptr<Server>> servers;
+    for (size_t i = 0; i < server_hosts; i++) {
+        servers.emplace_back(new Server);
+        Server& server = *servers.back();
+        server.host = &sharded.shard(i);
+        server.ticks.reset(new enetcpp::LatencyHistogram[steps.size() + 1]);
+        server.thread = std::thread(serve, std::ref(server), std::cref(step),
+                                    std::cref(stop_servers), tick);
+    }
+    std::vector<std::unique_ptr<Client>> clients;
+    for (size_t i = 0; i < client_hosts; i++) {
+        clients.emplace_back(new Client);
+        Client& client = *clients.back();
+        client.host.reset(new bench::QuietHost(client_peers));
+        client.thread =
+            std::thread(drive, std::ref(client), std::cref(addresses), i,
+                        std::cref(load), std::cref(stop_clients), tick);
+    }
+
+    auto connected = [&] { return sharded.connected_peers(); };
+    auto total = [&](std::atomic<uint64_t> enetcpp::HostMetrics::*counter) {
+        uint64_t out = 0;
+        for (auto& server : servers)
+            out += (server->host->metrics().*counter).load();
+        return out;
+    };
+
+    bench::Report report("connections");
+    for (size_t s = 0; s < steps.size(); s++) {
+        size_t target = steps[s];
+        for (size_t i = 0; i < client_hosts; i++)
+            clients[i]->target.store(target / client_hosts +
+                                     (i < target % client_hosts));
+        double ramp_start = bench::wall_seconds();
+        while (connected() < target &&
+               bench::wall_seconds() - ramp_start < ramp_timeout)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        double ramp = bench::wall_seconds() - ramp_start;
+
+        uint64_t messages = sharded.messages.load();
+        uint64_t disconnects =
+            total(&enetcpp::HostMetrics::disconnect_events);
+        double cpu = bench::cpu_seconds();
+        double start = bench::wall_seconds();
+        step.store(s);
+        std::this_thread::sleep_for(std::chrono::duration<double>(hold));
+        step.store(steps.size());
+        double elapsed = bench::wall_seconds() - start;
+        cpu = bench::cpu_seconds() - cpu;
+        messages = sharded.messages.load() - messages;
+        disconnects =
+            total(&enetcpp::HostMetrics::disconnect_events) - disconnects;
+
+        enetcpp::HistogramSnapshot ticks;
+        for (auto& server : servers)
+            ticks.merge(server->ticks[s].snapshot());
+        size_t peers = connected();
+        double peers_per_host = (double)peers / server_hosts;
+        bench::Result result;
+        result.add("target_peers", (long)target)
+            .add("connected_peers", (long)peers)
+            .add("server_hosts", (long)server_hosts)
+            .add("window_trim", (long)window_trim)
+            .add("peers_per_server_host", peers_per_host)
+            .add("ramp_seconds", ramp)
+            .add("ticks", (long)ticks.count())
+            .add("tick_mean_us", ticks.mean() / 1e3)
+            .add("tick_p50_us", ticks.p50() / 1e3)
+            .add("tick_p99_us", ticks.p99() / 1e3)
+            .add("tick_p999_us", ticks.p999() / 1e3)
+            .add("tick_max_us", ticks.max() / 1e3)
+            .add("tick_ns_per_peer",
+                 peers_per_host > 0 ? ticks.mean() / peers_per_host : 0.0)
+            .add("messages_per_second", messages / elapsed)
+            .add("expected_messages_per_second", peers * rate)
+            .add("disconnects", (long)disconnects)
+            .add("cpu_utilization", cpu / elapsed);
+        report.add(result);
+        std::cerr << "." << std::flush;
+    }
+    std::cerr << std::endl;
+
+    stop_clients.store(true);
+    for (auto& client : clients)
+        client->thread.join();
+    clients.clear();
+    stop_servers.store(true);
+    for (auto& server : servers)
+        server->thread.join();
+    report.write(output);
+    return 0;
+}
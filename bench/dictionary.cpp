@@ -0,0 +1,108 @@
+#include "bench.hpp"
+#include <enetcpp/enetcpp-compress.hpp>
+#include <enetcpp/enetcpp-pcap.hpp>
+#include <enetcpp/enetcpp.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Trains a DictionaryCompressor dictionary from a pcap capture and reports
+// how well it compresses the rest of the capture next to the plain LZ codec.
+// The first --train-fraction of the datagrams train the dictionary, the
+// remainder measure it, each stripped of its ENet protocol header (pass
+// --checksum if the captured hosts used Host::enable_checksum()). Datagrams
+// ENet already compressed are skipped.
+//
+//   bench_dictionary --pcap=<file> [--port=0 (all datagrams)] [--size=8192]
+//                    [--segment=32] [--train-fraction=0.5] [--checksum]
+//                    [--dictionary=<file to write>] [--output=]
+
+// Returns the part of a datagram ENet's compressor sees, or an empty vector
+// for datagrams that are too short or already compressed.
+static std::vector<uint8_t> payload(const std::vector<uint8_t>& datagram,
+                                    bool checksum) {
+    if (datagram.size() < 2)
+        return {};
+    uint16_t peer_id = (uint16_t)(datagram[0] << 8 | datagram[1]);
+    if (peer_id & ENET_PROTOCOL_HEADER_FLAG_COMPRESSED)
+        return {};
+    size_t header = (peer_id & ENET_PROTOCOL_HEADER_FLAG_SENT_TIME) ? 4 : 2;
+    if (checksum)
+        header += sizeof(enet_uint32);
+    if (datagram.size() <= header)
+        return {};
+    return std::vector<uint8_t>(datagram.begin() + header, datagram.end());
+}
+
+static void measure(bench::Result& result, const std::string& prefix,
+                    enetcpp::Compressor& codec,
+                    const std::vector<std::vector<uint8_t>>& samples) {
+    std::vector<uint8_t> out(ENET_PROTOCOL_MAXIMUM_MTU * 2);
+    uint64_t input = 0, output = 0;
+    double start = bench::wall_seconds();
+    for (const auto& sample : samples) {
+        out.resize(std::max(out.size(), sample.size()));
+        size_t size = codec.compress(sample.data(), sample.size(), out.data(),
+                                     out.size());
+        // ENet sends the original when compression does not help
+        input += sample.size();
+        output += size > 0 && size < sample.size() ? size : sample.size();
+    }
+    double elapsed = bench::wall_seconds() - start;
+    result.add((prefix + "_ratio").c_str(),
+               input ? (double)output / input : 1.0)
+        .add((prefix + "_ns_per_byte").c_str(),
+             input ? elapsed * 1e9 / input : 0.0);
+}
+
+int main(int argc, char** argv) {
+    bench::Options options(argc, argv);
+
+    std::string path = options.get("pcap", "");
+    if (path.empty())
+        throw std::runtime_error("--pcap=<file> is required");
+    long port = options.get_int("port", 0);
+    long size = options.get_int("size", 8192);
+    long segment = options.get_int("segment", 32);
+    double fraction = options.get_double("train-fraction", 0.5);
+    bool checksum = options.has("checksum");
+    std::string dictionary_path = options.get("dictionary", "");
+    std::string output = options.get("output", "");
+    options.check_unused();
+
+    enetcpp::PcapReplay capture(path);
+    std::vector<enetcpp::CapturedDatagram> datagrams =
+        port ? capture.to_port((uint16_t)port) : capture.datagrams();
+    std::vector<std::vector<uint8_t>> samples;
+    for (const auto& datagram : datagrams) {
+        std::vector<uint8_t> data = payload(datagram.data, checksum);
+        if (!data.empty())
+            samples.push_back(std::move(data));
+    }
+    size_t split = (size_t)(samples.size() * fraction);
+    std::vector<std::vector<uint8_t>> training(samples.begin(),
+                                               samples.begin() + split);
+    std::vector<std::vector<uint8_t>> evaluation(samples.begin() + split,
+                                                 samples.end());
+
+    double start = bench::wall_seconds();
+    enetcpp::DictionaryCompressor dictionary(
+        enetcpp::DictionaryCompressor::train(training, size, segment));
+    double training_seconds = bench::wall_seconds() - start;
+    if (!dictionary_path.empty())
+        dictionary.save(dictionary_path);
+
+    enetcpp::LZCompressor lz;
+    bench::Report report("dictionary");
+    bench::Result result;
+    result.add("training_datagrams", (long)training.size())
+        .add("evaluation_datagrams", (long)evaluation.size())
+        .add("dictionary_bytes", (long)dictionary.dictionary().size())
+        .add("dictionary_id", (long)dictionary.id())
+        .add("training_seconds", training_seconds);
+    measure(result, "lz", lz, evaluation);
+    measure(result, "dictionary", dictionary, evaluation);
+    report.add(result);
+    report.write(output);
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include "../test/pingpong.hpp"
+#include "bench.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <enetcpp/enetcpp-mt.hpp>
+#include <enetcpp/enetcpp.hpp>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Round-trip latency over 127.0.0.1 against a PingPong server (single
+// threaded Host, serviced with a fixed --service-timeout) and a HostMT echo
+// server using --run-loop (see RunLoopPolicy). Each stream is a client Host
+// with one ping in flight; pings carry their send time so the client measures
+// the full round trip. Prints a JSON report.
+//
+//   bench_latency [--servers=host,hostmt] [--streams=1,8] [--duration=2.0]
+//                 [--warmup=0.5] [--payload=32] [--interval=0]
+//                 [--service-timeout=10] [--run-loop=adaptive|fixed]
+//                 [--spin-us=200] [--port=23457] [--output=]
+//                 [--loss= --latency= --jitter= --reorder= --duplicate=
+//                  --bandwidth= --seed=1]
+
+class EchoThread : public enetcpp::ConnectionThread {
+  public:
+    using enetcpp::ConnectionThread::ConnectionThread;
+
+    void handle(enetcpp::Packet& packet) override {
+        enetcpp::Packet reply(packet.data(), packet.length());
+        peer().send(reply);
+    }
+};
+
+struct Ping {
+    uint64_t sent;
+    uint64_t sequence;
+};
+
+static uint64_t now_nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+class LatencyClient : public bench::QuietHost {
+  private:
+    std::vector<char> m_payload;
+    uint64_t m_sequence = 0;
+    uint64_t m_record_after;
+    std::chrono::microseconds m_interval;
+
+  public:
+    enetcpp::LatencyHistogram rtt;
+    std::atomic<bool> stopping{false};
+
+    LatencyClient(size_t payload, uint64_t record_after,
+                  std::chrono::microseconds interval)
+        : bench::QuietHost(1), m_payload(std::max(payload, sizeof(Ping))),
+          m_record_after(record_after), m_interval(interval) {}
+
+    void ping(enetcpp::Peer peer) {
+        Ping ping{now_nanoseconds(), m_sequence++};
+        memcpy(m_payload.data(), &ping, sizeof(ping));
+        enetcpp::Packet packet(m_payload.data(), m_payload.size());
+        peer.send(packet);
+    }
+
+    void on_event(enetcpp::EventReceive& event) override {
+        uint64_t now = now_nanoseconds();
+        Ping received;
+        memcpy(&received, event.packet().data(), sizeof(received));
+        if (received.sent >= m_record_after)
+            rtt.record(now - received.sent);
+        if (stopping.load(std::memory_order_relaxed))
+            return;
+        if (m_interval.count() > 0)
+            std::this_thread::sleep_for(m_interval);
+        ping(event.peer());
+        flush();
+    }
+};
+
+// The options that apply to every case, read before any case runs.
+struct Settings {
+    double duration;
+    double warmup;
+    size_t payload;
+    std::chrono::microseconds interval;
+    uint32_t timeout;
+    std::string run_loop;
+    std::chrono::microseconds spin;
+    long port;
+    bench::ImpairOptions impairment;
+
+    explicit Settings(const bench::Options& options)
+        : duration(options.get_double("duration", 2.0)),
+          warmup(options.get_double("warmup", 0.5)),
+          payload(options.get_int("payload", 32)),
+          interval((long)(options.get_double("interval", 0) * 1000)),
+          timeout(options.get_int("service-timeout", 10)),
+          run_loop(options.get("run-loop", "adaptive")),
+          spin(options.get_int("spin-us", 200)),
+          port(options.get_int("port", 23457)), impairment(options) {}
+};
+
+static bench::Result run_case(const std::string& server_type, long streams,
+                              const Settings& settings) {
+    double duration = settings.duration;
+    double warmup = settings.warmup;
+    size_t payload = settings.payload;
+    std::chrono::microseconds interval = settings.interval;
+    uint32_t timeout = settings.timeout;
+    const std::string& run_loop = settings.run_loop;
+    enetcpp::Address address("127.0.0.1", settings.port);
+    enetcpp::Logger quiet(enetcpp::Logger::NONE);
+
+    std::unique_ptr<PingPong> host_server;
+    std::unique_ptr<enetcpp::HostMT<EchoThread>> mt_server;
+    std::atomic<bool> stop_server{false};
+    bench::Failure failure;
+    std::thread server_thread;
+    if (server_type == "host") {
+        host_server.reset(new PingPong(address, streams + 8, 1, 0, 0, quiet));
+        host_server->set_quiet(true);
+        server_thread = std::thread([&] {
+            failure.guard([&] {
+                // the loop of HostMT::run with RunLoopPolicy::fixed
+                while (!stop_server.load(std::memory_order_relaxed)) {
+                    host_server->service(timeout);
+                    host_server->flush();
+                }
+            });
+        });
+    } else if (server_type == "hostmt") {
+        mt_server.reset(new enetcpp::HostMT<EchoThread>(
+            address, streams + 8, 1, 0, 0, quiet));
+        if (run_loop == "fixed")
+            mt_server->set_run_loop(enetcpp::RunLoopPolicy::fixed(timeout));
+        else if (run_loop == "adaptive")
+            mt_server->set_run_loop(
+                enetcpp::RunLoopPolicy::adaptive(settings.spin));
+        else
+            throw std::runtime_error("unknown run loop " + run_loop);
+        mt_server->launch();
+    } else {
+        throw std::runtime_error("unknown server " + server_type);
+    }
+
+    uint64_t record_after = now_nanoseconds() + (uint64_t)(warmup * 1e9);
+    std::vector<std::unique_ptr<LatencyClient>> clients;
+    std::vector<enetcpp::Peer> peers;
+    for (long i = 0; i < streams; i++) {
+        clients.emplace_back(
+            new LatencyClient(payload, record_after, interval));
+        bench::impair(*clients.back(), settings.impairment, i);
+        peers.push_back(clients.back()->connect(address));
+    }
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (long i = 0; i < streams; i++) {
+        threads.emplace_back([&, i] {
+            LatencyClient& client = *clients[i];
+            failure.guard([&] {
+                client.ping(peers[i]);
+                client.flush();
+                while (!stop.load(std::memory_order_relaxed))
+                    client.service(1);
+            });
+        });
+    }
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(warmup + duration));
+    for (auto& client : clients)
+        client->stopping.store(true, std::memory_order_relaxed);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& thread : threads)
+        thread.join();
+
+    enetcpp::HistogramSnapshot rtt;
+    for (size_t i = 0; i < clients.size(); i++) {
+        rtt.merge(clients[i]->rtt.snapshot());
+        enet_peer_disconnect_now(peers[i].get(), 0);
+    }
+    if (mt_server) {
+        // let the server see the disconnects and join its connection threads
+        double deadline = bench::wall_seconds() + 2.0;
+        while (mt_server->metrics().connection_threads.load() > 0 &&
+               bench::wall_seconds() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        mt_server->quit();
+        mt_server->join();
+    } else {
+        stop_server.store(true, std::memory_order_relaxed);
+        server_thread.join();
+    }
+
+    auto us = [&](double quantile) { return rtt.percentile(quantile) / 1e3; };
+    bench::Result result;
+    result.add("server", server_type)
+        .add("run_loop", server_type == "hostmt" ? run_loop : "fixed")
+        .add("streams", streams)
+        .add("payload_bytes", (long)payload)
+        .add("interval_ms", interval.count() / 1e3)
+        .add("samples", (long)rtt.count())
+        .add("pings_per_second", rtt.count() / duration)
+        .add("min_us", rtt.min() / 1e3)
+        .add("mean_us", rtt.mean() / 1e3)
+        .add("p50_us", us(0.5))
+        .add("p90_us", us(0.9))
+        .add("p99_us", us(0.99))
+        .add("p999_us", us(0.999))
+        .add("p9999_us", us(0.9999))
+        .add("max_us", rtt.max() / 1e3);
+    failure.report(result);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bench::Options options(argc, argv);
+    enetcpp::initialize();
+
+    std::vector<std::string> servers =
+        options.get_strings("servers", {"host", "hostmt"});
+    std::vector<long> streams = options.get_ints("streams", {1, 8});
+    Settings settings(options);
+    std::string output = options.get("output", "");
+    options.check_unused();
+
+    bench::Report report("latency");
+    for (const std::string& server : servers)
+        for (long n : streams) {
+            report.add(run_case(server, n, settings));
+            std::cerr << "." << std::flush;
+        }
+    std::cerr << std::endl;
+    report.write(output);
+    return 0;
+}
@@ -0,0 +1,298 @@
+#include "micro.hpp"
+#include <algorithm>
+#include <cstring>
+#include <enetcpp/enetcpp-compress.hpp>
+#include <enetcpp/enetcpp-mt.hpp>
+#include <enetcpp/enetcpp-shim.hpp>
+#include <enetcpp/enetcpp.hpp>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+// Microbenchmarks of the wrapper's hot paths, reported as nanoseconds per
+// operation. Enabled Logger output goes to /dev/null so stdout only carries
+// the report.
+//
+//   bench_micro [--filter=<substring>] [--min-time=0.1] [--repetitions=5]
+//               [--port=23470] [--output=]
+
+static uint16_t s_port = 23470;
+
+class CountingHost : public bench::QuietHost {
+  public:
+    using bench::QuietHost::QuietHost;
+
+    long connects = 0;
+    long received = 0;
+
+    void on_event(enetcpp::EventConnect&) override { connects++; }
+    void on_event(enetcpp::EventReceive&) override { received++; }
+};
+
+static void packet_create_destroy(bench::State& state) {
+    std::vector<uint8_t> data(state.arg(), 0x5a);
+    for (auto _ : state) {
+        enetcpp::Packet packet(data.data(), data.size());
+        bench::do_not_optimize(packet.get());
+    }
+    state.set_bytes_per_iteration(data.size());
+}
+BENCH_MICRO(packet_create_destroy, 16, 64, 256, 1024, 4096, 65536);
+
+static void event_construct(bench::State& state) {
+    ENetPeer peer;
+    memset(&peer, 0, sizeof(peer));
+    ENetEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = ENET_EVENT_TYPE_CONNECT;
+    event.peer = &peer;
+    for (auto _ : state) {
+        enetcpp::EventConnect connect(event);
+        bench::do_not_optimize(connect);
+    }
+}
+BENCH_MICRO(event_construct);
+
+static void event_receive_construct(bench::State& state) {
+    ENetPeer peer;
+    memset(&peer, 0, sizeof(peer));
+    uint8_t data[64] = {0};
+    ENetEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = ENET_EVENT_TYPE_RECEIVE;
+    event.peer = &peer;
+    event.packet = enet_packet_create(data, sizeof(data), 0);
+    for (auto _ : state) {
+        enetcpp::EventReceive receive(event);
+        receive.packet().release_ownership();
+        bench::do_not_optimize(receive);
+    }
+    enet_packet_destroy(event.packet);
+}
+BENCH_MICRO(event_receive_construct);
+
+static void host_service_idle(bench::State& state) {
+    bench::QuietHost host(1);
+    for (auto _ : state)
+        bench::do_not_optimize(host.service());
+}
+BENCH_MICRO(host_service_idle);
+
+// One unsequenced packet is sent and flushed with the timer paused, so only
+// the server's service() receiving and dispatching it is timed. The hosts are
+// connected through a MemoryNetwork when socket shims are linked in, otherwise
+// over 127.0.0.1.
+static void host_service_one_event(bench::State& state) {
+    std::unique_ptr<enetcpp::MemoryNetwork> network;
+    std::unique_ptr<CountingHost> server, client;
+    enetcpp::Address address("127.0.0.1", s_port);
+    if (enetcpp::SocketShims::installed()) {
+        network.reset(new enetcpp::MemoryNetwork());
+        address = enetcpp::Address("10.0.0.1", 1000);
+        server.reset(new CountingHost(1));
+        client.reset(new CountingHost(1));
+        network->attach(*server, address);
+        network->attach(*client, enetcpp::Address("10.0.0.2", 1000));
+    } else {
+        server.reset(new CountingHost(address, 1));
+        client.reset(new CountingHost(1));
+    }
+    enetcpp::Peer peer = client->connect_async(address);
+    for (int i = 0; i < 5000 && (!server->connects || !client->connects);
+         i++) {
+        client->service(1);
+        server->service(1);
+    }
+    if (!server->connects || !client->connects)
+        throw std::runtime_error("host_service_one_event failed to connect");
+
+    uint8_t payload[32] = {0};
+    for (auto _ : state) {
+        state.pause_timing();
+        enetcpp::Packet packet(payload, sizeof(payload),
+                               ENET_PACKET_FLAG_UNSEQUENCED);
+        peer.send(packet);
+        client->service();
+        state.resume_timing();
+        server->service();
+    }
+    if ((size_t)server->received < state.iterations())
+        std::cerr << "host_service_one_event: only " << server->received
+                  << " of " << state.iterations() << " events dispatched"
+                  << std::endl;
+}
+BENCH_MICRO(host_service_one_event);
+
+static void logger_disabled(bench::State& state) {
+    enetcpp::Logger logger(enetcpp::Logger::MINIMAL);
+    int value = 0;
+    for (auto _ : state)
+        logger.debug("peer %u sent %d bytes", 7u, value++);
+}
+BENCH_MICRO(logger_disabled);
+
+// The backend is flushed with the timer paused so the ring never fills and
+// every call takes the enqueue path rather than the drop path.
+static void logger_enabled(bench::State& state) {
+    enetcpp::Logger logger(enetcpp::Logger::INFO);
+    int value = 0;
+    for (auto _ : state) {
+        logger.info("peer %u sent %d bytes", 7u, value++);
+        if ((value & 255) == 0) {
+            state.pause_timing();
+            enetcpp::Logger::flush();
+            state.resume_timing();
+        }
+    }
+    enetcpp::Logger::flush();
+}
+BENCH_MICRO(logger_enabled);
+
+static void connection_thread_queue_dequeue(bench::State& state) {
+    bench::QuietHost host(1);
+    enetcpp::ConnectionThread thread(host, enetcpp::Address(),
+                                     enetcpp::Peer(&host.get()->peers[0]));
+    uint8_t data[64] = {0};
+    ENetPacket* packet = enet_packet_create(data, sizeof(data), 0);
+    for (auto _ : state) {
+        thread.queue_packet(packet);
+        bench::do_not_optimize(thread.dequeue_packet());
+    }
+    enet_packet_destroy(packet);
+}
+BENCH_MICRO(connection_thread_queue_dequeue);
+
+static void address_host_string(bench::State& state) {
+    enetcpp::Address address("127.0.0.1", 1234);
+    for (auto _ : state) {
+        std::string host = address.host_string();
+        bench::do_not_optimize(host.size());
+    }
+}
+BENCH_MICRO(address_host_string);
+
+// Checksums over one datagram of arg() bytes split into a header and a body
+// buffer, the way ENet passes them.
+static void checksum(bench::State& state, ENetChecksumCallback callback) {
+    std::vector<uint8_t> data(state.arg());
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 131 + 7);
+    ENetBuffer buffers[2];
+    buffers[0].data = data.data();
+    buffers[0].dataLength = std::min<size_t>(data.size(), 12);
+    buffers[1].data = data.data() + buffers[0].dataLength;
+    buffers[1].dataLength = data.size() - buffers[0].dataLength;
+    for (auto _ : state)
+        bench::do_not_optimize(callback(buffers, 2));
+    state.set_bytes_per_iteration(data.size());
+}
+
+static void checksum_enet_crc32(bench::State& state) {
+    checksum(state, enet_crc32);
+}
+BENCH_MICRO(checksum_enet_crc32, 64, 512, 1400, 4096);
+
+static void checksum_crc32(bench::State& state) {
+    checksum(state, enetcpp::Checksum::callback(enetcpp::ChecksumKind::CRC32));
+}
+BENCH_MICRO(checksum_crc32, 64, 512, 1400, 4096);
+
+static uint32_t ENET_CALLBACK crc32c_portable(const ENetBuffer* buffers,
+                                              size_t buffer_count) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < buffer_count; i++)
+        crc = enetcpp::Checksum::crc32c_portable(crc, buffers[i].data,
+                                                 buffers[i].dataLength);
+    return ~crc;
+}
+
+static void checksum_crc32c_portable(bench::State& state) {
+    checksum(state, crc32c_portable);
+}
+BENCH_MICRO(checksum_crc32c_portable, 64, 512, 1400, 4096);
+
+static void checksum_crc32c(bench::State& state) {
+    checksum(state,
+             enetcpp::Checksum::callback(enetcpp::ChecksumKind::CRC32C));
+}
+BENCH_MICRO(checksum_crc32c, 64, 512, 1400, 4096);
+
+// A datagram of arg() bytes of 24 byte entity records: an increasing id,
+// three slowly changing floats, and flags that are mostly zero.
+static std::vector<uint8_t> entity_datagram(size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t offset = 0, id = 1000; offset < size; offset += 24, id++) {
+        struct {
+            uint32_t id;
+            float x, y, z;
+            uint32_t flags[2];
+        } record = {(uint32_t)id, id * 0.5f, 10.0f, id * 0.25f, {0, 0}};
+        memcpy(data.data() + offset, &record,
+               std::min(sizeof(record), size - offset));
+    }
+    return data;
+}
+
+static void lz_compress(bench::State& state) {
+    enetcpp::LZCompressor lz;
+    std::vector<uint8_t> data = entity_datagram(state.arg());
+    std::vector<uint8_t> out(data.size());
+    for (auto _ : state)
+        bench::do_not_optimize(
+            lz.compress(data.data(), data.size(), out.data(), out.size()));
+    state.set_bytes_per_iteration(data.size());
+}
+BENCH_MICRO(lz_compress, 256, 1400, 4096);
+
+static void lz_decompress(bench::State& state) {
+    enetcpp::LZCompressor lz;
+    std::vector<uint8_t> data = entity_datagram(state.arg());
+    std::vector<uint8_t> compressed(data.size());
+    size_t size = lz.compress(data.data(), data.size(), compressed.data(),
+                              compressed.size());
+    for (auto _ : state)
+        bench::do_not_optimize(lz.decompress(compressed.data(), size,
+                                             data.data(), data.size()));
+    state.set_bytes_per_iteration(data.size());
+}
+BENCH_MICRO(lz_decompress, 256, 1400, 4096);
+
+static void range_coder_compress(bench::State& state) {
+    void* coder = enet_range_coder_create();
+    std::vector<uint8_t> data = entity_datagram(state.arg());
+    std::vector<uint8_t> out(data.size());
+    ENetBuffer buffer;
+    buffer.data = data.data();
+    buffer.dataLength = data.size();
+    for (auto _ : state)
+        bench::do_not_optimize(enet_range_coder_compress(
+            coder, &buffer, 1, data.size(), out.data(), out.size()));
+    state.set_bytes_per_iteration(data.size());
+    enet_range_coder_destroy(coder);
+}
+BENCH_MICRO(range_coder_compress, 256, 1400, 4096);
+
+int main(int argc, char** argv) {
+    bench::Options options(argc, argv);
+    enetcpp::initialize();
+    s_port = (uint16_t)options.get_int("port", s_port);
+
+    std::string output = options.get("output", "");
+    bench::MicroOptions micro_options(options);
+    options.check_unused();
+    FILE* report_file = NULL;
+    if (output.empty())
+        report_file = fdopen(dup(fileno(stdout)), "w");
+    if (!freopen("/dev/null", "w", stdout))
+        throw std::runtime_error("Failed to redirect stdout");
+
+    bench::Report report = bench::run_micros(micro_options);
+    if (report_file) {
+        report.write(report_file);
+        fclose(report_file);
+    } else {
+        report.write(output);
+    }
+    return 0;
+}
@@ -0,0 +1,222 @@
+#ifndef _BENCH_MICRO_HPP_
+#define _BENCH_MICRO_HPP_
+
+#include "bench.hpp"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/**
+ * @brief Keeps the compiler from optimizing away a value.
+ */
+template <typename T> inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * @brief Forces pending writes to memory.
+ */
+inline void clobber_memory() { asm volatile("" : : : "memory"); }
+
+/**
+ * @brief Timing state of one microbenchmark run, in the style of Google
+ * Benchmark: the body loops with `for (auto _ : state)`.
+ */
+class State {
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    size_t m_iterations;
+    long m_arg;
+    Clock::time_point m_start;
+    Clock::time_point m_paused_at;
+    Clock::duration m_paused{0};
+    Clock::duration m_elapsed{0};
+    size_t m_bytes = 0;
+
+    void stop() { m_elapsed = Clock::now() - m_start - m_paused; }
+
+  public:
+    class Iterator {
+      private:
+        State* m_state;
+        size_t m_remaining;
+
+      public:
+        // marked unused so `for (auto _ : state)` does not warn
+        struct __attribute__((unused)) Value {};
+
+        Iterator(State* state, size_t remaining)
+            : m_state(state), m_remaining(remaining) {}
+
+        bool operator!=(const Iterator&) {
+            if (m_remaining > 0)
+                return true;
+            m_state->stop();
+            return false;
+        }
+
+        void operator++() { m_remaining--; }
+
+        Value operator*() const { return Value(); }
+    };
+
+    State(size_t iterations, long arg) : m_iterations(iterations), m_arg(arg) {}
+
+    Iterator begin() {
+        m_start = Clock::now();
+        return Iterator(this, m_iterations);
+    }
+
+    Iterator end() { return Iterator(this, 0); }
+
+    /**
+     * @brief Returns the benchmark argument, e.g. a packet size.
+     */
+    long arg() const { return m_arg; }
+
+    /**
+     * @brief Returns the number of iterations of this run.
+     */
+    size_t iterations() const { return m_iterations; }
+
+    /**
+     * @brief Stops the timer, e.g. around per-iteration setup.
+     *
+     * A pause and resume still adds a few tens of nanoseconds to the
+     * iteration, so only use it around much more expensive work.
+     */
+    void pause_timing() { m_paused_at = Clock::now(); }
+
+    /**
+     * @brief Restarts the timer after `pause_timing()`.
+     */
+    void resume_timing() { m_paused += Clock::now() - m_paused_at; }
+
+    /**
+     * @brief Sets the bytes processed per iteration, to report a rate.
+     */
+    void set_bytes_per_iteration(size_t bytes) { m_bytes = bytes; }
+
+    size_t bytes_per_iteration() const { return m_bytes; }
+
+    /**
+     * @brief Returns the timed seconds of the run.
+     */
+    double seconds() const {
+        return std::chrono::duration<double>(m_elapsed).count();
+    }
+};
+
+/**
+ * @brief A registered microbenchmark, run once per argument.
+ */
+struct Micro {
+    std::string name;
+    void (*function)(State&);
+    std::vector<long> args;
+};
+
+inline std::vector<Micro>& micro_registry() {
+    static std::vector<Micro> registry;
+    return registry;
+}
+
+struct MicroRegistration {
+    MicroRegistration(const char* name, void (*function)(State&),
+                      std::vector<long> args = {}) {
+        micro_registry().push_back({name, function, std::move(args)});
+    }
+};
+
+/**
+ * @brief Registers a microbenchmark, optionally with a list of arguments.
+ */
+#define BENCH_MICRO(function, ...)                                             \
+    static bench::MicroRegistration function##_registration(                   \
+        #function, function, {__VA_ARGS__})
+
+/**
+ * @brief How `run_micros()` runs: `--filter`, `--min-time` and
+ * `--repetitions`.
+ */
+struct MicroOptions {
+    std::string filter;
+    double min_time;
+    long repetitions;
+
+    explicit MicroOptions(const Options& options)
+        : filter(options.get("filter", "")),
+          min_time(options.get_double("min-time", 0.1)),
+          repetitions(std::max(1L, options.get_int("repetitions", 5))) {}
+};
+
+/**
+ * @brief Runs every registered microbenchmark whose name contains
+ * `--filter`.
+ *
+ * The iteration count grows until a run takes `--min-time` seconds (default
+ * 0.1), then the run is repeated `--repetitions` times (default 5) and the
+ * median and minimum time per iteration are reported.
+ */
+inline Report run_micros(const MicroOptions& options) {
+    const std::string& filter = options.filter;
+    double min_time = options.min_time;
+    long repetitions = options.repetitions;
+    Report report("micro");
+    for (const Micro& micro : micro_registry()) {
+        std::vector<long> args = micro.args;
+        if (args.empty())
+            args.push_back(0);
+        for (long arg : args) {
+            std::string name = micro.name;
+            if (!micro.args.empty())
+                name += "/" + std::to_string(arg);
+            if (name.find(filter) == std::string::npos)
+                continue;
+
+            size_t iterations = 1;
+            while (true) {
+                State state(iterations, arg);
+                micro.function(state);
+                double seconds = state.seconds();
+                if (seconds >= min_time || iterations >= (1UL << 40))
+                    break;
+                double scale = seconds > 0 ? 1.4 * min_time / seconds : 10;
+                iterations = std::max(
+                    iterations + 1,
+                    (size_t)(iterations * std::min(scale, 10.0)));
+            }
+
+            std::vector<double> ns;
+            size_t bytes = 0;
+            for (long r = 0; r < repetitions; r++) {
+                State state(iterations, arg);
+                micro.function(state);
+                ns.push_back(state.seconds() * 1e9 / iterations);
+                bytes = state.bytes_per_iteration();
+            }
+            std::sort(ns.begin(), ns.end());
+            double median = ns[ns.size() / 2];
+            Result result;
+            result.add("name", name)
+                .add("iterations", (long)iterations)
+                .add("repetitions", repetitions)
+                .add("ns_per_op", median)
+                .add("ns_per_op_min", ns.front())
+                .add("ns_per_op_max", ns.back());
+            if (bytes > 0)
+                result.add("bytes_per_second", bytes * 1e9 / median);
+            report.add(result);
+            std::cerr << name << ": " << median << " ns" << std::endl;
+        }
+    }
+    return report;
+}
+
+} // namespace bench
+
+#endif // _BENCH_MICRO_HPP_
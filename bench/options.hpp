@@ -0,0 +1,120 @@
+#ifndef _BENCH_OPTIONS_HPP_
+#define _BENCH_OPTIONS_HPP_
+
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/**
+ * @brief Command line options of the form `--name=value`.
+ *
+ * A bare `--name` is treated as `--name=1`. List options are comma
+ * separated, e.g. `--sizes=16,256,1024`. The options read are recorded, so
+ * that `check_unused()` can reject misspelt ones.
+ */
+class Options {
+  private:
+    std::map<std::string, std::string> m_values;
+    mutable std::set<std::string> m_read;
+
+    const std::string* find(const std::string& name) const {
+        m_read.insert(name);
+        auto it = m_values.find(name);
+        return it == m_values.end() ? NULL : &it->second;
+    }
+
+    static std::vector<std::string> split(const std::string& value) {
+        std::vector<std::string> out;
+        size_t start = 0;
+        while (start <= value.size()) {
+            size_t end = value.find(',', start);
+            if (end == std::string::npos)
+                end = value.size();
+            if (end > start)
+                out.push_back(value.substr(start, end - start));
+            start = end + 1;
+        }
+        return out;
+    }
+
+  public:
+    /**
+     * @brief Parses the command line.
+     * @throws std::runtime_error on arguments not starting with `--`.
+     */
+    Options(int argc, char** argv) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0)
+                throw std::runtime_error("unexpected argument " + arg);
+            size_t equals = arg.find('=');
+            if (equals == std::string::npos)
+                m_values[arg.substr(2)] = "1";
+            else
+                m_values[arg.substr(2, equals - 2)] = arg.substr(equals + 1);
+        }
+    }
+
+    bool has(const std::string& name) const { return find(name) != NULL; }
+
+    std::string get(const std::string& name,
+                    const std::string& fallback) const {
+        const std::string* value = find(name);
+        return value ? *value : fallback;
+    }
+
+    long get_int(const std::string& name, long fallback) const {
+        const std::string* value = find(name);
+        return value ? std::stol(*value) : fallback;
+    }
+
+    double get_double(const std::string& name, double fallback) const {
+        const std::string* value = find(name);
+        return value ? std::stod(*value) : fallback;
+    }
+
+    std::vector<std::string>
+    get_strings(const std::string& name,
+                const std::vector<std::string>& fallback) const {
+        const std::string* value = find(name);
+        return value ? split(*value) : fallback;
+    }
+
+    std::vector<long> get_ints(const std::string& name,
+                               const std::vector<long>& fallback) const {
+        const std::string* value = find(name);
+        if (!value)
+            return fallback;
+        std::vector<long> out;
+        for (const std::string& item : split(*value))
+            out.push_back(std::stol(item));
+        return out;
+    }
+
+    /**
+     * @brief Rejects options that were given but never read.
+     *
+     * Call once every option has been read and before the benchmark runs,
+     * so that a typo such as `--pacng=timer` fails instead of running the
+     * default configuration. Reads are recorded without a lock, so finish
+     * them before starting threads.
+     *
+     * @throws std::runtime_error naming the unknown options.
+     */
+    void check_unused() const {
+        std::string unknown;
+        for (const auto& value : m_values)
+            if (m_read.count(value.first) == 0)
+                unknown += (unknown.empty() ? "--" : ", --") + value.first;
+        if (!unknown.empty())
+            throw std::runtime_error("unknown option " + unknown);
+    }
+};
+
+} // namespace bench
+
+#endif // _BENCH_OPTIONS_HPP_
@@ -0,0 +1,86 @@
+#include "bench.hpp"
+#include <enetcpp/enetcpp-pcap.hpp>
+#include <enetcpp/enetcpp.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// Replays a pcap capture into a fresh server Host as fast as it can take it
+// and reports the service latency. Capture a busy server with
+// PcapCapture::attach() (or bench_throughput --capture=), or with tcpdump, and
+// pass the server's port so only its incoming datagrams are replayed.
+// Anything the host sends is discarded.
+//
+//   bench_replay --pcap=<file> [--port=0 (all datagrams)] [--peers=4095]
+//                [--channels=255] [--speed=0 (as fast as possible)]
+//                [--repeat=1] [--output=]
+
+class ReplayHost : public bench::QuietHost {
+  public:
+    using bench::QuietHost::QuietHost;
+
+    long connects = 0;
+    long disconnects = 0;
+    long messages = 0;
+
+    void on_event(enetcpp::EventConnect&) override { connects++; }
+    void on_event(enetcpp::EventDisconnect&) override { disconnects++; }
+    void on_event(enetcpp::EventReceive&) override { messages++; }
+};
+
+int main(int argc, char** argv) {
+    bench::Options options(argc, argv);
+    enetcpp::initialize(true);
+
+    std::string path = options.get("pcap", "");
+    if (path.empty())
+        throw std::runtime_error("--pcap=<file> is required");
+    long port = options.get_int("port", 0);
+    long peers = options.get_int("peers", ENET_PROTOCOL_MAXIMUM_PEER_ID);
+    long channels = options.get_int("channels", 255);
+    double speed = options.get_double("speed", 0);
+    long repeat = options.get_int("repeat", 1);
+    std::string output = options.get("output", "");
+    options.check_unused();
+
+    bench::Report report("replay");
+    for (long i = 0; i < repeat; i++) {
+        ReplayHost host(peers, channels);
+        auto replay =
+            enetcpp::ReplayShim::attach(host, path, (uint16_t)port, speed);
+        double cpu = bench::cpu_seconds();
+        double start = bench::wall_seconds();
+        while (!replay->done())
+            host.service_batch(speed > 0 ? 1 : 0);
+        // let ENet dispatch whatever the last datagrams completed
+        host.service_batch();
+        double elapsed = bench::wall_seconds() - start;
+        cpu = bench::cpu_seconds() - cpu;
+
+        enetcpp::HistogramSnapshot service =
+            host.latency(enetcpp::LatencyStage::SERVICE);
+        enetcpp::HistogramSnapshot dispatch =
+            host.latency(enetcpp::LatencyStage::DISPATCH);
+        bench::Result result;
+        result.add("pcap", path)
+            .add("datagrams", (long)replay->delivered())
+            .add("sent_datagrams", (long)replay->discarded())
+            .add("connects", host.connects)
+            .add("disconnects", host.disconnects)
+            .add("messages", host.messages)
+            .add("seconds", elapsed)
+            .add("datagrams_per_second", replay->delivered() / elapsed)
+            .add("cpu_seconds", cpu)
+            .add("service_calls", (long)service.count())
+            .add("service_p50_us", service.p50() / 1e3)
+            .add("service_p99_us", service.p99() / 1e3)
+            .add("service_p999_us", service.p999() / 1e3)
+            .add("service_max_us", service.max() / 1e3)
+            .add("dispatch_p99_us", dispatch.p99() / 1e3)
+            .add("dispatch_max_us", dispatch.max() / 1e3);
+        report.add(result);
+        host.clear_shims();
+    }
+    report.write(output);
+    return 0;
+}
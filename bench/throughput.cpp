@@ -0,0 +1,324 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <atomic>
+#include <enetcpp/enetcpp-compress.hpp>
+#include <enetcpp/enetcpp-congestion.hpp>
+#include <enetcpp/enetcpp-mtu.hpp>
+#include <enetcpp/enetcpp-pacing.hpp>
+#include <enetcpp/enetcpp-pcap.hpp>
+#include <enetcpp/enetcpp.hpp>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Loopback throughput: one server Host and N client Hosts in this process,
+// each client sending as fast as ENet's queues allow. Prints a JSON report.
+// --transport=memory connects the hosts through a MemoryNetwork instead of
+// UDP sockets, leaving only protocol and wrapper cost. --capture writes the
+// server's datagrams to a pcap file for bench_replay. --congestion=bbr runs
+// the clients' peers under CongestionController, for comparison with ENet's
+// own throttle on impaired links, and --fast-retransmit attaches
+// FastRetransmit to them, to compare loss recovery with --loss. --pacing
+// paces the clients' datagrams with a Pacer. --adaptive-compression
+// compresses the clients' datagrams per peer with an AdaptiveCompressor.
+// --pmtu runs PathMtuDiscovery on the clients and reports the MTU found.
+//
+//   bench_throughput [--clients=4] [--sizes=16,256,1024,4096]
+//                    [--reliability=reliable,unreliable,unsequenced]
+//                    [--channels=1,4] [--duration=1.0] [--warmup=0.2]
+//                    [--batch=64] [--queue=1024] [--port=23456] [--output=]
+//                    [--transport=udp|memory] [--capture=<pcap file>]
+//                    [--congestion=enet|bbr] [--fast-retransmit]
+//                    [--pacing=off|auto|txtime|timer]
+//                    [--adaptive-compression] [--pmtu]
+//                    [--loss= --latency= --jitter= --reorder= --duplicate=
+//                     --bandwidth= --seed=1]
+
+class CountingServer : public bench::QuietHost {
+  public:
+    using bench::QuietHost::QuietHost;
+
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> bytes{0};
+
+    void on_event(enetcpp::EventReceive& event) override {
+        packets.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(event.packet().length(), std::memory_order_relaxed);
+    }
+};
+
+static uint32_t reliability_flags(const std::string& name) {
+    if (name == "reliable")
+        return ENET_PACKET_FLAG_RELIABLE;
+    if (name == "unreliable")
+        return 0;
+    if (name == "unsequenced")
+        return ENET_PACKET_FLAG_UNSEQUENCED;
+    throw std::runtime_error("unknown reliability " + name);
+}
+
+static enetcpp::PacingMode pacing_mode(const std::string& name) {
+    if (name == "auto")
+        return enetcpp::PacingMode::AUTO;
+    if (name == "txtime")
+        return enetcpp::PacingMode::TXTIME;
+    if (name == "timer")
+        return enetcpp::PacingMode::TIMER;
+    throw std::runtime_error("unknown pacing " + name);
+}
+
+struct Case {
+    long clients;
+    long size;
+    std::string reliability;
+    long channels;
+};
+
+// The options that apply to every case, read before any case runs.
+struct Settings {
+    double duration;
+    double warmup;
+    long batch;
+    size_t queue;
+    std::string congestion;
+    bool fast_retransmit;
+    std::string pacing;
+    bool compression;
+    bool pmtu;
+    bench::ImpairOptions impairment;
+
+    explicit Settings(const bench::Options& options)
+        : duration(options.get_double("duration", 1.0)),
+          warmup(options.get_double("warmup", 0.2)),
+          batch(options.get_int("batch", 64)),
+          queue(options.get_int("queue", 1024)),
+          congestion(options.get("congestion", "enet")),
+          fast_retransmit(options.has("fast-retransmit")),
+          pacing(options.get("pacing", "off")),
+          compression(options.has("adaptive-compression")),
+          pmtu(options.has("pmtu")), impairment(options) {
+        if (congestion != "enet" && congestion != "bbr")
+            throw std::runtime_error("unknown congestion control " +
+                                     congestion);
+    }
+};
+
+static bench::Result run_case(CountingServer& server,
+                              const enetcpp::Address& address, const Case& c,
+                              const Settings& settings,
+                              enetcpp::MemoryNetwork* network) {
+    double duration = settings.duration;
+    double warmup = settings.warmup;
+    long batch = settings.batch;
+    size_t queue = settings.queue;
+    uint32_t flags = reliability_flags(c.reliability);
+    const std::string& congestion = settings.congestion;
+    bool fast_retransmit = settings.fast_retransmit;
+    const std::string& pacing = settings.pacing;
+    bool compression = settings.compression;
+    bool pmtu = settings.pmtu;
+    std::vector<std::shared_ptr<enetcpp::FastRetransmit>> retransmits;
+    std::vector<std::shared_ptr<enetcpp::PathMtuDiscovery>> discoveries;
+
+    std::vector<std::unique_ptr<bench::QuietHost>> clients;
+    std::vector<enetcpp::Peer> peers;
+    for (long i = 0; i < c.clients; i++) {
+        clients.emplace_back(new bench::QuietHost(1, c.channels));
+        if (network)
+            network->attach(*clients.back(),
+                            enetcpp::Address("10.0.0.2", 1000 + i));
+        if (pacing != "off") {
+            // first, so that it sits directly above the socket
+            enetcpp::PacingPolicy policy;
+            policy.mode = pacing_mode(pacing);
+            enetcpp::Pacer::attach(*clients.back(), policy);
+        }
+        if (pmtu) {
+            // below the compressor, so that probes keep their size
+            discoveries.push_back(
+                enetcpp::PathMtuDiscovery::attach(*clients.back()));
+        }
+        if (compression) {
+            // below the shims that parse ENet's commands
+            enetcpp::AdaptiveCompressor::attach(
+                *clients.back(), std::make_shared<enetcpp::LZCompressor>());
+        }
+        bench::impair(*clients.back(), settings.impairment, i);
+        if (congestion == "bbr")
+            enetcpp::CongestionController::attach(*clients.back());
+        if (fast_retransmit)
+            retransmits.push_back(
+                enetcpp::FastRetransmit::attach(*clients.back()));
+        peers.push_back(clients.back()->connect(address, c.channels));
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> sent{0};
+    bench::Failure failure;
+    std::vector<std::thread> threads;
+    std::vector<char> payload(c.size, 'x');
+    for (long i = 0; i < c.clients; i++) {
+        threads.emplace_back([&, i] {
+            bench::QuietHost& client = *clients[i];
+            enetcpp::Peer peer = peers[i];
+            uint64_t count = 0;
+            failure.guard([&] {
+                while (!stop.load(std::memory_order_relaxed)) {
+                    // only top up the queue, so reliable runs measure the
+                    // transport rather than an ever-growing backlog
+                    if (peer.stats().outgoing_commands < queue) {
+                        for (long j = 0; j < batch; j++, count++) {
+                            enetcpp::Packet packet(payload.data(),
+                                                   payload.size(), flags);
+                            peer.send(packet, (uint8_t)(count % c.channels));
+                        }
+                    }
+                    while (client.service(0) > 0) {
+                    }
+                    client.flush();
+                }
+            });
+            sent.fetch_add(count, std::memory_order_relaxed);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(warmup));
+    uint64_t packets = server.packets.load(std::memory_order_relaxed);
+    uint64_t bytes = server.bytes.load(std::memory_order_relaxed);
+    uint64_t allocations = enetcpp::AllocationTracker::allocations();
+    double cpu = bench::cpu_seconds();
+    double start = bench::wall_seconds();
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+    packets = server.packets.load(std::memory_order_relaxed) - packets;
+    bytes = server.bytes.load(std::memory_order_relaxed) - bytes;
+    allocations = enetcpp::AllocationTracker::allocations() - allocations;
+    cpu = bench::cpu_seconds() - cpu;
+    double elapsed = bench::wall_seconds() - start;
+
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& thread : threads)
+        thread.join();
+    double mtu = 0;
+    uint64_t mtu_probes = 0;
+    for (size_t i = 0; i < discoveries.size(); i++) {
+        mtu += peers[i].stats().mtu;
+        mtu_probes += discoveries[i]->state(peers[i]).probes;
+    }
+    if (!discoveries.empty())
+        mtu /= discoveries.size();
+    for (size_t i = 0; i < clients.size(); i++) {
+        enet_peer_disconnect_now(peers[i].get(), 0);
+        clients[i]->flush();
+    }
+
+    uint64_t fast_retransmits = 0;
+    for (auto& shim : retransmits)
+        fast_retransmits += shim->retransmits();
+    uint64_t compressed = 0, compress_input = 0, compress_output = 0;
+    for (auto& client : clients) {
+        const enetcpp::HostMetrics& metrics = client->metrics();
+        compressed += metrics.compressed_datagrams.load();
+        compress_input += metrics.compress_input_bytes.load();
+        compress_output += metrics.compress_output_bytes.load();
+    }
+
+    bench::Result result;
+    result.add("transport", network ? "memory" : "udp")
+        .add("congestion", congestion)
+        .add("fast_retransmit", fast_retransmit ? "on" : "off")
+        .add("fast_retransmits", (long)fast_retransmits)
+        .add("pacing", pacing)
+        .add("adaptive_compression", compression ? "on" : "off")
+        .add("compressed_datagrams", (long)compressed)
+        .add("compression_ratio",
+             compress_input ? (double)compress_output / compress_input : 1.0)
+        .add("pmtu", pmtu ? "on" : "off")
+        .add("mtu", mtu)
+        .add("mtu_probes", (long)mtu_probes)
+        .add("clients", c.clients)
+        .add("payload_bytes", c.size)
+        .add("reliability", c.reliability)
+        .add("channels", c.channels)
+        .add("seconds", elapsed)
+        .add("packets", (long)packets)
+        .add("packets_per_second", packets / elapsed)
+        .add("megabytes_per_second", bytes / elapsed / 1e6)
+        .add("cpu_seconds", cpu)
+        .add("cpu_utilization", cpu / elapsed)
+        .add("allocations_per_packet",
+             packets ? (double)allocations / packets : 0.0)
+        .add("sent_packets", (long)sent.load());
+    failure.report(result);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bench::Options options(argc, argv);
+    enetcpp::initialize(true);
+
+    std::vector<long> clients = options.get_ints("clients", {4});
+    std::vector<long> sizes = options.get_ints("sizes", {16, 256, 1024, 4096});
+    std::vector<std::string> reliabilities = options.get_strings(
+        "reliability", {"reliable", "unreliable", "unsequenced"});
+    std::vector<long> channels = options.get_ints("channels", {1, 4});
+    Settings settings(options);
+
+    long max_clients = *std::max_element(clients.begin(), clients.end());
+    long max_channels = *std::max_element(channels.begin(), channels.end());
+    enetcpp::Address address("127.0.0.1", options.get_int("port", 23456));
+    size_t peers = 4 * max_clients + 32;
+    std::unique_ptr<enetcpp::MemoryNetwork> network;
+    std::unique_ptr<CountingServer> server_host;
+    std::string transport = options.get("transport", "udp");
+    std::string capture_path = options.get("capture", "");
+    std::string output = options.get("output", "");
+    options.check_unused();
+    if (transport == "memory") {
+        network.reset(new enetcpp::MemoryNetwork());
+        address = enetcpp::Address("10.0.0.1", 1000);
+        server_host.reset(new CountingServer(peers, max_channels));
+        network->attach(*server_host, address);
+    } else if (transport == "udp") {
+        server_host.reset(new CountingServer(address, peers, max_channels));
+    } else {
+        throw std::runtime_error("unknown transport " + transport);
+    }
+    CountingServer& server = *server_host;
+    if (settings.compression) {
+        // decompresses and negotiates the codec only
+        server.set_compressor(std::make_shared<enetcpp::LZCompressor>(),
+                              SIZE_MAX);
+    }
+    std::shared_ptr<enetcpp::PcapCapture> capture;
+    if (!capture_path.empty())
+        capture = enetcpp::PcapCapture::attach(server, capture_path);
+
+    std::atomic<bool> stop{false};
+    std::thread server_thread([&] {
+        while (!stop.load(std::memory_order_relaxed))
+            server.service(1);
+    });
+
+    bench::Report report("throughput");
+    for (long n : clients)
+        for (long size : sizes)
+            for (const std::string& reliability : reliabilities)
+                for (long channel_count : channels) {
+                    Case c{n, size, reliability, channel_count};
+                    report.add(
+                        run_case(server, address, c, settings, network.get()));
+                    std::cerr << "." << std::flush;
+                }
+    std::cerr << std::endl;
+
+    stop.store(true, std::memory_order_relaxed);
+    server_thread.join();
+    if (capture) {
+        std::cerr << "captured " << capture->captured() << " datagrams, "
+                  << capture->dropped() << " dropped" << std::endl;
+        server.clear_shims();
+    }
+    report.write(output);
+    return 0;
+}
@@ -2,4 +2,7 @@
 
 clang-format -i include/enetcpp/**.hpp
 clang-format -i test/**.cpp
-clang-format -i test/**.hpp
\ No newline at end of file
+clang-format -i test/**.hpp
+clang-format -i bench/**.cpp
+clang-format -i bench/**.hpp
+clang-format -i bench/check/**.cpp
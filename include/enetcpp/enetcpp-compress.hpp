@@ -0,0 +1,780 @@
+/*
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <https://unlicense.org>
+
+ */
+
+/**
+ * @file enetcpp-compress.hpp
+ * @brief Fast datagram codecs for `Host::set_compressor()`.
+ *
+ * `LZCompressor` is a byte-oriented LZ77 codec producing the LZ4 block
+ * format. Where ENet's range coder models and codes every byte, it only
+ * copies literals and back-references, trading some ratio for far less time
+ * per byte while still removing the repetition typical of game and RPC
+ * datagrams (repeated field layouts, small integers, zero padding).
+ * `bench_micro` compares the two. `DictionaryCompressor` extends it with a
+ * dictionary trained from sample traffic, for datagrams too small to repeat
+ * much within themselves. `AdaptiveCompressor` applies a codec per peer,
+ * only where it pays off.
+ *
+ * @note This file extends the functionality of `enetcpp.hpp`.
+ */
+
+#ifndef _ENETCPP_ENETCPP_COMPRESS_HPP_
+#define _ENETCPP_ENETCPP_COMPRESS_HPP_
+
+#include "enetcpp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace enetcpp {
+
+/**
+ * @brief LZ77 codec writing the LZ4 block format.
+ *
+ * Matches are found with a single-entry hash table of 4 byte sequences, kept
+ * per thread so one instance can serve every host. Decompression checks
+ * every length and offset against the buffers, so malformed input is
+ * rejected rather than read or written out of bounds.
+ */
+class LZCompressor : public Compressor {
+  private:
+    static constexpr int HASH_BITS = 12;
+    static constexpr size_t MIN_MATCH = 4;
+    // the format ends every block with at least 5 literals, and the last
+    // match starts at least 12 bytes before the end
+    static constexpr size_t LAST_LITERALS = 5;
+    static constexpr size_t MATCH_FIND_LIMIT = 12;
+    static constexpr size_t MAX_OFFSET = 65535;
+
+    static uint32 read32(const uint8* p) {
+        uint32 value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static uint32 hash(uint32 sequence) {
+        return (sequence * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    /**
+     * @brief Returns how many bytes at `a` and `b` are equal, reading `a` no
+     * further than `a_end`.
+     */
+    static size_t common_prefix(const uint8* a, const uint8* b,
+                                const uint8* a_end) {
+        const uint8* start = a;
+        while ((size_t)(a_end - a) >= sizeof(uint64_t)) {
+            uint64_t x, y;
+            memcpy(&x, a, sizeof(x));
+            memcpy(&y, b, sizeof(y));
+            if (x != y) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                return a - start + (__builtin_ctzll(x ^ y) >> 3);
+#else
+                break;
+#endif
+            }
+            a += sizeof(uint64_t);
+            b += sizeof(uint64_t);
+        }
+        while (a < a_end && *a == *b) {
+            a++;
+            b++;
+        }
+        return a - start;
+    }
+
+    /**
+     * @brief Writes the extra bytes of a length above 15 in the token.
+     */
+    static uint8* write_length(uint8* op, size_t length) {
+        for (; length >= 255; length -= 255)
+            *op++ = 255;
+        *op++ = (uint8)length;
+        return op;
+    }
+
+    /**
+     * @brief Writes one sequence, or returns `NULL` if it does not fit.
+     */
+    static uint8* write_sequence(uint8* op, uint8* out_end,
+                                 const uint8* literals, size_t literal_length,
+                                 size_t offset, size_t match_length) {
+        size_t needed = 1 + literal_length + literal_length / 255 + 1;
+        if (offset)
+            needed += 2 + match_length / 255 + 1;
+        if ((size_t)(out_end - op) < needed)
+            return NULL;
+        uint8* token = op++;
+        *token = (uint8)(std::min<size_t>(literal_length, 15) << 4);
+        if (literal_length >= 15)
+            op = write_length(op, literal_length - 15);
+        memcpy(op, literals, literal_length);
+        op += literal_length;
+        if (offset) {
+            *op++ = (uint8)offset;
+            *op++ = (uint8)(offset >> 8);
+            match_length -= MIN_MATCH;
+            *token |= (uint8)std::min<size_t>(match_length, 15);
+            if (match_length >= 15)
+                op = write_length(op, match_length - 15);
+        }
+        return op;
+    }
+
+    /**
+     * @brief Reads the extra bytes of a length, or returns `false` if the
+     * input ends first.
+     */
+    static bool read_length(const uint8*& ip, const uint8* in_end,
+                            size_t& length) {
+        uint8 byte;
+        do {
+            if (ip >= in_end)
+                return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+  protected:
+    /**
+     * @brief Bytes that matches may refer back into as if they preceded
+     * every block, with a hash table of their 4 byte sequences.
+     */
+    struct Dictionary {
+        const uint8* data;
+        size_t length;
+        // dictionary position plus one per hash, 0 if none
+        const uint16_t* table;
+    };
+
+    static constexpr size_t TABLE_SIZE = (size_t)1 << HASH_BITS;
+
+    /**
+     * @brief Fills `table` with the last position of each hash in
+     * `dictionary`.
+     */
+    static void index_dictionary(const uint8* dictionary, size_t length,
+                                 uint16_t* table) {
+        std::fill(table, table + TABLE_SIZE, 0);
+        for (size_t p = 0; p + sizeof(uint32) <= length; p++)
+            table[hash(read32(dictionary + p))] = (uint16_t)(p + 1);
+    }
+
+    static size_t compress_block(const uint8* in, size_t length, uint8* out,
+                                 size_t out_limit,
+                                 const Dictionary* dictionary) {
+        // positions are stored truncated to 16 bits, so a stale or wrapped
+        // entry is only a candidate that fails the comparison
+        thread_local uint16_t table[TABLE_SIZE];
+        const uint8* ip = in;
+        const uint8* anchor = in;
+        const uint8* in_end = in + length;
+        uint8* op = out;
+        uint8* out_end = out + out_limit;
+        if (length > MATCH_FIND_LIMIT) {
+            const uint8* match_limit = in_end - LAST_LITERALS;
+            const uint8* find_limit = in_end - MATCH_FIND_LIMIT;
+            while (ip < find_limit) {
+                uint32 sequence = read32(ip);
+                uint32 h = hash(sequence);
+                size_t position = ip - in;
+                size_t previous = (position & ~(size_t)0xFFFF) | table[h];
+                if (previous >= position)
+                    previous -= 0x10000;
+                table[h] = (uint16_t)position;
+                size_t offset = 0;
+                const uint8* end = ip + MIN_MATCH;
+                if (previous < position && position - previous <= MAX_OFFSET &&
+                    read32(in + previous) == sequence) {
+                    offset = position - previous;
+                    end += common_prefix(end, in + previous + MIN_MATCH,
+                                         match_limit);
+                } else if (dictionary && dictionary->table[h] != 0) {
+                    size_t entry = dictionary->table[h] - 1;
+                    const uint8* from = dictionary->data + entry;
+                    const uint8* dictionary_end =
+                        dictionary->data + dictionary->length;
+                    if (position + (dictionary->length - entry) <=
+                            MAX_OFFSET &&
+                        read32(from) == sequence) {
+                        offset = position + (dictionary->length - entry);
+                        // a match may run off the dictionary into the input
+                        size_t in_dictionary = std::min<size_t>(
+                            dictionary_end - from - MIN_MATCH,
+                            match_limit - end);
+                        size_t common = common_prefix(
+                            end, from + MIN_MATCH, end + in_dictionary);
+                        end += common;
+                        if (common == in_dictionary)
+                            end += common_prefix(end, in, match_limit);
+                    }
+                }
+                if (offset == 0) {
+                    // skip faster through data that does not compress
+                    ip += 1 + ((ip - anchor) >> 6);
+                    continue;
+                }
+                op = write_sequence(op, out_end, anchor, ip - anchor, offset,
+                                    end - ip);
+                if (op == NULL)
+                    return 0;
+                ip = anchor = end;
+            }
+        }
+        op = write_sequence(op, out_end, anchor, in_end - anchor, 0, 0);
+        return op ? op - out : 0;
+    }
+
+    static size_t decompress_block(const uint8* in, size_t length,
+                                   uint8* out, size_t out_limit,
+                                   const Dictionary* dictionary) {
+        const uint8* ip = in;
+        const uint8* in_end = in + length;
+        uint8* op = out;
+        uint8* out_end = out + out_limit;
+        size_t dictionary_length = dictionary ? dictionary->length : 0;
+        while (ip < in_end) {
+            uint8 token = *ip++;
+            size_t literal_length = token >> 4;
+            if (literal_length == 15 &&
+                !read_length(ip, in_end, literal_length))
+                return 0;
+            if (literal_length > (size_t)(in_end - ip) ||
+                literal_length > (size_t)(out_end - op))
+                return 0;
+            if (literal_length <= 16 && in_end - ip >= 16 && out_end - op >= 16)
+                memcpy(op, ip, 16); // fixed size, the excess is overwritten
+            else
+                memcpy(op, ip, literal_length);
+            ip += literal_length;
+            op += literal_length;
+            if (ip == in_end)
+                break;
+            if (in_end - ip < 2)
+                return 0;
+            size_t offset = ip[0] | (size_t)ip[1] << 8;
+            ip += 2;
+            size_t match_length = token & 15;
+            if (match_length == 15 && !read_length(ip, in_end, match_length))
+                return 0;
+            match_length += MIN_MATCH;
+            if (offset == 0 ||
+                offset > (size_t)(op - out) + dictionary_length ||
+                match_length > (size_t)(out_end - op))
+                return 0;
+            if (offset > (size_t)(op - out)) {
+                // the match starts in the dictionary and may continue at the
+                // start of the output
+                size_t back = offset - (op - out);
+                size_t part = std::min(back, match_length);
+                memcpy(op, dictionary->data + dictionary_length - back, part);
+                op += part;
+                match_length -= part;
+            }
+            const uint8* from = op - offset;
+            if (offset >= 8 && (size_t)(out_end - op) >= match_length + 8) {
+                // 8 byte steps, which may write past the match into space
+                // the rest of the output overwrites
+                uint8* end = op + match_length;
+                for (; op < end; op += 8, from += 8)
+                    memcpy(op, from, 8);
+                op = end;
+            } else if (offset >= match_length) {
+                memcpy(op, from, match_length);
+                op += match_length;
+            } else {
+                // an overlapping match repeats the last `offset` bytes, so
+                // copy whole periods, doubling as the repetition grows
+                for (size_t span = offset; match_length > 0; span *= 2) {
+                    size_t part = std::min(span, match_length);
+                    memcpy(op, from, part);
+                    op += part;
+                    match_length -= part;
+                }
+            }
+        }
+        return op - out;
+    }
+
+  public:
+    const char* name() const override { return "lz"; }
+
+    size_t compress(const uint8* in, size_t length, uint8* out,
+                    size_t out_limit) override {
+        return compress_block(in, length, out, out_limit, NULL);
+    }
+
+    size_t decompress(const uint8* in, size_t length, uint8* out,
+                      size_t out_limit) override {
+        return decompress_block(in, length, out, out_limit, NULL);
+    }
+};
+
+/**
+ * @brief LZ codec whose matches may also refer into a shared dictionary.
+ *
+ * Datagrams that are small but alike, such as one message type repeated
+ * with different field values, hold little repetition within themselves.
+ * A dictionary of the byte strings they commonly share lets the codec
+ * replace those with back-references even in the first bytes of a
+ * datagram. The format is LZ4's block format with an external dictionary.
+ *
+ * Both ends need the same dictionary. `id()` is a checksum of it, which
+ * `Host::set_compressor()` exchanges when connecting so that hosts with
+ * different dictionaries refuse each other instead of dropping every
+ * compressed datagram. Dictionaries are built offline with `train()`, for
+ * example from a capture (see `bench_dictionary`), and loaded with `load()`.
+ */
+class DictionaryCompressor : public LZCompressor {
+  private:
+    std::vector<uint8> m_dictionary;
+    std::vector<uint16_t> m_table;
+    Dictionary m_view;
+    uint32 m_id;
+
+  public:
+    /** @brief Largest dictionary the 16 bit match offsets can reach into. */
+    static constexpr size_t MAX_SIZE = 32768;
+
+    /**
+     * @brief Constructs the codec from a dictionary.
+     * @param dictionary The dictionary, the most useful bytes last.
+     * @throws std::runtime_error if the dictionary is larger than `MAX_SIZE`.
+     */
+    DictionaryCompressor(std::vector<uint8> dictionary)
+        : m_dictionary(std::move(dictionary)), m_table(TABLE_SIZE) {
+        if (m_dictionary.size() > MAX_SIZE)
+            throw std::runtime_error("Compression dictionary too large");
+        index_dictionary(m_dictionary.data(), m_dictionary.size(),
+                         m_table.data());
+        m_view = {m_dictionary.data(), m_dictionary.size(), m_table.data()};
+        uint32 crc = Checksum::crc32c(0xFFFFFFFF, m_dictionary.data(),
+                                      m_dictionary.size());
+        // 0 means no codec to negotiate
+        m_id = ~crc != 0 ? ~crc : 1;
+    }
+
+    // m_view points into m_dictionary and m_table
+    DictionaryCompressor(const DictionaryCompressor&) = delete;
+    DictionaryCompressor& operator=(const DictionaryCompressor&) = delete;
+
+    /**
+     * @brief Loads a dictionary file written by `save()`.
+     * @throws std::runtime_error if the file cannot be read.
+     */
+    static std::shared_ptr<DictionaryCompressor> load(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            throw std::runtime_error("Failed to open dictionary " + path);
+        std::vector<uint8> dictionary(MAX_SIZE + 1);
+        size_t size = fread(dictionary.data(), 1, dictionary.size(), file);
+        bool failed = ferror(file);
+        fclose(file);
+        if (failed)
+            throw std::runtime_error("Failed to read dictionary " + path);
+        dictionary.resize(size);
+        return std::make_shared<DictionaryCompressor>(std::move(dictionary));
+    }
+
+    /**
+     * @brief Writes the dictionary to a file.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void save(const std::string& path) const {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            throw std::runtime_error("Failed to create dictionary " + path);
+        size_t written =
+            fwrite(m_dictionary.data(), 1, m_dictionary.size(), file);
+        if (fclose(file) != 0 || written != m_dictionary.size())
+            throw std::runtime_error("Failed to write dictionary " + path);
+    }
+
+    /**
+     * @brief Builds a dictionary from sample datagrams.
+     *
+     * Picks the `segment` byte stretches of the samples that cover the most
+     * frequent 8 byte strings, counting each string once per sample so that
+     * strings shared by many datagrams win over ones repeated within a few,
+     * until `size` bytes are chosen. The most valuable stretches go last,
+     * where back-references to them are shortest.
+     *
+     * @param samples Datagrams as the codec will see them, after ENet's
+     * protocol header.
+     * @param size The dictionary size, at most `MAX_SIZE`.
+     * @param segment The length of the stretches picked.
+     * @return The dictionary.
+     */
+    static std::vector<uint8>
+    train(const std::vector<std::vector<uint8>>& samples, size_t size = 8192,
+          size_t segment = 32) {
+        const size_t gram = 8;
+        size = std::min(size, MAX_SIZE);
+        segment = std::max(segment, gram);
+        auto key = [](const uint8* p) {
+            uint64_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        };
+
+        std::unordered_map<uint64_t, uint32> counts;
+        std::unordered_set<uint64_t> seen;
+        for (const auto& sample : samples) {
+            seen.clear();
+            for (size_t p = 0; p + gram <= sample.size(); p++)
+                if (seen.insert(key(&sample[p])).second)
+                    counts[key(&sample[p])]++;
+        }
+
+        struct Candidate {
+            uint64_t score;
+            const uint8* data;
+            size_t length;
+            bool operator<(const Candidate& other) const {
+                return score < other.score;
+            }
+        };
+        auto score = [&](const uint8* data, size_t length) {
+            uint64_t total = 0;
+            for (size_t p = 0; p + gram <= length; p++) {
+                auto it = counts.find(key(data + p));
+                // strings seen in a single sample are not shared
+                if (it != counts.end() && it->second > 1)
+                    total += it->second;
+            }
+            return total;
+        };
+        std::priority_queue<Candidate> candidates;
+        for (const auto& sample : samples) {
+            for (size_t p = 0; p + gram <= sample.size(); p += segment / 2) {
+                size_t length = std::min(segment, sample.size() - p);
+                uint64_t s = score(&sample[p], length);
+                if (s > 0)
+                    candidates.push({s, &sample[p], length});
+            }
+        }
+
+        // scores only drop as strings are taken, so a candidate whose
+        // rescored value still leads can be taken without rescoring others
+        std::vector<Candidate> chosen;
+        size_t total = 0;
+        while (total < size && !candidates.empty()) {
+            Candidate best = candidates.top();
+            candidates.pop();
+            best.length = std::min(best.length, size - total);
+            best.score = score(best.data, best.length);
+            if (best.score == 0)
+                continue;
+            if (!candidates.empty() && best.score < candidates.top().score) {
+                candidates.push(best);
+                continue;
+            }
+            for (size_t p = 0; p + gram <= best.length; p++)
+                counts.erase(key(best.data + p));
+            chosen.push_back(best);
+            total += best.length;
+        }
+
+        std::vector<uint8> dictionary;
+        dictionary.reserve(total);
+        for (auto it = chosen.rbegin(); it != chosen.rend(); ++it)
+            dictionary.insert(dictionary.end(), it->data,
+                              it->data + it->length);
+        return dictionary;
+    }
+
+    /**
+     * @brief Returns the dictionary.
+     */
+    const std::vector<uint8>& dictionary() const { return m_dictionary; }
+
+    const char* name() const override { return "lz-dictionary"; }
+
+    uint32 id() const override { return m_id; }
+
+    size_t compress(const uint8* in, size_t length, uint8* out,
+                    size_t out_limit) override {
+        return compress_block(in, length, out, out_limit, &m_view);
+    }
+
+    size_t decompress(const uint8* in, size_t length, uint8* out,
+                      size_t out_limit) override {
+        return decompress_block(in, length, out, out_limit, &m_view);
+    }
+};
+
+/**
+ * @brief Settings of an `AdaptiveCompressor`.
+ */
+struct AdaptivePolicy {
+    /** @brief Datagrams with fewer payload bytes are sent uncompressed. */
+    size_t threshold = 64;
+    /**
+     * @brief Compression turns off for a peer whose average compressed size
+     * is above this fraction of the original.
+     */
+    double max_ratio = 0.9;
+    /** @brief Weight of each new sample in a peer's average ratio. */
+    double smoothing = 0.1;
+    /**
+     * @brief How long compression stays off for a peer before one datagram
+     * is compressed to measure it again, in microseconds.
+     */
+    uint64_t probe_interval = 1000000;
+    /** @brief Compression time allowed per tick, in nanoseconds, or `0`. */
+    uint64_t budget = 500000;
+    /** @brief Length of a budget tick, in microseconds. */
+    uint64_t tick = 10000;
+};
+
+/**
+ * @brief Socket shim that decides per peer whether to compress.
+ *
+ * ENet's compressor hook is host-wide and is not told which peer a datagram
+ * is for, so this shim compresses instead, where each datagram's destination
+ * is known. It produces exactly what ENet's own compression would: the
+ * payload after the protocol header (and checksum) compressed with the
+ * codec and the header's compressed flag set, with the checksum, if the
+ * host has one, recomputed over that header as ENet computes it. The
+ * receiving host only needs the same codec in `Host::set_compressor()`.
+ *
+ * For each peer it keeps a moving average of the compressed size over the
+ * original, and stops compressing for peers above `AdaptivePolicy::max_ratio`
+ * such as ones sending encrypted or media payloads, compressing one datagram
+ * per `probe_interval` to notice when their traffic changes. Compression time
+ * across all peers is capped at `budget` per `tick`; datagrams beyond it go
+ * out uncompressed. Results are counted in the host's `metrics()`.
+ *
+ * Needs the library built with the `ENETCPP_SOCKET_SHIM` CMake option.
+ */
+class AdaptiveCompressor : public SocketShim {
+  public:
+    /**
+     * @brief What the shim knows about one peer.
+     */
+    struct PeerState {
+        /** @brief Moving average of compressed over original size. */
+        double ratio = 1.0;
+        /** @brief Number of datagrams measured. */
+        uint64_t samples = 0;
+        /** @brief Whether compression is off for the peer. */
+        bool off = false;
+        /** @brief When a peer with compression off is next measured. */
+        uint64_t next_probe = 0;
+        /** @brief When the peer was last sent a datagram. */
+        uint64_t last_send = 0;
+    };
+
+  private:
+    std::shared_ptr<Compressor> m_codec;
+    AdaptivePolicy m_policy;
+    ENetHost* m_host;
+    HostMetrics& m_metrics;
+    PeerSlots<PeerState> m_peers;
+    std::vector<uint8> m_buffer;
+    uint64_t m_tick_start = 0;
+    uint64_t m_spent = 0;
+    std::atomic<uint64_t> m_skipped_off{0};
+    std::atomic<uint64_t> m_skipped_budget{0};
+    std::atomic<uint64_t> m_probes{0};
+
+    /**
+     * @brief Starts a new budget tick if the current one is over, and drops
+     * peers that have disconnected.
+     */
+    void roll_tick(uint64_t now) {
+        if (now - m_tick_start < m_policy.tick)
+            return;
+        m_tick_start = now;
+        m_spent = 0;
+        m_peers.sweep([](size_t) {});
+    }
+
+  public:
+    /**
+     * @brief Constructs the shim; see `attach()`.
+     */
+    AdaptiveCompressor(Host& host, std::shared_ptr<Compressor> codec,
+                       AdaptivePolicy policy)
+        : m_codec(std::move(codec)), m_policy(policy), m_host(host.get()),
+          m_metrics(host.metrics()), m_peers(host.get(), host.peer_capacity()),
+          m_buffer(ENET_PROTOCOL_MAXIMUM_MTU) {}
+
+    /**
+     * @brief Makes `host` compress per peer with `codec`.
+     *
+     * Sets `codec` as the host's compressor for decompression and connect
+     * negotiation only, and attaches the shim.
+     *
+     * @return The shim, for its statistics.
+     */
+    static std::shared_ptr<AdaptiveCompressor>
+    attach(Host& host, std::shared_ptr<Compressor> codec,
+           AdaptivePolicy policy = AdaptivePolicy()) {
+        host.set_compressor(codec, SIZE_MAX);
+        auto shim = std::make_shared<AdaptiveCompressor>(host, std::move(codec),
+                                                         policy);
+        host.add_shim(shim);
+        return shim;
+    }
+
+    int send(ShimLink& below, const ENetAddress& address, const void* data,
+             size_t length) override {
+        const uint8* bytes = (const uint8*)data;
+        size_t header = ShimProtocol::header_size(m_host, bytes, length);
+        if (header == 0 || header == length)
+            return below.send(address, data, length);
+        size_t payload = length - header;
+        auto relaxed = std::memory_order_relaxed;
+        ENetBuffer commands;
+        commands.data = (void*)(bytes + header);
+        commands.dataLength = payload;
+        if (payload < m_policy.threshold ||
+            ShimProtocol::handshake(&commands, 1)) {
+            m_metrics.uncompressed_datagrams.fetch_add(1, relaxed);
+            return below.send(address, data, length);
+        }
+
+        uint64_t now = SocketShim::now();
+        roll_tick(now);
+        size_t index = m_peers.lookup(address);
+        if (index == m_peers.NONE) {
+            // not a peer's datagram, so there is no checksum key for it
+            m_metrics.uncompressed_datagrams.fetch_add(1, relaxed);
+            return below.send(address, data, length);
+        }
+        PeerState& peer = m_peers[index];
+        peer.last_send = now;
+        bool probe = peer.off;
+        if (probe && now < peer.next_probe) {
+            m_skipped_off.fetch_add(1, relaxed);
+            m_metrics.uncompressed_datagrams.fetch_add(1, relaxed);
+            return below.send(address, data, length);
+        }
+        if (m_policy.budget != 0 && m_spent >= m_policy.budget) {
+            m_skipped_budget.fetch_add(1, relaxed);
+            m_metrics.uncompressed_datagrams.fetch_add(1, relaxed);
+            return below.send(address, data, length);
+        }
+
+        if (m_buffer.size() < length)
+            m_buffer.resize(length);
+        auto start = std::chrono::steady_clock::now();
+        size_t size = m_codec->compress(bytes + header, payload,
+                                        m_buffer.data() + header, payload - 1);
+        uint64_t elapsed =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+        m_spent += elapsed;
+        m_metrics.compress_nanoseconds.fetch_add(elapsed, relaxed);
+
+        double sample = size > 0 ? (double)size / payload : 1.0;
+        if (probe) {
+            // one probe decides, so a changed peer resumes straight away
+            m_probes.fetch_add(1, relaxed);
+            peer.ratio = sample;
+            peer.off = sample > m_policy.max_ratio;
+        } else {
+            peer.ratio = peer.samples == 0
+                             ? sample
+                             : peer.ratio +
+                                   m_policy.smoothing * (sample - peer.ratio);
+            peer.off = peer.ratio > m_policy.max_ratio;
+        }
+        peer.samples++;
+        if (peer.off)
+            peer.next_probe = now + m_policy.probe_interval;
+
+        if (size == 0) {
+            m_metrics.uncompressed_datagrams.fetch_add(1, relaxed);
+            return below.send(address, data, length);
+        }
+        memcpy(m_buffer.data(), bytes, header);
+        m_buffer[0] |= ENET_PROTOCOL_HEADER_FLAG_COMPRESSED >> 8;
+        // the receiver checks the flagged header with the payload
+        // decompressed, so the checksum ENet computed no longer holds
+        if (m_host->checksum != NULL)
+            ShimProtocol::sign(m_host, m_peers.connect_id(index),
+                               m_buffer.data(), header, bytes + header,
+                               payload);
+        m_metrics.compressed_datagrams.fetch_add(1, relaxed);
+        m_metrics.compress_input_bytes.fetch_add(payload, relaxed);
+        m_metrics.compress_output_bytes.fetch_add(size, relaxed);
+        return below.send(address, m_buffer.data(), header + size);
+    }
+
+    /**
+     * @brief Returns what the shim knows about the peer at `address`, or a
+     * default state if it has not sent it anything compressible.
+     *
+     * Only call this from the thread servicing the host.
+     */
+    PeerState peer_state(const Address& address) const {
+        ENetAddress enet_address;
+        enet_address.host = address.host();
+        enet_address.port = address.port();
+        size_t index = m_peers.find(enet_address);
+        return index != m_peers.NONE ? m_peers[index] : PeerState();
+    }
+
+    /**
+     * @brief Returns the number of datagrams sent uncompressed because
+     * compression was off for their peer.
+     */
+    uint64_t skipped_off() const { return m_skipped_off.load(); }
+
+    /**
+     * @brief Returns the number of datagrams sent uncompressed because the
+     * tick's budget was spent.
+     */
+    uint64_t skipped_budget() const { return m_skipped_budget.load(); }
+
+    /**
+     * @brief Returns the number of datagrams compressed to remeasure a peer
+     * with compression off.
+     */
+    uint64_t probes() const { return m_probes.load(); }
+};
+
+} // namespace enetcpp
+
+#endif // _ENETCPP_ENETCPP_COMPRESS_HPP_
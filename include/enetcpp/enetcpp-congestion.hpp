@@ -0,0 +1,734 @@
+/*
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <https://unlicense.org>
+
+ */
+
+/**
+ * @file enetcpp-congestion.hpp
+ * @brief Selectable per-peer congestion control with pacing, and fast
+ * retransmission.
+ *
+ * ENet limits a peer's reliable data in flight to its window, scaled by a
+ * throttle that backs off whenever a round trip takes longer than the
+ * lowest one recently seen. On long or lossy paths this keeps bulk reliable
+ * transfers far below what the path carries, and ENet sends each window
+ * out in one burst, which fills bottleneck queues. `CongestionController`
+ * replaces that, per peer, with a BBR-style controller that estimates the
+ * path's bottleneck bandwidth and minimum round trip time, sizes the
+ * window to their product and paces datagrams at the estimated rate.
+ * `FastRetransmit` resends reliable commands as soon as acknowledgements of
+ * later ones show them lost, instead of waiting for ENet's timeout.
+ *
+ * @note This file extends the functionality of `enetcpp.hpp`.
+ */
+
+#ifndef _ENETCPP_ENETCPP_CONGESTION_HPP_
+#define _ENETCPP_ENETCPP_CONGESTION_HPP_
+
+#include "enetcpp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+namespace enetcpp {
+
+/**
+ * @brief Congestion controller used for a peer.
+ */
+enum class CongestionControl {
+    /** @brief ENet's own window and throttle. */
+    ENET,
+    /** @brief Rate based, modelled on BBR, with pacing. */
+    BBR
+};
+
+/**
+ * @brief Tuning of `CongestionController`'s BBR mode.
+ */
+struct BbrSettings {
+    /** @brief Largest reliable window, in bytes. */
+    uint32 max_window = 16 << 20;
+    /** @brief Smallest reliable window, in datagrams of the peer's MTU. */
+    uint32 min_window_datagrams = 4;
+    /** @brief Window and pacing gain while searching for the bandwidth. */
+    double startup_gain = 2.885;
+    /** @brief Window gain once the bandwidth is found. */
+    double window_gain = 2.0;
+    /** @brief Number of round trips the bandwidth estimate is the maximum
+     * over. */
+    uint32 bandwidth_rounds = 10;
+    /** @brief How long a minimum round trip time sample is kept, in
+     * microseconds. */
+    uint64_t min_rtt_window = 10000000;
+    /** @brief How often the estimates are updated, in microseconds. */
+    uint64_t update_interval = 1000;
+    /** @brief Whether datagrams are paced, rather than only windowed. */
+    bool pacing = true;
+};
+
+/**
+ * @brief Socket shim that runs a congestion controller per peer.
+ *
+ * Peers in `CongestionControl::BBR` mode have ENet's throttle pinned open
+ * and their window set from the shim's estimates instead: the bottleneck
+ * bandwidth is the highest delivery rate measured over the last few round
+ * trips, the minimum round trip time the lowest sample over the last ten
+ * seconds. The shim starts each peer by doubling the rate every round trip
+ * until it stops growing, drains the queue that built up, then cycles the
+ * pacing rate a quarter above and below the estimate to track changes.
+ * Datagrams to the peer are released no faster than the pacing rate, so
+ * windows leave spread over a round trip instead of in bursts. Peers in
+ * `CongestionControl::ENET` mode are left alone.
+ *
+ * Delivered bytes are counted as bytes sent less ENet's reliable data in
+ * transit, so the controller is aimed at reliable bulk traffic; unreliable
+ * datagrams count as delivered as soon as they are sent.
+ *
+ * Needs the library built with the `ENETCPP_SOCKET_SHIM` CMake option.
+ */
+class CongestionController : public SocketShim {
+  public:
+    /**
+     * @brief Phase of a BBR peer.
+     */
+    enum class Phase {
+        /** @brief Searching for the bandwidth. */
+        STARTUP,
+        /** @brief Emptying the queue built while searching. */
+        DRAIN,
+        /** @brief Cycling the rate around the estimate. */
+        PROBE_BANDWIDTH
+    };
+
+    /**
+     * @brief What the shim knows about one peer.
+     */
+    struct FlowStats {
+        /** @brief The peer's controller. */
+        CongestionControl mode = CongestionControl::ENET;
+        /** @brief The BBR phase. */
+        Phase phase = Phase::STARTUP;
+        /** @brief Estimated bottleneck bandwidth, in bytes per second. */
+        double bandwidth = 0;
+        /** @brief Minimum round trip time, in microseconds. */
+        uint64_t min_rtt = 0;
+        /** @brief Rate datagrams are paced at, in bytes per second. */
+        double pacing_rate = 0;
+        /** @brief Reliable window, in bytes. */
+        uint32 window = 0;
+        /** @brief Datagrams waiting for their pacing time. */
+        size_t queued = 0;
+        /** @brief Datagrams that had to wait for their pacing time. */
+        uint64_t paced = 0;
+        /** @brief Datagrams dropped because the pacing queue was full. */
+        uint64_t dropped = 0;
+    };
+
+  private:
+    struct Flow {
+        FlowStats stats;
+        bool saved = false;
+        uint32 saved_window = 0;
+        uint32 saved_deceleration = 0;
+        uint64_t sent = 0;
+        uint64_t lost = 0;
+        uint32 packets_lost = 0;
+        uint64_t delivered = 0;
+        uint64_t sample_start = 0;
+        uint64_t sample_delivered = 0;
+        std::vector<double> samples;
+        size_t next_sample = 0;
+        uint64_t min_rtt_stamp = 0;
+        double full_bandwidth = 0;
+        uint32 full_rounds = 0;
+        size_t cycle = 0;
+        uint64_t cycle_stamp = 0;
+        uint64_t next_send = 0;
+        DatagramQueue queue;
+    };
+
+    // pacing gains of the PROBE_BANDWIDTH cycle, one round trip each
+    static constexpr double CYCLE[8] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+
+    ENetHost* m_host;
+    CongestionControl m_default;
+    BbrSettings m_settings;
+    PeerSlots<Flow> m_flows;
+    // flows that may hold datagrams back
+    std::unordered_set<size_t> m_paced;
+    uint64_t m_last_update = 0;
+
+    uint32 min_window(const ENetPeer* peer) const {
+        return std::max<uint32>(m_settings.min_window_datagrams * peer->mtu,
+                                ENET_PROTOCOL_MINIMUM_WINDOW_SIZE);
+    }
+
+    uint64_t interval(const Flow& flow, size_t length) const {
+        return (uint64_t)(length * 1e6 / flow.stats.pacing_rate);
+    }
+
+    /**
+     * @brief Returns the flow of `peer`, starting a new one in the default
+     * mode if the peer has reconnected since.
+     */
+    Flow& flow_of(ENetPeer* peer) {
+        bool fresh = !m_flows.current(peer);
+        Flow& flow = m_flows.of(peer);
+        if (fresh)
+            apply_mode(peer, flow, m_default);
+        return flow;
+    }
+
+    void apply_mode(ENetPeer* peer, Flow& flow, CongestionControl mode) {
+        if (flow.stats.mode == mode)
+            return;
+        flow.stats.mode = mode;
+        if (mode == CongestionControl::BBR) {
+            flow.stats.phase = Phase::STARTUP;
+            uint32 rounds = std::max<uint32>(m_settings.bandwidth_rounds, 1);
+            flow.samples.assign(rounds, 0);
+            m_paced.insert(peer - m_host->peers);
+        } else {
+            if (flow.saved) {
+                peer->windowSize = flow.saved_window;
+                peer->packetThrottleDeceleration = flow.saved_deceleration;
+                flow.saved = false;
+            }
+            flow.stats.pacing_rate = 0;
+            // queued datagrams still go out, see poll()
+        }
+    }
+
+    /**
+     * @brief Takes a round trip time and delivery rate sample and moves the
+     * peer's window and pacing rate.
+     */
+    void step(ENetPeer* peer, Flow& flow, uint64_t now) {
+        FlowStats& stats = flow.stats;
+        if (!flow.saved) {
+            // taken once connected, as connecting negotiates the window
+            flow.saved = true;
+            flow.saved_window = peer->windowSize;
+            flow.saved_deceleration = peer->packetThrottleDeceleration;
+            peer->packetThrottleDeceleration = 0;
+            stats.window = std::max(peer->windowSize, min_window(peer));
+        }
+        // ENet measures in milliseconds, so loopback shows as 0
+        uint64_t rtt = std::max<uint64_t>(peer->lastRoundTripTime, 1) * 1000;
+        if (stats.min_rtt == 0 || rtt <= stats.min_rtt ||
+            now - flow.min_rtt_stamp > m_settings.min_rtt_window) {
+            stats.min_rtt = rtt;
+            flow.min_rtt_stamp = now;
+        }
+
+        // ENet counts datagrams still in the pacing queue as in transit
+        uint64_t in_transit = peer->reliableDataInTransit;
+        uint64_t in_flight = in_transit > flow.queue.bytes()
+                                 ? in_transit - flow.queue.bytes()
+                                 : 0;
+        // timed out data leaves ENet's count without being delivered; the
+        // loss count restarts every packet loss interval
+        uint32 packets_lost = peer->packetsLost;
+        flow.lost += (uint64_t)(packets_lost >= flow.packets_lost
+                                    ? packets_lost - flow.packets_lost
+                                    : packets_lost) *
+                     peer->mtu;
+        flow.packets_lost = packets_lost;
+        uint64_t left = flow.sent > in_flight ? flow.sent - in_flight : 0;
+        if (left > flow.lost)
+            flow.delivered = std::max(flow.delivered, left - flow.lost);
+        if (flow.sample_start == 0) {
+            flow.sample_start = now;
+            flow.sample_delivered = flow.delivered;
+        }
+
+        bool round = now - flow.sample_start >= stats.min_rtt;
+        bool app_limited = false;
+        if (round) {
+            double rate = (flow.delivered - flow.sample_delivered) * 1e6 /
+                          (now - flow.sample_start);
+            // a sender with nothing queued measures itself, not the path
+#if ENET_VERSION >= ENET_VERSION_CREATE(1, 3, 18)
+            app_limited =
+                enet_list_empty(&peer->outgoingCommands) &&
+                enet_list_empty(&peer->outgoingSendReliableCommands) &&
+                flow.queue.empty();
+#else
+            app_limited =
+                enet_list_empty(&peer->outgoingReliableCommands) &&
+                enet_list_empty(&peer->outgoingUnreliableCommands) &&
+                flow.queue.empty();
+#endif
+            if (!app_limited || rate > stats.bandwidth) {
+                flow.samples[flow.next_sample] = rate;
+                flow.next_sample = (flow.next_sample + 1) % flow.samples.size();
+                stats.bandwidth = *std::max_element(flow.samples.begin(),
+                                                    flow.samples.end());
+            }
+            flow.sample_start = now;
+            flow.sample_delivered = flow.delivered;
+        }
+
+        double bdp = stats.bandwidth * stats.min_rtt / 1e6;
+        if (round && !app_limited && stats.phase == Phase::STARTUP) {
+            if (stats.bandwidth >= flow.full_bandwidth * 1.25) {
+                flow.full_bandwidth = stats.bandwidth;
+                flow.full_rounds = 0;
+            } else if (++flow.full_rounds >= 3) {
+                stats.phase = Phase::DRAIN;
+            }
+        }
+        if (stats.phase == Phase::DRAIN && in_flight <= bdp) {
+            stats.phase = Phase::PROBE_BANDWIDTH;
+            flow.cycle = 2;
+            flow.cycle_stamp = now;
+        }
+        if (stats.phase == Phase::PROBE_BANDWIDTH &&
+            now - flow.cycle_stamp >= stats.min_rtt) {
+            flow.cycle = (flow.cycle + 1) % 8;
+            flow.cycle_stamp = now;
+        }
+
+        double pacing_gain = m_settings.startup_gain;
+        double window_gain = m_settings.startup_gain;
+        if (stats.phase == Phase::DRAIN) {
+            pacing_gain = 1 / m_settings.startup_gain;
+            window_gain = m_settings.window_gain;
+        } else if (stats.phase == Phase::PROBE_BANDWIDTH) {
+            pacing_gain = CYCLE[flow.cycle];
+            window_gain = m_settings.window_gain;
+        }
+
+        // never pace slower than the smallest window per round trip
+        double floor = (double)min_window(peer) * 1e6 / stats.min_rtt;
+        if (stats.bandwidth > 0) {
+            double target = std::min<double>(window_gain * bdp,
+                                             m_settings.max_window);
+            uint32 window = std::max((uint32)target, min_window(peer));
+            // the window only grows while searching for the bandwidth
+            stats.window = stats.phase == Phase::STARTUP
+                               ? std::max(stats.window, window)
+                               : window;
+            stats.pacing_rate = std::max(pacing_gain * stats.bandwidth, floor);
+        } else {
+            stats.pacing_rate = pacing_gain * stats.window * 1e6 /
+                                stats.min_rtt;
+        }
+        peer->windowSize = stats.window;
+        peer->packetThrottle = ENET_PEER_PACKET_THROTTLE_SCALE;
+    }
+
+    /**
+     * @brief Follows peers connecting and disconnecting and steps the BBR
+     * ones.
+     */
+    void update(ShimLink& below, uint64_t now) {
+        m_flows.sweep([&](size_t index) {
+            m_flows[index].queue.flush(below, m_flows.address(index));
+            m_paced.erase(index);
+        });
+        for (size_t i = 0; i < m_host->peerCount; i++) {
+            ENetPeer* peer = &m_host->peers[i];
+            if (!ShimProtocol::in_use(peer))
+                continue;
+            Flow& flow = flow_of(peer);
+            if (flow.stats.mode == CongestionControl::BBR &&
+                ShimProtocol::live(peer))
+                step(peer, flow, now);
+        }
+    }
+
+  public:
+    /**
+     * @brief Constructs the shim; see `attach()`.
+     */
+    CongestionController(Host& host, CongestionControl mode,
+                         BbrSettings settings)
+        : m_host(host.get()), m_default(mode), m_settings(settings),
+          m_flows(host.get(), host.peer_capacity()) {}
+
+    /**
+     * @brief Runs congestion control on `host`'s peers.
+     * @param host The host.
+     * @param mode Controller of peers not given one with `set_mode()`.
+     * @param settings Tuning of the BBR mode.
+     * @return The shim, to set modes and read statistics.
+     */
+    static std::shared_ptr<CongestionController>
+    attach(Host& host, CongestionControl mode = CongestionControl::BBR,
+           BbrSettings settings = BbrSettings()) {
+        auto shim =
+            std::make_shared<CongestionController>(host, mode, settings);
+        host.add_shim(shim);
+        return shim;
+    }
+
+    /**
+     * @brief Sets the controller of one peer, until it disconnects.
+     *
+     * This may be called as soon as the peer is returned by
+     * `Host::connect_async()`. Only call it from the thread servicing the
+     * host.
+     */
+    void set_mode(Peer peer, CongestionControl mode) {
+        apply_mode(peer.get(), flow_of(peer.get()), mode);
+    }
+
+    /**
+     * @brief Returns what the shim knows about a peer.
+     *
+     * Only call this from the thread servicing the host.
+     */
+    FlowStats stats(Peer peer) const {
+        if (!m_flows.current(peer.get()))
+            return FlowStats();
+        size_t index = peer.get() - m_host->peers;
+        FlowStats stats = m_flows[index].stats;
+        stats.queued = m_flows[index].queue.size();
+        return stats;
+    }
+
+    int send(ShimLink& below, const ENetAddress& address, const void* data,
+             size_t length) override {
+        size_t index = m_flows.find(address);
+        if (index == m_flows.NONE)
+            return below.send(address, data, length);
+        Flow& flow = m_flows[index];
+        bool bbr = flow.stats.mode == CongestionControl::BBR;
+        if (!bbr || !m_settings.pacing || flow.stats.pacing_rate <= 0) {
+            if (flow.queue.empty()) {
+                flow.sent += length;
+                return below.send(address, data, length);
+            }
+        } else {
+            uint64_t now = SocketShim::now();
+            if (flow.queue.empty() && flow.next_send <= now) {
+                // idle time earns at most one update interval of burst
+                flow.next_send =
+                    std::max(flow.next_send, now - m_settings.update_interval) +
+                    interval(flow, length);
+                flow.sent += length;
+                return below.send(address, data, length);
+            }
+        }
+        if (flow.queue.bytes() + length > flow.stats.window) {
+            // a full queue drops, as a router's would
+            flow.stats.dropped++;
+            return (int)length;
+        }
+        flow.queue.push(data, length);
+        flow.stats.paced++;
+        return (int)length;
+    }
+
+    void poll(ShimLink& below) override {
+        uint64_t now = SocketShim::now();
+        if (now - m_last_update >= m_settings.update_interval) {
+            m_last_update = now;
+            update(below, now);
+        }
+        for (auto it = m_paced.begin(); it != m_paced.end();) {
+            Flow& flow = m_flows[*it];
+            bool bbr = flow.stats.mode == CongestionControl::BBR;
+            while (!flow.queue.empty() &&
+                   (!bbr || !m_settings.pacing || flow.next_send <= now)) {
+                size_t length = flow.queue.release(below, m_flows.address(*it));
+                if (bbr && flow.stats.pacing_rate > 0)
+                    flow.next_send += interval(flow, length);
+                flow.sent += length;
+            }
+            if (!bbr)
+                it = m_paced.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    uint64_t next_deadline() override {
+        uint64_t deadline = UINT64_MAX;
+        for (size_t index : m_paced) {
+            const Flow& flow = m_flows[index];
+            if (!flow.queue.empty())
+                deadline = std::min(deadline, flow.next_send);
+        }
+        return deadline;
+    }
+};
+
+/**
+ * @brief Tuning of `FastRetransmit`.
+ */
+struct RetransmitPolicy {
+    /** @brief Number of later reliable commands on the same channel that must
+     * be acknowledged before a command is presumed lost; 0 disables this. */
+    uint32 duplicate_threshold = 3;
+    /** @brief Reordering tolerated before a command sent earlier than an
+     * acknowledged one is presumed lost, as a fraction of the peer's lowest
+     * round trip time. */
+    double reorder_window = 0.25;
+    /** @brief Smallest reordering window, in milliseconds. */
+    uint32 min_reorder_window = 1;
+};
+
+/**
+ * @brief Socket shim that resends lost reliable commands without waiting for
+ * ENet's retransmission timeout.
+ *
+ * ENet acknowledges every reliable command individually, so the
+ * acknowledgements already tell a sender exactly which commands arrived,
+ * but ENet only resends a command once its timeout, a few round trips,
+ * expires. Under light loss those timeouts dominate tail latency. This shim
+ * reads the acknowledgements a host receives and, once ENet has processed
+ * them, presumes a command still awaiting acknowledgement lost when it was
+ * sent more than a reordering window before an acknowledged command, or
+ * when `duplicate_threshold` later commands on its channel are acknowledged.
+ * Such commands are moved back to the peer's send queue, as ENet's timeout
+ * would do, and go out in the same service call. Their timeout is not
+ * doubled, and they count in ENet's packet loss. Once a command is resent,
+ * only acknowledgements of commands sent after it count towards its
+ * channel's gaps.
+ *
+ * Only the sender needs the shim; receivers acknowledge as usual.
+ * Acknowledgements in compressed datagrams are not seen, so with a
+ * compressor set, lost commands may still wait for their timeout.
+ *
+ * Needs the library built with the `ENETCPP_SOCKET_SHIM` CMake option.
+ */
+class FastRetransmit : public SocketShim {
+  private:
+    // no acknowledgement seen on a channel
+    static constexpr uint32 NONE = 0x10000;
+
+    struct Channel {
+        // highest reliable sequence number acknowledged, and how many
+        // acknowledgements have been counted
+        uint32 highest = NONE;
+        uint32 acknowledged = 0;
+        // acknowledgements of commands sent before resent_at are ignored
+        bool resent = false;
+        enet_uint32 resent_at = 0;
+        // a command on the channel is being resent
+        bool moving = false;
+    };
+
+    struct PeerState {
+        bool pending = false;
+        bool acknowledged = false;
+        enet_uint32 latest_sent = 0;
+        std::vector<Channel> channels;
+    };
+
+    ENetHost* m_host;
+    RetransmitPolicy m_policy;
+    PeerSlots<PeerState> m_peers;
+    std::vector<size_t> m_pending;
+    std::atomic<uint64_t> m_retransmits{0};
+
+    /**
+     * @brief Notes an acknowledgement from `peer`.
+     */
+    void acknowledged(size_t index, const ENetProtocolAcknowledge& ack) {
+        ENetPeer* peer = &m_host->peers[index];
+        PeerState& state = m_peers.of(peer);
+        // widened to ENet's 32 bit time as enet_protocol_handle_acknowledge
+        // does
+        enet_uint32 sent = ENET_NET_TO_HOST_16(ack.receivedSentTime);
+        sent |= m_host->serviceTime & 0xFFFF0000;
+        if ((sent & 0x8000) > (m_host->serviceTime & 0x8000))
+            sent -= 0x10000;
+        if (!state.acknowledged || ENET_TIME_GREATER(sent, state.latest_sent))
+            state.latest_sent = sent;
+        state.acknowledged = true;
+
+        // ENet's own commands, such as pings, use channel 0xFF
+        size_t channel = ack.header.channelID == 0xFF ? peer->channelCount
+                                                      : ack.header.channelID;
+        if (channel <= peer->channelCount) {
+            state.channels.resize(peer->channelCount + 1);
+            Channel& gaps = state.channels[channel];
+            // a resent command is only behind commands sent after it
+            if (gaps.resent && !ENET_TIME_LESS(sent, gaps.resent_at))
+                gaps.resent = false;
+            uint16_t sequence =
+                ENET_NET_TO_HOST_16(ack.receivedReliableSequenceNumber);
+            if (!gaps.resent) {
+                if (gaps.highest == NONE ||
+                    (uint16_t)(sequence - gaps.highest) < 0x8000)
+                    gaps.highest = sequence;
+                gaps.acknowledged++;
+            }
+        }
+        if (!state.pending) {
+            state.pending = true;
+            m_pending.push_back(index);
+        }
+    }
+
+    /**
+     * @brief Reads the acknowledgements in a received datagram.
+     */
+    void scan(const ENetAddress& address, const uint8* data, size_t length) {
+        size_t header = ShimProtocol::header_size(m_host, data, length);
+        if (header == 0)
+            return;
+        size_t index = (data[0] << 8 | data[1]) & ENET_PROTOCOL_MAXIMUM_PEER_ID;
+        if (index >= m_host->peerCount)
+            return;
+        const ENetPeer* peer = &m_host->peers[index];
+        if (!ShimProtocol::live(peer) || peer->address.host != address.host ||
+            peer->address.port != address.port)
+            return;
+        ShimProtocol::for_each_command(
+            data, header, length, [&](const ENetProtocol& command) {
+                if ((command.header.command & ENET_PROTOCOL_COMMAND_MASK) ==
+                    ENET_PROTOCOL_COMMAND_ACKNOWLEDGE)
+                    acknowledged(index, command.acknowledge);
+                return true;
+            });
+    }
+
+    /**
+     * @brief Moves the commands of `peer` that acknowledgements show lost
+     * back to its send queues.
+     */
+    void recover(ENetPeer* peer, PeerState& state) {
+        uint32 rtt = peer->lowestRoundTripTime ? peer->lowestRoundTripTime
+                                               : peer->roundTripTime;
+        uint32 reorder = std::max(m_policy.min_reorder_window,
+                                  (uint32)(rtt * m_policy.reorder_window));
+#if ENET_VERSION >= ENET_VERSION_CREATE(1, 3, 18)
+        ENetListIterator reliable =
+            enet_list_begin(&peer->outgoingSendReliableCommands);
+        ENetListIterator other = enet_list_begin(&peer->outgoingCommands);
+#else
+        ENetListIterator reliable =
+            enet_list_begin(&peer->outgoingReliableCommands);
+        ENetListIterator other = reliable;
+#endif
+        uint64_t moved = 0;
+        ENetListIterator current = enet_list_begin(&peer->sentReliableCommands);
+        while (current != enet_list_end(&peer->sentReliableCommands)) {
+            ENetOutgoingCommand* command = (ENetOutgoingCommand*)current;
+            current = enet_list_next(current);
+            if (!ENET_TIME_LESS(command->sentTime, state.latest_sent))
+                continue;
+            bool late =
+                ENET_TIME_LESS(command->sentTime + reorder, state.latest_sent);
+            uint8 id = command->command.header.channelID;
+            size_t channel = id == 0xFF ? peer->channelCount : id;
+            bool gap = false;
+            if (m_policy.duplicate_threshold > 0 &&
+                channel < state.channels.size() &&
+                state.channels[channel].highest != NONE) {
+                const Channel& gaps = state.channels[channel];
+                uint16_t ahead = (uint16_t)(gaps.highest -
+                                            command->reliableSequenceNumber);
+                gap = ahead < 0x8000 && ahead >= m_policy.duplicate_threshold &&
+                      gaps.acknowledged >= m_policy.duplicate_threshold;
+            }
+            if (!late && !gap)
+                continue;
+            if (channel < state.channels.size())
+                state.channels[channel].moving = true;
+
+            // as enet_protocol_check_timeouts does, keeping the order
+            ++peer->packetsLost;
+            if (command->packet != NULL) {
+                peer->reliableDataInTransit -= command->fragmentLength;
+                enet_list_insert(reliable, enet_list_remove(
+                                               &command->outgoingCommandList));
+            } else {
+                enet_list_insert(other, enet_list_remove(
+                                            &command->outgoingCommandList));
+            }
+            moved++;
+        }
+        // start counting gaps afresh from the resends, which go out in this
+        // service call
+        for (Channel& gaps : state.channels) {
+            if (gaps.moving) {
+                gaps = Channel();
+                gaps.resent = true;
+                gaps.resent_at = m_host->serviceTime;
+            }
+        }
+        if (moved > 0 && !enet_list_empty(&peer->sentReliableCommands)) {
+            ENetOutgoingCommand* first = (ENetOutgoingCommand*)enet_list_begin(
+                &peer->sentReliableCommands);
+            peer->nextTimeout = first->sentTime + first->roundTripTimeout;
+        }
+        m_retransmits.fetch_add(moved, std::memory_order_relaxed);
+    }
+
+  public:
+    /**
+     * @brief Constructs the shim; see `attach()`.
+     */
+    FastRetransmit(Host& host, RetransmitPolicy policy)
+        : m_host(host.get()), m_policy(policy),
+          m_peers(host.get(), host.peer_capacity()) {}
+
+    /**
+     * @brief Makes `host` resend lost reliable commands early.
+     * @return The shim, for its statistics.
+     */
+    static std::shared_ptr<FastRetransmit>
+    attach(Host& host, RetransmitPolicy policy = RetransmitPolicy()) {
+        auto shim = std::make_shared<FastRetransmit>(host, policy);
+        host.add_shim(shim);
+        return shim;
+    }
+
+    int receive(ShimLink& below, ENetAddress& address, void* data,
+                size_t capacity) override {
+        // ENet has processed the previous datagram's acknowledgements by now
+        for (size_t index : m_pending) {
+            PeerState& state = m_peers[index];
+            state.pending = false;
+            ENetPeer* peer = &m_host->peers[index];
+            if (index < m_host->peerCount && ShimProtocol::live(peer) &&
+                m_peers.current(peer))
+                recover(peer, state);
+        }
+        m_pending.clear();
+        int length = below.receive(address, data, capacity);
+        if (length > 0)
+            scan(address, (const uint8*)data, length);
+        return length;
+    }
+
+    /**
+     * @brief Returns the number of commands resent before their timeout.
+     */
+    uint64_t retransmits() const { return m_retransmits.load(); }
+};
+
+} // namespace enetcpp
+
+#endif // _ENETCPP_ENETCPP_CONGESTION_HPP_
@@ -0,0 +1,511 @@
+/*
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <https://unlicense.org>
+
+ */
+
+/**
+ * @file enetcpp-metrics.hpp
+ * @brief Metrics registry and Prometheus text exporter for ENetCPP hosts.
+ *
+ * This file provides a `MetricsRegistry` that collects the `HostMetrics` and
+ * stage latency histograms of any number of hosts, together with ENet
+ * allocation counts, and renders them in the Prometheus text exposition
+ * format. A `PrometheusExporter` renders the registry on a timer and publishes
+ * the result to a file (for a textfile collector) and/or an in-process scrape
+ * buffer.
+ *
+ * Rendering only reads atomics and histogram snapshots, so it never takes
+ * `Host::m_mutex` and never slows down the thread servicing a host.
+ *
+ * @note This file extends the functionality of `enetcpp.hpp`.
+ */
+
+#ifndef _ENETCPP_ENETCPP_METRICS_HPP_
+#define _ENETCPP_ENETCPP_METRICS_HPP_
+
+#include "enetcpp.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace enetcpp {
+
+/**
+ * @brief Double-buffered text that readers can copy without blocking.
+ *
+ * A single writer publishes new text by filling the buffer readers are not
+ * using and then flipping the current index. Readers never wait for the
+ * writer; at worst they retry once when a flip races with them.
+ */
+class ScrapeBuffer {
+  private:
+    std::string m_buffers[2];
+    std::atomic<int> m_current{0};
+    std::atomic<int> m_readers[2] = {{0}, {0}};
+
+  public:
+    /**
+     * @brief Replaces the published text.
+     *
+     * Only one thread may publish at a time.
+     *
+     * @param text The new text.
+     */
+    void publish(std::string text) {
+        int next = 1 - m_current.load();
+        while (m_readers[next].load() != 0)
+            std::this_thread::yield();
+        m_buffers[next] = std::move(text);
+        m_current.store(next);
+    }
+
+    /**
+     * @brief Copies the most recently published text.
+     * @return The text, empty if nothing has been published yet.
+     */
+    std::string read() {
+        while (true) {
+            int current = m_current.load();
+            m_readers[current].fetch_add(1);
+            if (m_current.load() == current) {
+                std::string out = m_buffers[current];
+                m_readers[current].fetch_sub(1);
+                return out;
+            }
+            m_readers[current].fetch_sub(1);
+        }
+    }
+};
+
+/**
+ * @brief Collects metrics from registered hosts and renders them in the
+ * Prometheus text format.
+ *
+ * Registration takes a lock, rendering only reads atomics. Hosts must be
+ * removed before they are destroyed.
+ */
+class MetricsRegistry {
+  private:
+    struct Entry {
+        std::string name;
+        Host* host;
+    };
+
+    struct Metric {
+        const char* name;
+        const char* help;
+        const char* type;
+    };
+
+    std::mutex m_mutex;
+    std::vector<Entry> m_hosts;
+
+    static std::string escape(const std::string& value) {
+        std::string out;
+        for (char c : value) {
+            if (c == '\\' || c == '"')
+                out += '\\';
+            if (c == '\n') {
+                out += "\\n";
+                continue;
+            }
+            out += c;
+        }
+        return out;
+    }
+
+    static void header(std::string& out, const Metric& metric) {
+        out += "# HELP ";
+        out += metric.name;
+        out += ' ';
+        out += metric.help;
+        out += "\n# TYPE ";
+        out += metric.name;
+        out += ' ';
+        out += metric.type;
+        out += '\n';
+    }
+
+    template <typename T>
+    static void sample(std::string& out, const char* name,
+                       const std::string& labels, T value) {
+        out += name;
+        if (!labels.empty()) {
+            out += '{';
+            out += labels;
+            out += '}';
+        }
+        out += ' ';
+        if constexpr (std::is_floating_point<T>::value) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.9g", (double)value);
+            out += buffer;
+        } else {
+            out += std::to_string(value);
+        }
+        out += '\n';
+    }
+
+    template <typename T>
+    void host_metric(std::string& out, const Metric& metric,
+                     const std::vector<std::string>& labels,
+                     std::atomic<T> HostMetrics::*field) {
+        header(out, metric);
+        for (size_t i = 0; i < m_hosts.size(); i++)
+            sample(out, metric.name, labels[i],
+                   (m_hosts[i].host->metrics().*field)
+                       .load(std::memory_order_relaxed));
+    }
+
+  public:
+    /**
+     * @brief Registers a host under the given name.
+     *
+     * The name is exported as the `host` label.
+     *
+     * @param name The label value identifying the host.
+     * @param host The host to collect metrics from.
+     */
+    void add_host(const std::string& name, Host& host) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_hosts.push_back({name, &host});
+    }
+
+    /**
+     * @brief Stops collecting metrics from a host.
+     * @param host The host to remove.
+     */
+    void remove_host(Host& host) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_hosts.begin(); it != m_hosts.end();) {
+            if (it->host == &host)
+                it = m_hosts.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    /**
+     * @brief Renders every metric in the Prometheus text format.
+     * @param out String the text is appended to.
+     */
+    void render(std::string& out) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::string> labels;
+        for (auto& entry : m_hosts)
+            labels.push_back("host=\"" + escape(entry.name) + "\"");
+        auto relaxed = std::memory_order_relaxed;
+
+        host_metric(out,
+                    {"enetcpp_sent_bytes_total", "Bytes sent by the host.",
+                     "counter"},
+                    labels, &HostMetrics::sent_bytes);
+        host_metric(out,
+                    {"enetcpp_sent_packets_total",
+                     "Datagrams sent by the host.", "counter"},
+                    labels, &HostMetrics::sent_packets);
+        host_metric(out,
+                    {"enetcpp_received_bytes_total",
+                     "Bytes received by the host.", "counter"},
+                    labels, &HostMetrics::received_bytes);
+        host_metric(out,
+                    {"enetcpp_received_packets_total",
+                     "Datagrams received by the host.", "counter"},
+                    labels, &HostMetrics::received_packets);
+        host_metric(out,
+                    {"enetcpp_connected_peers", "Peers currently connected.",
+                     "gauge"},
+                    labels, &HostMetrics::connected_peers);
+        host_metric(out,
+                    {"enetcpp_service_calls_total", "Calls to Host::service.",
+                     "counter"},
+                    labels, &HostMetrics::service_calls);
+
+        Metric events = {"enetcpp_events_total", "Events dispatched by type.",
+                         "counter"};
+        header(out, events);
+        for (size_t i = 0; i < m_hosts.size(); i++) {
+            HostMetrics& m = m_hosts[i].host->metrics();
+            sample(out, events.name, labels[i] + ",type=\"connect\"",
+                   m.connect_events.load(relaxed));
+            sample(out, events.name, labels[i] + ",type=\"disconnect\"",
+                   m.disconnect_events.load(relaxed));
+            sample(out, events.name, labels[i] + ",type=\"receive\"",
+                   m.receive_events.load(relaxed));
+        }
+
+        Metric dispatch = {"enetcpp_dispatch_seconds",
+                           "Time spent in on_event handlers.", "summary"};
+        header(out, dispatch);
+        for (size_t i = 0; i < m_hosts.size(); i++) {
+            HostMetrics& m = m_hosts[i].host->metrics();
+            sample(out, "enetcpp_dispatch_seconds_sum", labels[i],
+                   m.dispatch_nanoseconds.load(relaxed) * 1e-9);
+            sample(out, "enetcpp_dispatch_seconds_count", labels[i],
+                   m.connect_events.load(relaxed) +
+                       m.disconnect_events.load(relaxed) +
+                       m.receive_events.load(relaxed));
+        }
+        Metric dispatch_max = {"enetcpp_dispatch_max_seconds",
+                               "Longest single on_event handler call.",
+                               "gauge"};
+        header(out, dispatch_max);
+        for (size_t i = 0; i < m_hosts.size(); i++) {
+            HostMetrics& m = m_hosts[i].host->metrics();
+            sample(out, dispatch_max.name, labels[i],
+                   m.dispatch_max_nanoseconds.load(relaxed) * 1e-9);
+        }
+        Metric latency = {"enetcpp_latency_seconds",
+                          "Latency of each packet handling stage.", "summary"};
+        header(out, latency);
+        for (size_t i = 0; i < m_hosts.size(); i++) {
+            for (size_t stage = 0; stage < (size_t)LatencyStage::COUNT;
+                 stage++) {
+                HistogramSnapshot snapshot =
+                    m_hosts[i].host->latency((LatencyStage)stage);
+                std::string stage_labels =
+                    labels[i] + ",stage=\"" +
+                    latency_stage_name((LatencyStage)stage) + "\"";
+                for (const char* quantile : {"0.5", "0.99", "0.999"}) {
+                    sample(out, latency.name,
+                           stage_labels + ",quantile=\"" + quantile + "\"",
+                           snapshot.percentile(atof(quantile)) * 1e-9);
+                }
+                sample(out, "enetcpp_latency_seconds_sum", stage_labels,
+                       snapshot.sum() * 1e-9);
+                sample(out, "enetcpp_latency_seconds_count", stage_labels,
+                       snapshot.count());
+            }
+        }
+        host_metric(out,
+                    {"enetcpp_queued_packets",
+                     "Packets waiting in connection thread queues.", "gauge"},
+                    labels, &HostMetrics::queued_packets);
+        host_metric(out,
+                    {"enetcpp_connection_threads",
+                     "Running connection threads.", "gauge"},
+                    labels, &HostMetrics::connection_threads);
+
+        Metric compressed = {"enetcpp_compression_datagrams_total",
+                             "Datagrams sent, by whether they were compressed.",
+                             "counter"};
+        header(out, compressed);
+        for (size_t i = 0; i < m_hosts.size(); i++) {
+            HostMetrics& m = m_hosts[i].host->metrics();
+            sample(out, compressed.name, labels[i] + ",result=\"compressed\"",
+                   m.compressed_datagrams.load(relaxed));
+            sample(out, compressed.name,
+                   labels[i] + ",result=\"uncompressed\"",
+                   m.uncompressed_datagrams.load(relaxed));
+        }
+        host_metric(out,
+                    {"enetcpp_compression_input_bytes_total",
+                     "Size of compressed datagrams before compression.",
+                     "counter"},
+                    labels, &HostMetrics::compress_input_bytes);
+        host_metric(out,
+                    {"enetcpp_compression_output_bytes_total",
+                     "Size of compressed datagrams after compression.",
+                     "counter"},
+                    labels, &HostMetrics::compress_output_bytes);
+        Metric codec_time = {"enetcpp_compression_seconds_total",
+                             "Time spent in the compressor, by direction.",
+                             "counter"};
+        header(out, codec_time);
+        for (size_t i = 0; i < m_hosts.size(); i++) {
+            HostMetrics& m = m_hosts[i].host->metrics();
+            sample(out, codec_time.name,
+                   labels[i] + ",direction=\"compress\"",
+                   m.compress_nanoseconds.load(relaxed) * 1e-9);
+            sample(out, codec_time.name,
+                   labels[i] + ",direction=\"decompress\"",
+                   m.decompress_nanoseconds.load(relaxed) * 1e-9);
+        }
+        host_metric(out,
+                    {"enetcpp_decompress_failures_total",
+                     "Compressed datagrams that failed to decompress.",
+                     "counter"},
+                    labels, &HostMetrics::decompress_failures);
+
+        if (AllocationTracker::enabled()) {
+            Metric allocations = {"enetcpp_allocations_total",
+                                  "Allocations made by ENet.", "counter"};
+            header(out, allocations);
+            sample(out, allocations.name, "",
+                   AllocationTracker::allocations());
+            Metric frees = {"enetcpp_frees_total", "Frees made by ENet.",
+                            "counter"};
+            header(out, frees);
+            sample(out, frees.name, "", AllocationTracker::frees());
+            Metric bytes = {"enetcpp_allocated_bytes_total",
+                            "Bytes requested by ENet.", "counter"};
+            header(out, bytes);
+            sample(out, bytes.name, "", AllocationTracker::bytes());
+            Metric live = {"enetcpp_live_allocations",
+                           "ENet allocations not yet freed.", "gauge"};
+            header(out, live);
+            sample(out, live.name, "",
+                   (int64_t)(AllocationTracker::allocations() -
+                             AllocationTracker::frees()));
+        }
+    }
+
+    /**
+     * @brief Renders every metric in the Prometheus text format.
+     * @return The rendered text.
+     */
+    std::string render() {
+        std::string out;
+        render(out);
+        return out;
+    }
+};
+
+/**
+ * @brief Periodically renders a MetricsRegistry for scraping.
+ *
+ * Each interval the exporter thread renders the registry, publishes the text
+ * to its scrape buffer and, if a path was given, atomically replaces that
+ * file (writing to `<path>.tmp` and renaming it), which suits the node
+ * exporter textfile collector.
+ */
+class PrometheusExporter {
+  private:
+    MetricsRegistry& m_registry;
+    std::chrono::milliseconds m_interval;
+    std::string m_path;
+    ScrapeBuffer m_buffer;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_should_quit = false;
+    std::thread m_thread;
+    bool m_launched = false;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_should_quit) {
+            lock.unlock();
+            export_now();
+            lock.lock();
+            m_cv.wait_for(lock, m_interval, [this] { return m_should_quit; });
+        }
+    }
+
+  public:
+    /**
+     * @brief Constructs an exporter for a registry.
+     * @param registry The registry to render.
+     * @param interval How often to render.
+     * @param path File to write on every render, empty to only fill the
+     * scrape buffer.
+     */
+    PrometheusExporter(MetricsRegistry& registry,
+                       std::chrono::milliseconds interval =
+                           std::chrono::milliseconds(1000),
+                       std::string path = "")
+        : m_registry(registry), m_interval(interval), m_path(path) {}
+
+    /**
+     * @brief Stops the exporter thread if it is running.
+     */
+    ~PrometheusExporter() {
+        if (m_launched)
+            stop();
+    }
+
+    /**
+     * @brief Renders the registry once and publishes the result.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void export_now() {
+        std::string text = m_registry.render();
+        if (!m_path.empty())
+            write_file(m_path, text);
+        m_buffer.publish(std::move(text));
+    }
+
+    /**
+     * @brief Returns the most recently rendered text.
+     *
+     * This never blocks and never touches a host.
+     *
+     * @return The Prometheus text, empty before the first render.
+     */
+    std::string scrape() { return m_buffer.read(); }
+
+    /**
+     * @brief Launches the exporter thread.
+     */
+    void launch() {
+        m_launched = true;
+        m_thread = std::thread(&PrometheusExporter::run, this);
+    }
+
+    /**
+     * @brief Signals the exporter thread to quit and joins it.
+     * @throws std::runtime_error if the exporter has not been launched.
+     */
+    void stop() {
+        if (!m_launched)
+            throw std::runtime_error("Exporter stopped but not launched");
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_should_quit = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+        m_launched = false;
+    }
+
+    /**
+     * @brief Atomically replaces a file with the given text.
+     * @param path The file to write.
+     * @param text The contents.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    static void write_file(const std::string& path, const std::string& text) {
+        std::string tmp = path + ".tmp";
+        FILE* file = fopen(tmp.c_str(), "w");
+        if (file == NULL)
+            throw std::runtime_error("Failed to open " + tmp);
+        size_t written = fwrite(text.data(), 1, text.size(), file);
+        if (fclose(file) != 0 || written != text.size() ||
+            rename(tmp.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+    }
+};
+
+} // namespace enetcpp
+
+#endif // _ENETCPP_ENETCPP_METRICS_HPP_
@@ -49,11 +49,14 @@ For more information, please refer to <https://unlicense.org>
 #define _ENETCPP_ENETCPP_MT_HPP_
 
 #include "enetcpp.hpp"
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <iostream>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <utility>
 
 namespace enetcpp {
 
@@ -75,11 +78,13 @@ class ConnectionThread {
     Peer m_peer;
     std::mutex m_mutex;
     std::condition_variable m_cv;
-    std::queue<ENetPacket*> m_packet_queue;
+    std::queue<std::pair<ENetPacket*, std::chrono::steady_clock::time_point>>
+        m_packet_queue;
     bool m_should_quit = false;
     std::thread m_thread;
     bool m_launched = false;
     bool m_should_wake = false;
+    StageHistograms m_latency;
 
   public:
     /**
@@ -89,7 +94,14 @@ class ConnectionThread {
      * @param peer The peer associated with the connection.
      */
     ConnectionThread(Host& host, Address address, Peer peer)
-        : m_host(host), m_address(address), m_peer(peer) {}
+        : m_host(host), m_address(address), m_peer(peer) {
+        m_host.add_latency(m_latency);
+    }
+
+    /**
+     * @brief Folds this thread's latency samples into the host's totals.
+     */
+    virtual ~ConnectionThread() { m_host.remove_latency(m_latency); }
 
     /**
      * @brief Returns a reference to the host managing the connection.
@@ -105,7 +117,7 @@ class ConnectionThread {
      */
     void wake() {
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
+            TracedLock lock(m_mutex, "wait ConnectionThread::m_mutex");
             m_should_wake = true;
         }
         m_cv.notify_one();
@@ -117,6 +129,7 @@ class ConnectionThread {
      * The thread will wait until it is woken up by a call to `wake()`.
      */
     void sleep() {
+        TraceSpan span("ConnectionThread::sleep");
         std::unique_lock lk(m_mutex);
         m_cv.wait(lk, [this] { return m_should_wake; });
     }
@@ -163,8 +176,11 @@ class ConnectionThread {
      * @param packet Pointer to the ENetPacket to queue.
      */
     void queue_packet(ENetPacket* packet) {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_packet_queue.push(packet);
+        {
+            TracedLock lock(m_mutex, "wait ConnectionThread::m_mutex");
+            m_packet_queue.push({packet, std::chrono::steady_clock::now()});
+        }
+        m_host.metrics().queued_packets.fetch_add(1, std::memory_order_relaxed);
     }
 
     /**
@@ -173,12 +189,14 @@ class ConnectionThread {
      * empty.
      */
     ENetPacket* dequeue_packet() {
-        std::lock_guard<std::mutex> lock(m_mutex);
+        TracedLock lock(m_mutex, "wait ConnectionThread::m_mutex");
         if (m_packet_queue.size() == 0)
             return NULL;
         auto out = m_packet_queue.front();
         m_packet_queue.pop();
-        return out;
+        m_host.metrics().queued_packets.fetch_sub(1, std::memory_order_relaxed);
+        m_latency[LatencyStage::QUEUE_WAIT].record_since(out.second);
+        return out.first;
     }
 
     /**
@@ -226,17 +244,31 @@ class ConnectionThread {
      * waits for network events. It runs until the `should_quit()` flag is set.
      */
     void run() {
+        if constexpr (ENETCPP_TRACE) {
+            char name[64];
+            snprintf(name, sizeof(name), "ConnectionThread %x:%u",
+                     m_address.host(), m_address.port());
+            Tracer::instance().set_thread_name(name);
+        }
         while (true) {
             sleep();
             {
                 std::lock_guard<std::mutex> lock(m_mutex);
                 m_should_wake = false;
             }
+            TraceSpan drain_span("ConnectionThread::drain");
             while (queue_size() > 0) {
                 ENetPacket* raw_packet = dequeue_packet();
                 if (raw_packet) {
-                    Packet packet(raw_packet);
-                    this->handle(packet);
+                    TraceSpan handle_span("ConnectionThread::handle");
+                    auto start = std::chrono::steady_clock::now();
+                    {
+                        Packet packet(raw_packet);
+                        this->handle(packet);
+                    }
+                    m_latency[LatencyStage::HANDLE].record_since(start);
+                    // send any replies now if the host is blocked
+                    m_host.notify();
                 }
             }
             if (should_quit()) {
@@ -246,6 +278,59 @@ class ConnectionThread {
     }
 };
 
+/**
+ * @brief How `HostMT::run` waits for network events.
+ *
+ * After any event the loop keeps polling without blocking for `spin`, so a
+ * busy host answers without a wakeup. Once idle it blocks until ENet's next
+ * retransmit, ping or throttle deadline (see `Host::next_timeout()`), capped
+ * at `max_block`; connection threads wake it with `Host::notify()` when they
+ * queue replies.
+ */
+struct RunLoopPolicy {
+    /** @brief How long to keep polling after the last event. */
+    std::chrono::microseconds spin{200};
+
+    /**
+     * @brief The longest blocking wait, in milliseconds, which also bounds
+     * how long `HostMT::quit()` takes to be noticed over UDP.
+     */
+    uint32 max_block = 100;
+
+    /**
+     * @brief If non-zero, the loop just calls `service(fixed_timeout)` and
+     * `flush()`, as older versions did.
+     */
+    uint32 fixed_timeout = 0;
+
+    /**
+     * @brief Spins for `spin` after activity, then blocks up to `max_block`.
+     */
+    static RunLoopPolicy adaptive(std::chrono::microseconds spin,
+                                  uint32 max_block = 100) {
+        RunLoopPolicy policy;
+        policy.spin = spin;
+        policy.max_block = max_block;
+        return policy;
+    }
+
+    /**
+     * @brief Services with a fixed timeout in a loop.
+     */
+    static RunLoopPolicy fixed(uint32 timeout) {
+        RunLoopPolicy policy;
+        policy.fixed_timeout = timeout;
+        return policy;
+    }
+
+    /**
+     * @brief Never blocks, for the lowest latency at the cost of a core.
+     */
+    static RunLoopPolicy busy_poll() {
+        return adaptive(std::chrono::microseconds::max());
+    }
+};
+
 /**
  * @brief Multi-threaded host class for managing multiple connection threads.
  *
@@ -263,8 +348,9 @@ class ConnectionThread {
 template <typename ConnectionThread_t> class HostMT : public Host {
   private:
     std::thread m_thread;
-    bool m_should_quit = false;
+    std::atomic<bool> m_should_quit{false};
     bool m_launched = false;
+    RunLoopPolicy m_policy;
 
   public:
     using Host::Host;
@@ -279,6 +365,7 @@ template <typename ConnectionThread_t> class HostMT : public Host {
             new ConnectionThread_t(*this, event.address(), event.peer());
         event.set_peer_data(new_connection);
         new_connection->launch();
+        metrics().connection_threads.fetch_add(1, std::memory_order_relaxed);
     }
 
     /**
@@ -292,6 +379,7 @@ template <typename ConnectionThread_t> class HostMT : public Host {
         connection->wake();
         connection->join();
         delete connection;
+        metrics().connection_threads.fetch_sub(1, std::memory_order_relaxed);
     }
 
     /**
@@ -306,16 +394,42 @@ template <typename ConnectionThread_t> class HostMT : public Host {
         connection->wake();
     }
 
+    /**
+     * @brief Sets how `run()` waits for events; takes effect at the next
+     * `launch()` or `run()`.
+     * @param policy The run-loop policy.
+     */
+    void set_run_loop(const RunLoopPolicy& policy) { m_policy = policy; }
+
     /**
      * @brief Runs the main loop for the host, servicing network events.
      *
      * The host processes network events and flushes the network state in this
-     * loop. The loop runs until `should_quit()` returns `true`.
+     * loop, waiting as set by `set_run_loop()`. The loop runs until
+     * `should_quit()` returns `true`.
      */
     void run() {
+        if constexpr (ENETCPP_TRACE)
+            Tracer::instance().set_thread_name("HostMT::run");
+        const RunLoopPolicy policy = m_policy;
+        if (policy.fixed_timeout > 0) {
+            while (!should_quit()) {
+                service(policy.fixed_timeout);
+                flush();
+            }
+            return;
+        }
+        auto last_event = std::chrono::steady_clock::now();
         while (!should_quit()) {
-            service(10);
-            flush();
+            uint32 timeout = 0;
+            auto idle = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - last_event);
+            if (idle >= policy.spin)
+                timeout = next_timeout(policy.max_block);
+            if (service_batch(timeout) > 0) {
+                flush();
+                last_event = std::chrono::steady_clock::now();
+            }
         }
     }
 
@@ -323,8 +437,8 @@ template <typename ConnectionThread_t> class HostMT : public Host {
      * @brief Signals the host to stop running.
      */
     void quit() {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_should_quit = true;
+        m_should_quit.store(true, std::memory_order_release);
+        notify();
     }
 
     /**
@@ -332,8 +446,7 @@ template <typename ConnectionThread_t> class HostMT : public Host {
      * @return `true` if the host should quit, `false` otherwise.
      */
     bool should_quit() {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        return m_should_quit;
+        return m_should_quit.load(std::memory_order_acquire);
     }
 
     /**
@@ -0,0 +1,408 @@
+/*
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <https://unlicense.org>
+
+ */
+
+/**
+ * @file enetcpp-mtu.hpp
+ * @brief Path MTU discovery per peer.
+ *
+ * ENet sends every peer datagrams of up to the MTU negotiated at connect,
+ * `ENET_HOST_DEFAULT_MTU` (1392 bytes) unless changed. On paths with jumbo
+ * frames that leaves capacity unused, and on tunnelled paths with a smaller
+ * MTU every full datagram is fragmented by IP, so losing either fragment
+ * loses both. `PathMtuDiscovery` searches each peer's path for the largest
+ * datagram that arrives whole and sets the peer's MTU to it.
+ *
+ * @note This file extends the functionality of `enetcpp.hpp`.
+ */
+
+#ifndef _ENETCPP_ENETCPP_MTU_HPP_
+#define _ENETCPP_ENETCPP_MTU_HPP_
+
+#include "enetcpp.hpp"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+namespace enetcpp {
+
+/**
+ * @brief Tuning of `PathMtuDiscovery`.
+ */
+struct PathMtuPolicy {
+    /** @brief Largest datagram probed, at most `ENET_PROTOCOL_MAXIMUM_MTU`. */
+    uint32 max_mtu = ENET_PROTOCOL_MAXIMUM_MTU;
+    /** @brief The search stops once the largest size known to arrive and the
+     * smallest known not to are this close, in bytes. */
+    uint32 precision = 16;
+    /** @brief Number of probes of one size that must go unacknowledged
+     * before the size is taken to be too large. */
+    uint32 attempts = 2;
+    /** @brief Least time to wait for a probe's acknowledgement, in
+     * microseconds; at least four round trips are always allowed. */
+    uint64_t probe_timeout = 1000000;
+    /** @brief Time from the end of a search to the next search of the same
+     * path, in microseconds. */
+    uint64_t interval = 600000000;
+};
+
+/**
+ * @brief Socket shim that discovers each peer's path MTU.
+ *
+ * The shim asks ENet to ping the peer and pads the datagram carrying the
+ * ping with zeros to the size being probed, sent with IP fragmentation
+ * forbidden (`IP_MTU_DISCOVER` set to `IP_PMTUDISC_PROBE` on Linux,
+ * `IP_DONTFRAG` elsewhere) for that datagram only. The receiver ignores the
+ * padding, so the probe needs nothing of it: if the ping is acknowledged,
+ * a datagram of that size arrives whole; if the local interface refuses it
+ * or repeated probes go unacknowledged, it does not. The shim binary
+ * searches between ENet's minimum MTU and `max_mtu`, starting with the
+ * peer's current MTU so that paths smaller than it are found first, and
+ * sets `peer->mtu` as it goes, which ENet uses for the datagrams it
+ * assembles and the fragments of packets sent afterwards. The result shows
+ * in `PeerStats::mtu`. Searches repeat every `interval` to follow changing
+ * paths.
+ *
+ * Only datagrams holding nothing but the ping and acknowledgements are
+ * padded, so a lost probe never delays application data. Each end
+ * discovers the path it sends on; ENet receives datagrams of up to
+ * `ENET_PROTOCOL_MAXIMUM_MTU` bytes whatever MTU was negotiated.
+ *
+ * Needs the library built with the `ENETCPP_SOCKET_SHIM` CMake option.
+ */
+class PathMtuDiscovery : public SocketShim {
+  public:
+    /**
+     * @brief What the shim knows about one peer's path.
+     */
+    struct PathState {
+        /** @brief Largest size known to arrive, or `0` if none yet. */
+        uint32 low = 0;
+        /** @brief Smallest size known not to arrive, or `max_mtu + 1`. */
+        uint32 high = 0;
+        /** @brief Size of the probe in flight, or `0` if none. */
+        uint32 probe = 0;
+        /** @brief Whether a search is under way. */
+        bool searching = false;
+        /** @brief Number of probes sent. */
+        uint64_t probes = 0;
+        /** @brief Number of probes refused or not acknowledged. */
+        uint64_t failures = 0;
+    };
+
+  private:
+    struct Path {
+        PathState state;
+        uint32 target = 0;
+        uint32 misses = 0;
+        bool requested = false;
+        uint64_t requested_at = 0;
+        uint16_t sequence = 0;
+        uint16_t sent_time = 0;
+        uint64_t deadline = 0;
+        uint64_t next_search = 0;
+    };
+
+    ENetHost* m_host;
+    PathMtuPolicy m_policy;
+    PeerSlots<Path> m_paths;
+    // number of peers whose ping is to be padded
+    size_t m_requested = 0;
+    std::vector<uint8> m_buffer;
+    uint64_t m_last_update = 0;
+    int m_saved_option = 0;
+
+    // how often peers are checked for due probes and timeouts
+    static constexpr uint64_t UPDATE_INTERVAL = 1000;
+
+    /**
+     * @brief Forbids or allows IP fragmentation of the host's datagrams.
+     */
+    void forbid_fragmentation(bool forbid) {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+        int value = forbid ? IP_PMTUDISC_PROBE : m_saved_option;
+        setsockopt(m_host->socket, IPPROTO_IP, IP_MTU_DISCOVER, &value,
+                   sizeof(value));
+#elif defined(IP_DONTFRAG)
+        int value = forbid ? 1 : m_saved_option;
+        setsockopt(m_host->socket, IPPROTO_IP, IP_DONTFRAG, &value,
+                   sizeof(value));
+#else
+        (void)forbid;
+#endif
+    }
+
+    /**
+     * @brief Records the outcome of a probe of `size` bytes and moves the
+     * search on.
+     */
+    void finish_probe(ENetPeer* peer, Path& path, uint32 size, bool arrived,
+                      uint64_t now) {
+        PathState& state = path.state;
+        state.probe = 0;
+        if (arrived) {
+            path.misses = 0;
+            state.low = size;
+            if (size > peer->mtu)
+                peer->mtu = size;
+        } else {
+            state.failures++;
+            if (++path.misses < m_policy.attempts)
+                return; // probe the same size again
+            path.misses = 0;
+            state.high = size;
+            // the current MTU is too large: fall back to what is known
+            if (size <= peer->mtu)
+                peer->mtu = std::max<uint32>(state.low,
+                                             ENET_PROTOCOL_MINIMUM_MTU);
+        }
+        uint32 base = std::max<uint32>(state.low, ENET_PROTOCOL_MINIMUM_MTU);
+        if (state.high <= base + m_policy.precision) {
+            state.searching = false;
+            path.next_search = now + m_policy.interval;
+        }
+    }
+
+    /**
+     * @brief Starts and times out probes.
+     */
+    void update(uint64_t now) {
+        m_paths.sweep([&](size_t index) {
+            if (m_paths[index].requested)
+                m_requested--;
+        });
+        for (size_t i = 0; i < m_host->peerCount; i++) {
+            ENetPeer* peer = &m_host->peers[i];
+            if (peer->state != ENET_PEER_STATE_CONNECTED)
+                continue;
+            Path& path = m_paths.of(peer);
+            PathState& state = path.state;
+            if (state.probe != 0 && now >= path.deadline)
+                finish_probe(peer, path, state.probe, false, now);
+            if (path.requested &&
+                now - path.requested_at >= m_policy.probe_timeout) {
+                // the ping went out with other commands; ask again
+                path.requested = false;
+                m_requested--;
+            }
+            if (state.probe != 0 || path.requested)
+                continue;
+            if (!state.searching) {
+                if (now < path.next_search)
+                    continue;
+                // the path may have shrunk, so the current MTU is retried
+                state.searching = true;
+                state.low = 0;
+                state.high = std::min<uint32>(m_policy.max_mtu,
+                                              ENET_PROTOCOL_MAXIMUM_MTU) +
+                             1;
+            }
+            uint32 base = std::max<uint32>(state.low,
+                                           ENET_PROTOCOL_MINIMUM_MTU);
+            path.target = state.low == 0 && peer->mtu < state.high
+                              ? peer->mtu
+                              : base + (state.high - base) / 2;
+            path.requested = true;
+            path.requested_at = now;
+            m_requested++;
+            enet_peer_ping(peer);
+        }
+    }
+
+    /**
+     * @brief Looks for the acknowledgement of a probe in a datagram from a
+     * peer.
+     */
+    void scan(const ENetAddress& address, const uint8* data, size_t length,
+              uint64_t now) {
+        size_t header = ShimProtocol::header_size(m_host, data, length);
+        if (header == 0)
+            return;
+        size_t index = (data[0] << 8 | data[1]) & ENET_PROTOCOL_MAXIMUM_PEER_ID;
+        if (index >= m_host->peerCount)
+            return;
+        ENetPeer* peer = &m_host->peers[index];
+        if (!m_paths.current(peer) || m_paths[index].state.probe == 0 ||
+            peer->address.host != address.host ||
+            peer->address.port != address.port)
+            return;
+        Path& path = m_paths[index];
+        ShimProtocol::for_each_command(
+            data, header, length, [&](const ENetProtocol& command) {
+                if ((command.header.command & ENET_PROTOCOL_COMMAND_MASK) !=
+                        ENET_PROTOCOL_COMMAND_ACKNOWLEDGE ||
+                    command.header.channelID != 0xFF ||
+                    ENET_NET_TO_HOST_16(
+                        command.acknowledge.receivedReliableSequenceNumber) !=
+                        path.sequence)
+                    return true;
+                // an acknowledgement of a resent ping means the probe was lost
+                bool arrived =
+                    ENET_NET_TO_HOST_16(command.acknowledge.receivedSentTime) ==
+                    path.sent_time;
+                finish_probe(peer, path, path.state.probe, arrived, now);
+                return false;
+            });
+    }
+
+    /**
+     * @brief Returns the sequence number of the ping in a datagram that holds
+     * only acknowledgements and pings, or `-1`.
+     */
+    static int ping_sequence(const uint8* data, size_t header, size_t length) {
+        int sequence = -1;
+        for (size_t offset = header; offset < length;) {
+            if (offset + sizeof(ENetProtocolCommandHeader) > length)
+                return -1;
+            uint8 number = data[offset] & ENET_PROTOCOL_COMMAND_MASK;
+            if (number == ENET_PROTOCOL_COMMAND_PING)
+                sequence = data[offset + 2] << 8 | data[offset + 3];
+            else if (number != ENET_PROTOCOL_COMMAND_ACKNOWLEDGE)
+                return -1;
+            offset += enet_protocol_command_size(number);
+        }
+        return sequence;
+    }
+
+  public:
+    /**
+     * @brief Constructs the shim; see `attach()`.
+     * @throws std::runtime_error if the platform cannot forbid
+     * fragmentation per socket.
+     */
+    PathMtuDiscovery(Host& host, PathMtuPolicy policy)
+        : m_host(host.get()), m_policy(policy),
+          m_paths(host.get(), host.peer_capacity()),
+          m_buffer(ENET_PROTOCOL_MAXIMUM_MTU) {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+        socklen_t size = sizeof(m_saved_option);
+        if (getsockopt(m_host->socket, IPPROTO_IP, IP_MTU_DISCOVER,
+                       &m_saved_option, &size) != 0)
+            m_saved_option = IP_PMTUDISC_DONT;
+#elif defined(IP_DONTFRAG)
+        m_saved_option = 0;
+#else
+        throw std::runtime_error(
+            "Path MTU discovery is not supported on this platform");
+#endif
+    }
+
+    /**
+     * @brief Makes `host` discover the path MTU of each connected peer.
+     * @return The shim, for its statistics.
+     */
+    static std::shared_ptr<PathMtuDiscovery>
+    attach(Host& host, PathMtuPolicy policy = PathMtuPolicy()) {
+        auto shim = std::make_shared<PathMtuDiscovery>(host, policy);
+        host.add_shim(shim);
+        return shim;
+    }
+
+    int send(ShimLink& below, const ENetAddress& address, const void* data,
+             size_t length) override {
+        if (m_requested == 0)
+            return below.send(address, data, length);
+        size_t index = m_paths.find(address);
+        if (index == m_paths.NONE || !m_paths[index].requested)
+            return below.send(address, data, length);
+        const uint8* bytes = (const uint8*)data;
+        size_t header = ShimProtocol::header_size(m_host, bytes, length);
+        uint16_t flags = (uint16_t)(bytes[0] << 8 | bytes[1]);
+        int sequence = header ? ping_sequence(bytes, header, length) : -1;
+        Path& path = m_paths[index];
+        if (sequence < 0 || !(flags & ENET_PROTOCOL_HEADER_FLAG_SENT_TIME) ||
+            path.target <= length)
+            return below.send(address, data, length);
+
+        ENetPeer* peer = &m_host->peers[index];
+        m_requested--;
+        path.requested = false;
+        memcpy(m_buffer.data(), bytes, length);
+        memset(m_buffer.data() + length, 0, path.target - length);
+        // the checksum covers the padding
+        if (m_host->checksum != NULL)
+            ShimProtocol::sign(m_host, m_paths.connect_id(index),
+                               m_buffer.data(), header,
+                               m_buffer.data() + header, path.target - header);
+
+        uint64_t now = SocketShim::now();
+        path.state.probes++;
+        path.state.probe = path.target;
+        forbid_fragmentation(true);
+        int sent = below.send(address, m_buffer.data(), path.target);
+        forbid_fragmentation(false);
+        if (sent < 0) {
+            // refused locally, e.g. larger than the interface MTU
+            path.misses = m_policy.attempts;
+            finish_probe(peer, path, path.target, false, now);
+            return below.send(address, data, length);
+        }
+        path.sequence = (uint16_t)sequence;
+        path.sent_time = (uint16_t)(bytes[2] << 8 | bytes[3]);
+        uint64_t round_trips = (uint64_t)peer->roundTripTime * 4000;
+        path.deadline = now + std::max(m_policy.probe_timeout, round_trips);
+        return (int)length;
+    }
+
+    int receive(ShimLink& below, ENetAddress& address, void* data,
+                size_t capacity) override {
+        uint64_t now = SocketShim::now();
+        // ENet is not walking its peers while it receives, so pings can be
+        // queued here
+        if (now - m_last_update >= UPDATE_INTERVAL) {
+            m_last_update = now;
+            update(now);
+        }
+        int length = below.receive(address, data, capacity);
+        if (length > 0)
+            scan(address, (const uint8*)data, length, now);
+        return length;
+    }
+
+    /**
+     * @brief Returns what the shim knows about a peer's path.
+     *
+     * Only call this from the thread servicing the host.
+     */
+    PathState state(Peer peer) const {
+        if (!m_paths.current(peer.get()))
+            return PathState();
+        return m_paths[peer.get() - m_host->peers].state;
+    }
+};
+
+} // namespace enetcpp
+
+#endif // _ENETCPP_ENETCPP_MTU_HPP_
@@ -0,0 +1,379 @@
+/*
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <https://unlicense.org>
+
+ */
+
+/**
+ * @file enetcpp-pacing.hpp
+ * @brief Paced transmission per peer.
+ *
+ * ENet sends everything it has queued for a peer in one go whenever a host
+ * is serviced or flushed, so a `flush()` or `broadcast()` leaves the network
+ * card as a burst at line rate. On fast links such microbursts overflow
+ * switch buffers even when the average rate is modest. `Pacer` spreads each
+ * peer's datagrams at the peer's estimated rate instead, handing them to
+ * the kernel with `SO_TXTIME` launch times where the socket supports it and
+ * holding them back in the library otherwise.
+ *
+ * @note This file extends the functionality of `enetcpp.hpp`.
+ */
+
+#ifndef _ENETCPP_ENETCPP_PACING_HPP_
+#define _ENETCPP_ENETCPP_PACING_HPP_
+
+#include "enetcpp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#endif
+
+namespace enetcpp {
+
+/**
+ * @brief How `Pacer` holds datagrams back.
+ */
+enum class PacingMode {
+    /** @brief `SO_TXTIME` if the socket accepts it, otherwise `TIMER`. */
+    AUTO,
+    /** @brief Launch times passed to the kernel with `SO_TXTIME`. */
+    TXTIME,
+    /** @brief A queue per peer in the library, released as the host is
+     * serviced. */
+    TIMER
+};
+
+/**
+ * @brief Tuning of `Pacer`.
+ */
+struct PacingPolicy {
+    /** @brief Rate of every peer, in bytes per second; `0` estimates each
+     * peer's rate from its window and round trip time. */
+    double rate = 0;
+    /** @brief Factor on the estimated rate, above 1 so that pacing spreads
+     * a window over a round trip without slowing ENet down. */
+    double gain = 1.25;
+    /** @brief Data that may leave back to back after a pause, in
+     * microseconds at the peer's rate. */
+    uint64_t burst = 250;
+    /** @brief Longest a datagram is held back, in microseconds; datagrams
+     * that would wait longer are dropped. */
+    uint64_t max_delay = 100000;
+    /** @brief How datagrams are held back. */
+    PacingMode mode = PacingMode::AUTO;
+};
+
+/**
+ * @brief Socket shim that paces each peer's datagrams.
+ *
+ * A peer's rate is `gain` times its effective reliable window (ENet's
+ * window scaled by its throttle) per smoothed round trip time, capped at
+ * the incoming bandwidth the peer declared, unless set with `set_rate()` or
+ * `PacingPolicy::rate`. Each datagram is due one datagram's worth of time
+ * after the previous one to the same peer; after a pause up to `burst` of
+ * data may leave at once.
+ *
+ * With `SO_TXTIME` (Linux), datagrams go to the socket straight away with
+ * their due time attached and the kernel's `fq` queueing discipline holds
+ * them until then, so pacing does not depend on how often the host is
+ * serviced. The interface needs `fq`, e.g.
+ * `tc qdisc replace dev eth0 root fq`; without it launch times are ignored.
+ * This applies only when the shim sits directly above the socket, i.e. was
+ * attached before other shims. Otherwise datagrams wait in a queue per peer
+ * and are released as the host is serviced; `next_deadline()` makes socket
+ * waits and `Host::next_timeout()` end when the next one is due.
+ *
+ * `CongestionController` paces its BBR peers itself, so use the two
+ * together only with those peers left to ENet's congestion control.
+ *
+ * Needs the library built with the `ENETCPP_SOCKET_SHIM` CMake option.
+ */
+class Pacer : public SocketShim {
+  private:
+    struct Flow {
+        double rate = 0;
+        double fixed_rate = 0;
+        uint64_t next_send = 0;
+        DatagramQueue queue;
+    };
+
+    // how often peer rates are re-estimated, in microseconds
+    static constexpr uint64_t UPDATE_INTERVAL = 1000;
+
+    ENetHost* m_host;
+    PacingPolicy m_policy;
+    bool m_txtime = false;
+    PeerSlots<Flow> m_flows;
+    uint64_t m_last_update = 0;
+    std::atomic<uint64_t> m_paced{0};
+    std::atomic<uint64_t> m_dropped{0};
+
+    double estimate(const ENetPeer* peer) const {
+        if (m_policy.rate > 0)
+            return m_policy.rate;
+        uint64_t window = (uint64_t)peer->windowSize * peer->packetThrottle /
+                          ENET_PEER_PACKET_THROTTLE_SCALE;
+        window = std::max<uint64_t>(window, peer->mtu);
+        uint32 rtt = std::max<uint32>(peer->roundTripTime, 1);
+        double rate = m_policy.gain * window * 1000 / rtt;
+        if (peer->incomingBandwidth != 0)
+            rate = std::min(rate, (double)peer->incomingBandwidth);
+        return rate;
+    }
+
+    /**
+     * @brief Follows peers connecting and disconnecting and refreshes their
+     * rates.
+     */
+    void update(ShimLink& below) {
+        m_flows.sweep([&](size_t index) {
+            m_flows[index].queue.flush(below, m_flows.address(index));
+        });
+        for (size_t i = 0; i < m_host->peerCount; i++) {
+            ENetPeer* peer = &m_host->peers[i];
+            if (!ShimProtocol::in_use(peer))
+                continue;
+            Flow& flow = m_flows.of(peer);
+            flow.rate = flow.fixed_rate > 0 ? flow.fixed_rate : estimate(peer);
+        }
+    }
+
+    uint64_t interval(const Flow& flow, size_t length) const {
+        return (uint64_t)(length * 1e6 / flow.rate);
+    }
+
+    /**
+     * @brief Returns when a datagram sent now is due, and books its time.
+     */
+    uint64_t schedule(Flow& flow, size_t length, uint64_t now) {
+        // a pause earns at most `burst` of sending at once
+        uint64_t earliest = now > m_policy.burst ? now - m_policy.burst : 0;
+        uint64_t due = std::max(flow.next_send, earliest);
+        flow.next_send = due + interval(flow, length);
+        return std::max(due, now);
+    }
+
+    int send_at(const ENetAddress& address, const void* data, size_t length,
+                uint64_t delay) {
+#if defined(__linux__) && defined(SO_TXTIME)
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        uint64_t launch = (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec +
+                          delay * 1000;
+
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = ENET_HOST_TO_NET_16(address.port);
+        sin.sin_addr.s_addr = address.host;
+        struct iovec iov;
+        iov.iov_base = (void*)data;
+        iov.iov_len = length;
+        char control[CMSG_SPACE(sizeof(launch))];
+        memset(control, 0, sizeof(control));
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_name = &sin;
+        message.msg_namelen = sizeof(sin);
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_TXTIME;
+        header->cmsg_len = CMSG_LEN(sizeof(launch));
+        memcpy(CMSG_DATA(header), &launch, sizeof(launch));
+
+        // the results of enet_socket_send
+        int sent = (int)sendmsg(m_host->socket, &message, MSG_NOSIGNAL);
+        if (sent == -1)
+            return errno == EWOULDBLOCK ? 0 : -1;
+        return sent;
+#else
+        (void)address;
+        (void)data;
+        (void)length;
+        (void)delay;
+        return -1;
+#endif
+    }
+
+  public:
+    /**
+     * @brief Constructs the shim; see `attach()`.
+     * @throws std::runtime_error if `PacingMode::TXTIME` was asked for and
+     * the socket does not support it.
+     */
+    Pacer(Host& host, PacingPolicy policy)
+        : m_host(host.get()), m_policy(policy),
+          m_flows(host.get(), host.peer_capacity()) {
+#if defined(__linux__) && defined(SO_TXTIME)
+        if (m_policy.mode != PacingMode::TIMER) {
+            struct sock_txtime config;
+            memset(&config, 0, sizeof(config));
+            config.clockid = CLOCK_MONOTONIC;
+            m_txtime = setsockopt(m_host->socket, SOL_SOCKET, SO_TXTIME,
+                                  &config, sizeof(config)) == 0;
+        }
+#endif
+        if (m_policy.mode == PacingMode::TXTIME && !m_txtime)
+            throw std::runtime_error("SO_TXTIME is not supported");
+    }
+
+    /**
+     * @brief Paces the datagrams of `host`'s peers.
+     *
+     * Attach it before other shims for `SO_TXTIME` to apply.
+     *
+     * @return The shim, to set rates and read statistics.
+     */
+    static std::shared_ptr<Pacer> attach(Host& host,
+                                         PacingPolicy policy = PacingPolicy()) {
+        auto shim = std::make_shared<Pacer>(host, policy);
+        host.add_shim(shim);
+        return shim;
+    }
+
+    /**
+     * @brief Sets the rate of one peer until it disconnects, e.g. from
+     * another estimator; `0` goes back to the policy's rate.
+     *
+     * Only call this from the thread servicing the host.
+     * @param peer The peer.
+     * @param rate The rate in bytes per second.
+     */
+    void set_rate(Peer peer, double rate) {
+        m_flows.of(peer.get()).fixed_rate = rate;
+        // applied at the next send
+        m_last_update = 0;
+    }
+
+    /**
+     * @brief Returns the rate a peer is paced at, in bytes per second, or
+     * `0` if it is not paced yet.
+     *
+     * Only call this from the thread servicing the host.
+     */
+    double rate(Peer peer) const {
+        if (!m_flows.current(peer.get()))
+            return 0;
+        return m_flows[peer.get() - m_host->peers].rate;
+    }
+
+    /**
+     * @brief Checks whether launch times go to the kernel with `SO_TXTIME`.
+     */
+    bool uses_txtime() const { return m_txtime; }
+
+    /**
+     * @brief Returns the number of datagrams sent later than ENet sent them.
+     */
+    uint64_t paced() const { return m_paced.load(); }
+
+    /**
+     * @brief Returns the number of datagrams dropped for waiting longer than
+     * `max_delay`.
+     */
+    uint64_t dropped() const { return m_dropped.load(); }
+
+    int send(ShimLink& below, const ENetAddress& address, const void* data,
+             size_t length) override {
+        uint64_t now = SocketShim::now();
+        if (now - m_last_update >= UPDATE_INTERVAL) {
+            m_last_update = now;
+            update(below);
+        }
+        size_t index = m_flows.find(address);
+        if (index == m_flows.NONE)
+            return below.send(address, data, length);
+        Flow& flow = m_flows[index];
+        if (flow.rate <= 0)
+            return below.send(address, data, length);
+
+        if (flow.queue.empty()) {
+            uint64_t booked = flow.next_send;
+            uint64_t due = schedule(flow, length, now);
+            if (due - now > m_policy.max_delay) {
+                flow.next_send = booked;
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return (int)length;
+            }
+            if (due == now)
+                return below.send(address, data, length);
+            m_paced.fetch_add(1, std::memory_order_relaxed);
+            if (m_txtime && below.reaches_socket())
+                return send_at(address, data, length, due - now);
+            // held back: next_send is when the head of the queue is due
+            flow.next_send = due;
+        } else if (flow.next_send +
+                       (uint64_t)(flow.queue.bytes() * 1e6 / flow.rate) >
+                   now + m_policy.max_delay) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return (int)length;
+        } else {
+            m_paced.fetch_add(1, std::memory_order_relaxed);
+        }
+        flow.queue.push(data, length);
+        return (int)length;
+    }
+
+    void poll(ShimLink& below) override {
+        uint64_t now = SocketShim::now();
+        m_flows.for_each([&](size_t index) {
+            Flow& flow = m_flows[index];
+            const ENetAddress& address = m_flows.address(index);
+            while (!flow.queue.empty() && flow.next_send <= now)
+                flow.next_send +=
+                    interval(flow, flow.queue.release(below, address));
+        });
+    }
+
+    uint64_t next_deadline() override {
+        uint64_t deadline = UINT64_MAX;
+        m_flows.for_each([&](size_t index) {
+            const Flow& flow = m_flows[index];
+            if (!flow.queue.empty())
+                deadline = std::min(deadline, flow.next_send);
+        });
+        return deadline;
+    }
+};
+
+} // namespace enetcpp
+
+#endif // _ENETCPP_ENETCPP_PACING_HPP_
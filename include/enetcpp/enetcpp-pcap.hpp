@@ -0,0 +1,602 @@
+/*
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <https://unlicense.org>
+
+ */
+
+/**
+ * @file enetcpp-pcap.hpp
+ * @brief Pcap capture of a host's datagrams, and replay of captures.
+ *
+ * `PcapCapture` is a socket shim that records every datagram a host sends and
+ * receives. The service loop only copies each datagram into a lock-free ring;
+ * a writer thread turns them into pcap records with synthesized IPv4 and UDP
+ * headers, so captures open directly in Wireshark or tcpdump. `PcapReplay`
+ * reads a capture, from `PcapCapture` or from tcpdump, and `ReplayShim` feeds
+ * its datagrams into a host in place of the socket, as fast as the host can
+ * take them or at the captured pace.
+ *
+ * Both need the library built with the `ENETCPP_SOCKET_SHIM` CMake option.
+ *
+ * @note This file extends the functionality of `enetcpp.hpp`.
+ */
+
+#ifndef _ENETCPP_ENETCPP_PCAP_HPP_
+#define _ENETCPP_ENETCPP_PCAP_HPP_
+
+#include "enetcpp.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace enetcpp {
+
+/**
+ * @brief A datagram read from a capture.
+ */
+struct CapturedDatagram {
+    /** @brief Capture timestamp in microseconds. */
+    uint64_t time;
+    /** @brief Source address. */
+    ENetAddress from;
+    /** @brief Destination address. */
+    ENetAddress to;
+    /** @brief UDP payload. */
+    std::vector<uint8> data;
+};
+
+/**
+ * @brief Records every datagram of a host to a pcap file.
+ *
+ * Attach with `PcapCapture::attach()`. Datagrams are written as raw IPv4
+ * (`LINKTYPE_RAW`) with the host's socket address on one side and the peer's
+ * on the other. Timestamps are wall-clock time, or the host's Clock if it has
+ * one.
+ *
+ * The shim is called under its host's lock and only copies the datagram into
+ * a single-producer ring, so a capture must belong to one host. When the
+ * writer thread falls behind and the ring fills up, datagrams are dropped from
+ * the capture (never from the host) and counted by `dropped()`.
+ *
+ * Shims added after the capture sit between it and ENet, so add it last to
+ * record exactly what ENet sends and receives, or first to record what goes
+ * over the wire.
+ */
+class PcapCapture : public SocketShim {
+  private:
+    struct Record {
+        uint32 size;
+        uint32 length;
+        uint64_t time;
+        ENetAddress from;
+        ENetAddress to;
+    };
+
+    static constexpr size_t ALIGNMENT = 32;
+    static_assert(sizeof(Record) <= ALIGNMENT, "Record must fit alignment");
+
+    std::FILE* m_file;
+    ENetAddress m_local;
+    size_t m_capacity;
+    std::unique_ptr<char[]> m_buffer;
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    std::atomic<size_t> m_captured{0};
+    std::atomic<size_t> m_dropped{0};
+    std::atomic<bool> m_stop{false};
+    std::mutex m_stop_mutex;
+    std::condition_variable m_stop_cv;
+    uint16_t m_ip_id = 0;
+    std::vector<uint8> m_scratch;
+    std::thread m_writer;
+
+    static uint64_t timestamp() {
+        if (Clock* clock = Clock::active())
+            return clock->microseconds();
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static void put16(uint8* out, uint16_t value) {
+        out[0] = (uint8)(value >> 8);
+        out[1] = (uint8)value;
+    }
+
+    void record(const ENetAddress& from, const ENetAddress& to,
+                const void* data, size_t length) {
+        size_t size = (sizeof(Record) + length + ALIGNMENT - 1) &
+                      ~(ALIGNMENT - 1);
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t contiguous = m_capacity - (head & (m_capacity - 1));
+        size_t needed = size > contiguous ? contiguous + size : size;
+        if (size > m_capacity || m_capacity - (head - tail) < needed) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (size > contiguous) {
+            Record* pad = (Record*)(m_buffer.get() + (head & (m_capacity - 1)));
+            pad->size = (uint32)contiguous;
+            pad->length = UINT32_MAX;
+            head += contiguous;
+        }
+        char* slot = m_buffer.get() + (head & (m_capacity - 1));
+        Record* header = (Record*)slot;
+        header->size = (uint32)size;
+        header->length = (uint32)length;
+        header->time = timestamp();
+        header->from = from;
+        header->to = to;
+        memcpy(slot + sizeof(Record), data, length);
+        m_head.store(head + size, std::memory_order_release);
+        m_captured.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void write(const Record& record, const uint8* payload) {
+        size_t length = 28 + record.length;
+        m_scratch.resize(16 + length);
+        uint8* out = m_scratch.data();
+        uint32 packet_header[4] = {(uint32)(record.time / 1000000),
+                                   (uint32)(record.time % 1000000),
+                                   (uint32)length, (uint32)length};
+        memcpy(out, packet_header, sizeof(packet_header));
+        uint8* ip = out + 16;
+        memset(ip, 0, 20);
+        ip[0] = 0x45;
+        put16(ip + 2, (uint16_t)length);
+        put16(ip + 4, m_ip_id++);
+        put16(ip + 6, 0x4000);
+        ip[8] = 64;
+        ip[9] = 17;
+        memcpy(ip + 12, &record.from.host, 4);
+        memcpy(ip + 16, &record.to.host, 4);
+        uint32 sum = 0;
+        for (int i = 0; i < 20; i += 2)
+            sum += (ip[i] << 8) | ip[i + 1];
+        while (sum >> 16)
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        put16(ip + 10, (uint16_t)~sum);
+        uint8* udp = ip + 20;
+        put16(udp, record.from.port);
+        put16(udp + 2, record.to.port);
+        put16(udp + 4, (uint16_t)(8 + record.length));
+        put16(udp + 6, 0);
+        memcpy(udp + 8, payload, record.length);
+        std::fwrite(out, 1, m_scratch.size(), m_file);
+    }
+
+    size_t drain() {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t count = 0;
+        while (tail != head) {
+            const char* slot = m_buffer.get() + (tail & (m_capacity - 1));
+            const Record* record = (const Record*)slot;
+            if (record->length != UINT32_MAX) {
+                write(*record, (const uint8*)(slot + sizeof(Record)));
+                count++;
+            }
+            tail += record->size;
+        }
+        m_tail.store(tail, std::memory_order_release);
+        return count;
+    }
+
+    void run() {
+        while (!m_stop.load(std::memory_order_acquire)) {
+            if (drain() > 0)
+                continue;
+            std::fflush(m_file);
+            std::unique_lock<std::mutex> lock(m_stop_mutex);
+            m_stop_cv.wait_for(lock, std::chrono::milliseconds(1), [this] {
+                return m_stop.load(std::memory_order_acquire);
+            });
+        }
+        drain();
+        std::fflush(m_file);
+    }
+
+  public:
+    /**
+     * @brief Opens a capture file and starts its writer thread.
+     * @param path The pcap file to create.
+     * @param local The host's own address, used for the IPv4 headers.
+     * @param ring_size Bytes buffered between the host and the writer thread,
+     * a power of two.
+     * @throws std::runtime_error if the file cannot be created or `ring_size`
+     * is not a power of two.
+     */
+    PcapCapture(const std::string& path, const ENetAddress& local,
+                size_t ring_size = 1 << 22)
+        : m_local(local), m_capacity(ring_size),
+          m_buffer(new char[ring_size]) {
+        if (ring_size < ALIGNMENT || (ring_size & (ring_size - 1)) != 0)
+            throw std::runtime_error(
+                "Capture ring size must be a power of two");
+        m_file = std::fopen(path.c_str(), "wb");
+        if (!m_file)
+            throw std::runtime_error("Failed to open capture file " + path);
+        std::setvbuf(m_file, NULL, _IOFBF, 1 << 20);
+        // microsecond pcap, version 2.4, snaplen 65535, LINKTYPE_RAW
+        uint32 header[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, 101};
+        std::fwrite(header, 1, sizeof(header), m_file);
+        m_writer = std::thread([this] { run(); });
+    }
+
+    ~PcapCapture() {
+        {
+            std::lock_guard<std::mutex> lock(m_stop_mutex);
+            m_stop.store(true, std::memory_order_release);
+        }
+        m_stop_cv.notify_one();
+        m_writer.join();
+        std::fclose(m_file);
+    }
+
+    PcapCapture(const PcapCapture&) = delete;
+    PcapCapture& operator=(const PcapCapture&) = delete;
+
+    /**
+     * @brief Starts capturing a host's datagrams.
+     * @param host The host; its socket address is used as the local address.
+     * @param path The pcap file to create.
+     * @param ring_size Bytes buffered between the host and the writer thread.
+     * @return The capture, which keeps writing until it is removed from the
+     * host with `Host::clear_shims()` and released.
+     * @throws std::runtime_error if the file cannot be created or the
+     * library was built without `ENETCPP_SOCKET_SHIM`.
+     */
+    static std::shared_ptr<PcapCapture> attach(Host& host,
+                                               const std::string& path,
+                                               size_t ring_size = 1 << 22) {
+        ENetAddress local = host.get()->address;
+        ENetAddress bound;
+        if (enet_socket_get_address(host.get()->socket, &bound) == 0) {
+            if (local.host == ENET_HOST_ANY)
+                local.host = bound.host;
+            local.port = bound.port;
+        }
+        auto capture = std::make_shared<PcapCapture>(path, local, ring_size);
+        host.add_shim(capture);
+        return capture;
+    }
+
+    int send(ShimLink& below, const ENetAddress& address, const void* data,
+             size_t length) override {
+        int sent = below.send(address, data, length);
+        if (sent > 0)
+            record(m_local, address, data, length);
+        return sent;
+    }
+
+    int receive(ShimLink& below, ENetAddress& address, void* data,
+                size_t capacity) override {
+        int received = below.receive(address, data, capacity);
+        if (received > 0)
+            record(address, m_local, data, received);
+        return received;
+    }
+
+    /**
+     * @brief Returns the number of datagrams queued for the file.
+     */
+    size_t captured() const {
+        return m_captured.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the number of datagrams left out because the ring was
+     * full.
+     */
+    size_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+};
+
+/**
+ * @brief Reads the UDP datagrams of a pcap file.
+ */
+class PcapReplay {
+  private:
+    std::vector<CapturedDatagram> m_datagrams;
+
+    static uint32 read32(const uint8* in, bool swapped) {
+        uint32 value;
+        memcpy(&value, in, 4);
+        if (swapped)
+            value = (value >> 24) | ((value >> 8) & 0xFF00) |
+                    ((value << 8) & 0xFF0000) | (value << 24);
+        return value;
+    }
+
+    static uint16_t read16(const uint8* in) {
+        return (uint16_t)((in[0] << 8) | in[1]);
+    }
+
+    // Returns the offset of the IPv4 header in a frame, or -1 if there is none.
+    static long ipv4_offset(uint32 link_type, const uint8* frame,
+                            size_t length) {
+        switch (link_type) {
+        case 0: // BSD loopback
+            return length >= 4 && (frame[0] == 2 || frame[3] == 2) ? 4 : -1;
+        case 1: // Ethernet
+            return length >= 14 && read16(frame + 12) == 0x0800 ? 14 : -1;
+        case 101: // raw IP
+        case 228: // raw IPv4
+            return 0;
+        case 113: // Linux cooked
+            return length >= 16 && read16(frame + 14) == 0x0800 ? 16 : -1;
+        default:
+            return -1;
+        }
+    }
+
+  public:
+    /**
+     * @brief Reads every IPv4 UDP datagram in a capture.
+     *
+     * Reads classic pcap files with raw IP, Ethernet, Linux cooked or loopback
+     * framing, as written by `PcapCapture` or tcpdump. Fragments, truncated
+     * packets and anything that is not IPv4 UDP are skipped.
+     *
+     * @param path The capture file.
+     * @throws std::runtime_error if the file cannot be read or is not a
+     * supported pcap file.
+     */
+    explicit PcapReplay(const std::string& path) {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            throw std::runtime_error("Failed to open capture file " + path);
+        std::vector<uint8> contents;
+        uint8 chunk[1 << 16];
+        size_t read;
+        while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+            contents.insert(contents.end(), chunk, chunk + read);
+        std::fclose(file);
+
+        if (contents.size() < 24)
+            throw std::runtime_error("Not a pcap file: " + path);
+        uint32 magic;
+        memcpy(&magic, contents.data(), 4);
+        bool swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+        bool nanoseconds = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+        if (!swapped && !nanoseconds && magic != 0xa1b2c3d4)
+            throw std::runtime_error("Not a pcap file: " + path);
+        uint32 link_type = read32(contents.data() + 20, swapped) & 0xFFFF;
+        if (link_type != 0 && link_type != 1 && link_type != 101 &&
+            link_type != 113 && link_type != 228)
+            throw std::runtime_error("Unsupported pcap link type in " + path);
+
+        size_t offset = 24;
+        while (offset + 16 <= contents.size()) {
+            const uint8* record = contents.data() + offset;
+            uint64_t seconds = read32(record, swapped);
+            uint64_t fraction = read32(record + 4, swapped);
+            size_t length = read32(record + 8, swapped);
+            offset += 16;
+            if (offset + length > contents.size())
+                break;
+            const uint8* frame = contents.data() + offset;
+            offset += length;
+
+            long ip_offset = ipv4_offset(link_type, frame, length);
+            if (ip_offset < 0 || length < (size_t)ip_offset + 20)
+                continue;
+            const uint8* ip = frame + ip_offset;
+            size_t ip_length = length - ip_offset;
+            size_t header_length = (ip[0] & 0x0F) * 4;
+            if ((ip[0] >> 4) != 4 || ip[9] != 17 || header_length < 20 ||
+                (read16(ip + 6) & 0x3FFF) != 0 ||
+                ip_length < header_length + 8)
+                continue;
+            const uint8* udp = ip + header_length;
+            size_t udp_length = read16(udp + 4);
+            if (udp_length < 8 || header_length + udp_length > ip_length)
+                continue;
+
+            CapturedDatagram datagram;
+            datagram.time = seconds * 1000000 +
+                            (nanoseconds ? fraction / 1000 : fraction);
+            memcpy(&datagram.from.host, ip + 12, 4);
+            memcpy(&datagram.to.host, ip + 16, 4);
+            datagram.from.port = read16(udp);
+            datagram.to.port = read16(udp + 2);
+            datagram.data.assign(udp + 8, udp + udp_length);
+            m_datagrams.push_back(std::move(datagram));
+        }
+    }
+
+    /**
+     * @brief Returns the datagrams in capture order.
+     */
+    const std::vector<CapturedDatagram>& datagrams() const {
+        return m_datagrams;
+    }
+
+    /**
+     * @brief Returns the datagrams sent to a port, e.g. a host's incoming
+     * traffic.
+     */
+    std::vector<CapturedDatagram> to_port(uint16_t port) const {
+        std::vector<CapturedDatagram> out;
+        for (const CapturedDatagram& datagram : m_datagrams)
+            if (datagram.to.port == port)
+                out.push_back(datagram);
+        return out;
+    }
+};
+
+/**
+ * @brief Feeds captured datagrams into a host in place of its socket.
+ *
+ * Attach with `ReplayShim::attach()` to a host created for the replay, e.g.
+ * with the same peer and channel limits as the captured one. ENet receives the
+ * datagrams from their captured source addresses; anything it sends is
+ * counted and discarded. A capture that starts before the connections were
+ * made replays them too, since a fresh host assigns the same peer slots.
+ *
+ * With a speed of `0` each `Host::service()` reads as many datagrams as ENet
+ * accepts, so the host runs as fast as it can. Otherwise datagrams are
+ * released at the captured pace, scaled by the speed.
+ */
+class ReplayShim : public SocketShim {
+  private:
+    std::vector<CapturedDatagram> m_datagrams;
+    double m_speed;
+    size_t m_next = 0;
+    uint64_t m_start = UINT64_MAX;
+    std::atomic<size_t> m_delivered{0};
+    std::atomic<size_t> m_discarded{0};
+
+    uint64_t due(size_t index) const {
+        uint64_t offset = m_datagrams[index].time - m_datagrams[0].time;
+        return m_start + (uint64_t)(offset / m_speed);
+    }
+
+    bool ready() {
+        if (m_next >= m_datagrams.size())
+            return false;
+        if (m_speed <= 0)
+            return true;
+        if (m_start == UINT64_MAX)
+            m_start = now();
+        return due(m_next) <= now();
+    }
+
+  public:
+    /**
+     * @brief Constructs a replay of the given datagrams.
+     * @param datagrams The datagrams, in order.
+     * @param speed `0` to replay as fast as possible, otherwise a multiple of
+     * the captured pace.
+     */
+    explicit ReplayShim(std::vector<CapturedDatagram> datagrams,
+                        double speed = 0)
+        : m_datagrams(std::move(datagrams)), m_speed(speed) {}
+
+    /**
+     * @brief Replays the datagrams a capture holds for a port into a host.
+     * @param host The host to feed.
+     * @param path The capture file.
+     * @param port Only datagrams sent to this port are replayed, normally the
+     * captured host's port; `0` replays every datagram.
+     * @param speed `0` to replay as fast as possible, otherwise a multiple of
+     * the captured pace.
+     * @return The attached shim.
+     * @throws std::runtime_error if the capture cannot be read or the library
+     * was built without `ENETCPP_SOCKET_SHIM`.
+     */
+    static std::shared_ptr<ReplayShim> attach(Host& host,
+                                              const std::string& path,
+                                              uint16_t port = 0,
+                                              double speed = 0) {
+        PcapReplay capture(path);
+        auto shim = std::make_shared<ReplayShim>(
+            port ? capture.to_port(port) : capture.datagrams(), speed);
+        host.add_shim(shim);
+        return shim;
+    }
+
+    int send(ShimLink& below, const ENetAddress& address, const void* data,
+             size_t length) override {
+        (void)below;
+        (void)address;
+        (void)data;
+        m_discarded.fetch_add(1, std::memory_order_relaxed);
+        return (int)length;
+    }
+
+    int receive(ShimLink& below, ENetAddress& address, void* data,
+                size_t capacity) override {
+        (void)below;
+        if (!ready())
+            return 0;
+        const CapturedDatagram& datagram = m_datagrams[m_next++];
+        address = datagram.from;
+        m_delivered.fetch_add(1, std::memory_order_relaxed);
+        if (datagram.data.size() > capacity)
+            return -2;
+        memcpy(data, datagram.data.data(), datagram.data.size());
+        return (int)datagram.data.size();
+    }
+
+    uint64_t next_deadline() override {
+        if (m_speed <= 0 || m_next >= m_datagrams.size() ||
+            m_start == UINT64_MAX)
+            return UINT64_MAX;
+        return due(m_next);
+    }
+
+    bool replaces_socket() const override { return true; }
+
+    int wait(enet_uint32* condition, enet_uint32 timeout) override {
+        bool receive = ready();
+        if (!receive && timeout > 0 && m_speed > 0 &&
+            m_next < m_datagrams.size() && !Clock::active()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+            receive = ready();
+        }
+        *condition = receive ? ENET_SOCKET_WAIT_RECEIVE : ENET_SOCKET_WAIT_NONE;
+        return 0;
+    }
+
+    /**
+     * @brief Checks whether every datagram has been handed to ENet.
+     *
+     * Only call this with the host lock held or from the servicing thread.
+     */
+    bool done() const { return m_next >= m_datagrams.size(); }
+
+    /**
+     * @brief Returns the number of datagrams in the replay.
+     */
+    size_t size() const { return m_datagrams.size(); }
+
+    /**
+     * @brief Returns the number of datagrams handed to ENet so far.
+     */
+    size_t delivered() const {
+        return m_delivered.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the number of datagrams ENet sent, which are discarded.
+     */
+    size_t discarded() const {
+        return m_discarded.load(std::memory_order_relaxed);
+    }
+};
+
+} // namespace enetcpp
+
+#endif // _ENETCPP_ENETCPP_PCAP_HPP_
@@ -0,0 +1,432 @@
+/*
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <https://unlicense.org>
+
+ */
+
+/**
+ * @file enetcpp-sharded.hpp
+ * @brief A server spanning several ENet hosts, for more than 4095 peers.
+ *
+ * ENet addresses peers with a 12 bit id, so one `ENetHost` holds at most 4095
+ * of them. `ShardedHost` splits a larger server across several hosts, either
+ * on consecutive ports or sharing one port with `SO_REUSEPORT`, and presents
+ * them as one host: events from every shard reach the same handlers, peers
+ * are named by one `PeerId` space, and broadcasts go to all shards.
+ *
+ * @note This file extends the functionality of `enetcpp.hpp`.
+ */
+
+#ifndef _ENETCPP_ENETCPP_SHARDED_HPP_
+#define _ENETCPP_ENETCPP_SHARDED_HPP_
+
+#include "enetcpp.hpp"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+namespace enetcpp {
+
+/**
+ * @brief How the shards of a `ShardedHost` share the server address.
+ */
+enum class ShardMode {
+    /** Shard `i` listens on the server port plus `i`; clients pick one. */
+    PORTS,
+    /**
+     * Every shard listens on the server port with `SO_REUSEPORT`, and the
+     * kernel spreads clients across them by address. Linux only.
+     */
+    REUSEPORT
+};
+
+/**
+ * @brief A peer handle that is unique across the shards of a `ShardedHost`.
+ *
+ * The shard index is in the bits above `PEER_ID_BITS`, and the peer's slot in
+ * that shard's host in the bits below.
+ */
+using PeerId = uint32;
+
+/**
+ * @brief Server that spans several ENet hosts behind one host interface.
+ *
+ * Each shard is a `Host`, so everything `Host` offers is available per shard
+ * through `shard()`. `ShardedHost` itself covers what a server needs across
+ * all of them: servicing, flushing, broadcasting, statistics and peer lookup.
+ *
+ * `service()` services every shard from the calling thread. Shards can instead
+ * be serviced from a thread each through `shard(i).service()`, in which case
+ * the `on_event()` handlers are called concurrently from those threads.
+ */
+class ShardedHost {
+  public:
+    /** @brief Bits of a `PeerId` holding the peer's slot in its shard. */
+    static constexpr unsigned PEER_ID_BITS = 12;
+
+    /** @brief Most peers one shard holds, ENet's peer id limit. */
+    static constexpr size_t SHARD_PEERS = ENET_PROTOCOL_MAXIMUM_PEER_ID;
+
+    /**
+     * @brief One of the hosts of a `ShardedHost`, forwarding its events.
+     */
+    class Shard : public Host {
+      private:
+        ShardedHost& m_owner;
+
+      public:
+        /**
+         * @brief Constructs a shard listening on `address`.
+         */
+        Shard(ShardedHost& owner, Address address, size_t peer_count,
+              size_t channel_limit, uint32 incoming_bandwidth,
+              uint32 outgoing_bandwidth, Logger logger)
+            : Host(address, peer_count, channel_limit, incoming_bandwidth,
+                   outgoing_bandwidth, logger),
+              m_owner(owner) {}
+
+        /**
+         * @brief Constructs an unbound shard, for `ShardMode::REUSEPORT`.
+         */
+        Shard(ShardedHost& owner, size_t peer_count, size_t channel_limit,
+              uint32 incoming_bandwidth, uint32 outgoing_bandwidth,
+              Logger logger)
+            : Host(peer_count, channel_limit, incoming_bandwidth,
+                   outgoing_bandwidth, logger),
+              m_owner(owner) {}
+
+        void on_event(EventConnect& event) override {
+            m_owner.on_event(event);
+        }
+
+        void on_event(EventDisconnect& event) override {
+            m_owner.on_event(event);
+        }
+
+        void on_event(EventReceive& event) override {
+            m_owner.on_event(event);
+        }
+    };
+
+  private:
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::vector<Address> m_addresses;
+    Logger m_logger;
+
+    /**
+     * @brief Binds an unbound shard's socket to `address` with
+     * `SO_REUSEPORT` set.
+     */
+    void bind_reuseport(Shard& shard, Address address) {
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+        ENetHost* host = shard.get();
+        int on = 1;
+        if (setsockopt(host->socket, SOL_SOCKET, SO_REUSEPORT, &on,
+                       sizeof(on)) != 0 ||
+            enet_socket_bind(host->socket, address.get()) != 0)
+            throw std::runtime_error("Failed to bind a reuseport shard");
+        if (enet_socket_get_address(host->socket, &host->address) != 0)
+            host->address = *address.get();
+#else
+        (void)shard;
+        (void)address;
+        throw std::runtime_error("SO_REUSEPORT is not supported here");
+#endif
+    }
+
+    /**
+     * @brief Blocks until any shard's socket is readable or `timeout`
+     * milliseconds pass.
+     */
+    void wait(uint32 timeout) {
+        ENetSocketSet set;
+        ENET_SOCKETSET_EMPTY(set);
+        ENetSocket max_socket = 0;
+        for (auto& shard : m_shards) {
+            ENetSocket socket = shard->get()->socket;
+            ENET_SOCKETSET_ADD(set, socket);
+            max_socket = std::max(max_socket, socket);
+        }
+        enet_socketset_select(max_socket, &set, NULL, timeout);
+    }
+
+  public:
+    /**
+     * @brief Constructs a server holding `peer_count` peers, with as many
+     * shards as that needs.
+     *
+     * @param address The server address. With `ShardMode::PORTS` shard `i`
+     * listens on its port plus `i`, so the port must not be `0`.
+     * @param peer_count The maximum number of peers across all shards.
+     * @param channel_limit The maximum number of channels.
+     * @param mode How the shards share the server address.
+     * @param incoming_bandwidth The incoming bandwidth limit of each shard.
+     * @param outgoing_bandwidth The outgoing bandwidth limit of each shard.
+     * @throws std::runtime_error if a shard cannot be created.
+     */
+    ShardedHost(Address address, size_t peer_count, size_t channel_limit = 1U,
+                ShardMode mode = ShardMode::PORTS,
+                uint32 incoming_bandwidth = 0U,
+                uint32 outgoing_bandwidth = 0U, Logger logger = Logger())
+        : ShardedHost(address, (peer_count + SHARD_PEERS - 1) / SHARD_PEERS,
+                      peer_count, channel_limit, mode, incoming_bandwidth,
+                      outgoing_bandwidth, logger) {}
+
+    /**
+     * @brief Constructs a server with an explicit number of shards.
+     *
+     * More shards than `peer_count` needs spread the load of servicing them
+     * from a thread each.
+     *
+     * @param address The server address, see the constructor above.
+     * @param shards The number of shards.
+     * @param peer_count The maximum number of peers across all shards.
+     * @param channel_limit The maximum number of channels.
+     * @param mode How the shards share the server address.
+     * @param incoming_bandwidth The incoming bandwidth limit of each shard.
+     * @param outgoing_bandwidth The outgoing bandwidth limit of each shard.
+     * @throws std::runtime_error if a shard cannot be created, or `shards`
+     * cannot hold `peer_count` peers.
+     */
+    ShardedHost(Address address, size_t shards, size_t peer_count,
+                size_t channel_limit, ShardMode mode = ShardMode::PORTS,
+                uint32 incoming_bandwidth = 0U,
+                uint32 outgoing_bandwidth = 0U, Logger logger = Logger())
+        : m_logger(logger) {
+        if (shards == 0)
+            shards = 1;
+        size_t per_shard = (peer_count + shards - 1) / shards;
+        if (per_shard > SHARD_PEERS ||
+            shards > ((size_t)1 << (32 - PEER_ID_BITS)))
+            throw std::runtime_error("Too few shards for the peer count");
+        if (per_shard == 0)
+            per_shard = 1;
+        m_logger.trace("creating %lu ENet shards of %lu peers", shards,
+                       per_shard);
+        for (size_t i = 0; i < shards; i++) {
+            if (mode == ShardMode::PORTS) {
+                Address shard_address(address.host(),
+                                      (uint16)(address.port() + i));
+                m_shards.emplace_back(new Shard(
+                    *this, shard_address, per_shard, channel_limit,
+                    incoming_bandwidth, outgoing_bandwidth, logger));
+                m_addresses.push_back(shard_address);
+            } else {
+                m_shards.emplace_back(new Shard(*this, per_shard,
+                                                channel_limit,
+                                                incoming_bandwidth,
+                                                outgoing_bandwidth, logger));
+                bind_reuseport(*m_shards.back(), address);
+                if (i == 0)
+                    m_addresses.push_back(address);
+            }
+        }
+    }
+
+    virtual ~ShardedHost() = default;
+
+    ShardedHost(const ShardedHost&) = delete;
+    ShardedHost& operator=(const ShardedHost&) = delete;
+
+    /**
+     * @brief Returns the number of shards.
+     */
+    size_t shard_count() const { return m_shards.size(); }
+
+    /**
+     * @brief Returns shard `index`.
+     */
+    Shard& shard(size_t index) { return *m_shards.at(index); }
+
+    /**
+     * @brief Returns the addresses clients should connect to: one per shard
+     * with `ShardMode::PORTS`, the shared one with `ShardMode::REUSEPORT`.
+     */
+    const std::vector<Address>& addresses() const { return m_addresses; }
+
+    /**
+     * @brief Returns the number of peer slots across all shards.
+     */
+    size_t peer_capacity() const {
+        size_t out = 0;
+        for (auto& shard : m_shards)
+            out += shard->peer_capacity();
+        return out;
+    }
+
+    /**
+     * @brief Returns the number of connected peers across all shards.
+     *
+     * This is thread safe.
+     */
+    size_t connected_peers() {
+        size_t out = 0;
+        for (auto& shard : m_shards)
+            out += shard->metrics().connected_peers.load();
+        return out;
+    }
+
+    /**
+     * @brief Services every shard, dispatching their events.
+     *
+     * Drains all shards without blocking first. If none had events, blocks
+     * until one of their sockets is readable, `timeout` passes or the
+     * earliest shard has timed work to do (see `Host::next_timeout()`), then
+     * drains them again.
+     *
+     * @param timeout The longest time to block, in milliseconds.
+     * @return The number of events dispatched, or a negative value on error.
+     */
+    int service(uint32 timeout = 0) {
+        int total = 0;
+        for (auto& shard : m_shards) {
+            int rc = shard->service_batch(0);
+            if (rc < 0)
+                return rc;
+            total += rc;
+        }
+        if (total > 0 || timeout == 0)
+            return total;
+        for (auto& shard : m_shards)
+            timeout = shard->next_timeout(timeout);
+        if (timeout > 0)
+            wait(timeout);
+        for (auto& shard : m_shards) {
+            int rc = shard->service_batch(0);
+            if (rc < 0)
+                return rc;
+            total += rc;
+        }
+        return total;
+    }
+
+    /**
+     * @brief Flushes every shard's queued packets to the network.
+     */
+    void flush() {
+        for (auto& shard : m_shards)
+            shard->flush();
+    }
+
+    /**
+     * @brief Broadcasts a packet to the connected peers of every shard.
+     *
+     * Each shard after the first gets its own copy of the packet, since ENet
+     * counts packet references without synchronization and the shards may be
+     * serviced from different threads.
+     *
+     * @param packet The packet to be broadcasted.
+     * @param channel The channel on which the packet will be broadcast.
+     */
+    void broadcast(Packet& packet, uint8 channel = 0) {
+        for (size_t i = 1; i < m_shards.size(); i++) {
+            Packet copy(packet.data(), packet.length(), packet.flags());
+            m_shards[i]->broadcast(copy, channel);
+        }
+        m_shards[0]->broadcast(packet, channel);
+    }
+
+    /**
+     * @brief Sets every shard's window trim, see `Host::set_window_trim()`.
+     */
+    void set_window_trim(size_t spare) {
+        for (auto& shard : m_shards)
+            shard->set_window_trim(spare);
+    }
+
+    /**
+     * @brief Snapshots every connected peer of every shard.
+     * @param out Replaced with the snapshots.
+     * @return The number of snapshots.
+     */
+    size_t peer_stats(std::vector<PeerStats>& out) {
+        std::vector<PeerStats> shard_stats;
+        out.clear();
+        for (auto& shard : m_shards) {
+            shard->peer_stats(shard_stats);
+            out.insert(out.end(), shard_stats.begin(), shard_stats.end());
+        }
+        return out.size();
+    }
+
+    /**
+     * @brief Returns the id of a peer of one of the shards.
+     * @throws std::runtime_error if the peer belongs to no shard.
+     */
+    PeerId peer_id(Peer peer) {
+        ENetPeer* enet_peer = peer.get();
+        for (size_t i = 0; i < m_shards.size(); i++) {
+            if (enet_peer->host == m_shards[i]->get())
+                return ((PeerId)i << PEER_ID_BITS) |
+                       (PeerId)(enet_peer - enet_peer->host->peers);
+        }
+        throw std::runtime_error("Peer does not belong to this host");
+    }
+
+    /**
+     * @brief Returns the peer with id `id`.
+     *
+     * The slot may since have been reused by another connection, so ids of
+     * disconnected peers should be dropped on `EventDisconnect`.
+     *
+     * @throws std::runtime_error if no shard has that slot.
+     */
+    Peer peer(PeerId id) {
+        size_t index = id >> PEER_ID_BITS;
+        size_t slot = id & (((PeerId)1 << PEER_ID_BITS) - 1);
+        if (index >= m_shards.size() ||
+            slot >= m_shards[index]->peer_capacity())
+            throw std::runtime_error("Invalid peer id");
+        return Peer(&m_shards[index]->get()->peers[slot]);
+    }
+
+    /**
+     * @brief Handles connection events from every shard.
+     * @param event The connection event.
+     */
+    virtual void on_event(EventConnect& event) { (void)event; }
+
+    /**
+     * @brief Handles disconnection events from every shard.
+     * @param event The disconnection event.
+     */
+    virtual void on_event(EventDisconnect& event) { (void)event; }
+
+    /**
+     * @brief Handles packet reception events from every shard.
+     * @param event The packet reception event.
+     */
+    virtual void on_event(EventReceive& event) { (void)event; }
+};
+
+} // namespace enetcpp
+
+#endif // _ENETCPP_ENETCPP_SHARDED_HPP_
@@ -0,0 +1,732 @@
+/*
+
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <https://unlicense.org>
+
+ */
+
+/**
+ * @file enetcpp-shim.hpp
+ * @brief Socket shims: network impairment, an in-memory transport and the
+ * link-time socket wrappers.
+ *
+ * When the library is built with the `ENETCPP_SOCKET_SHIM` CMake option (the
+ * default on Linux), ENet's `enet_socket_send`, `enet_socket_receive` and
+ * `enet_socket_wait` are wrapped at link time with `--wrap`, so every datagram
+ * of a host passes through the `SocketShim` objects attached with
+ * `Host::add_shim()`. `enet_time_get` is wrapped too, so hosts can run on
+ * their own `Clock`. This file provides those wrappers and an
+ * `ImpairmentShim` that injects loss, latency, jitter, reordering,
+ * duplication and bandwidth limits, reproducibly from a seed, a
+ * `MemoryNetwork` that connects hosts through in-memory queues instead of
+ * UDP, and a `Simulation` that runs such hosts on a virtual clock.
+ *
+ * @note This file extends the functionality of `enetcpp.hpp`.
+ */
+
+#ifndef _ENETCPP_ENETCPP_SHIM_HPP_
+#define _ENETCPP_ENETCPP_SHIM_HPP_
+
+#include "enetcpp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace enetcpp {
+
+/**
+ * @brief Link conditions for one direction of an ImpairmentShim.
+ */
+struct Impairment {
+    /** @brief Probability of dropping a datagram, from 0 to 1. */
+    double loss = 0;
+    /** @brief Fixed one-way delay, in milliseconds. */
+    double latency = 0;
+    /** @brief Extra delay drawn uniformly from 0 to `jitter` milliseconds. */
+    double jitter = 0;
+    /**
+     * @brief Probability of a datagram skipping the latency and jitter, so it
+     * overtakes the ones before it.
+     */
+    double reorder = 0;
+    /** @brief Probability of delivering a datagram twice. */
+    double duplicate = 0;
+    /** @brief Link rate in bytes per second, or 0 for unlimited. */
+    double bandwidth = 0;
+    /**
+     * @brief Longest queue behind the bandwidth limit, in milliseconds, before
+     * datagrams are tail dropped.
+     */
+    double queue = 50;
+
+    /**
+     * @brief Checks whether any impairment is configured.
+     */
+    bool active() const {
+        return loss > 0 || latency > 0 || jitter > 0 || reorder > 0 ||
+               duplicate > 0 || bandwidth > 0;
+    }
+};
+
+/**
+ * @brief Datagram counts for one direction of an ImpairmentShim.
+ */
+struct ImpairmentStats {
+    /** @brief Datagrams submitted. */
+    uint64_t datagrams = 0;
+    /** @brief Datagrams dropped by `Impairment::loss`. */
+    uint64_t lost = 0;
+    /** @brief Datagrams dropped because the bandwidth queue was full. */
+    uint64_t queue_dropped = 0;
+    /** @brief Extra copies created by `Impairment::duplicate`. */
+    uint64_t duplicated = 0;
+    /** @brief Datagrams that skipped the delay. */
+    uint64_t reordered = 0;
+    /** @brief Datagrams passed on. */
+    uint64_t delivered = 0;
+};
+
+/**
+ * @brief A SocketShim that makes a host's link behave like a WAN path.
+ *
+ * Outgoing and incoming datagrams are impaired independently. Every random
+ * decision comes from a generator seeded in the constructor, so a run with
+ * the same seed and the same traffic makes the same decisions. Delayed
+ * datagrams are released whenever the host is serviced or flushed; the
+ * socket wait is cut short when one becomes due.
+ *
+ * The configuration can be changed while the host is running.
+ */
+class ImpairmentShim : public SocketShim {
+  private:
+    struct Datagram {
+        ENetAddress address;
+        std::vector<uint8> data;
+    };
+
+    struct Path {
+        Impairment config;
+        uint64_t state;
+        uint64_t link_free = 0;
+        std::multimap<uint64_t, Datagram> queue;
+        ImpairmentStats stats;
+
+        /**
+         * @brief Returns a uniform double in [0, 1) from a splitmix64 stream.
+         */
+        double random() {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            z ^= z >> 31;
+            return (z >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        void submit(uint64_t now, const ENetAddress& address,
+                    const void* data, size_t length) {
+            stats.datagrams++;
+            if (random() < config.loss) {
+                stats.lost++;
+                return;
+            }
+            int copies = 1;
+            if (random() < config.duplicate) {
+                copies = 2;
+                stats.duplicated++;
+            }
+            for (int i = 0; i < copies; i++) {
+                uint64_t at = now;
+                if (config.bandwidth > 0) {
+                    uint64_t start = std::max(now, link_free);
+                    if (start - now > config.queue * 1000) {
+                        stats.queue_dropped++;
+                        continue;
+                    }
+                    link_free = start + (uint64_t)(length * 1e6 /
+                                                   config.bandwidth);
+                    at = link_free;
+                }
+                if (random() < config.reorder)
+                    stats.reordered++;
+                else
+                    at += (uint64_t)((config.latency +
+                                      random() * config.jitter) *
+                                     1000);
+                const uint8* bytes = (const uint8*)data;
+                queue.emplace(at,
+                              Datagram{address, std::vector<uint8>(
+                                                    bytes, bytes + length)});
+            }
+        }
+
+        bool due(uint64_t now) const {
+            return !queue.empty() && queue.begin()->first <= now;
+        }
+
+        uint64_t deadline() const {
+            return queue.empty() ? UINT64_MAX : queue.begin()->first;
+        }
+    };
+
+    std::mutex m_mutex;
+    Path m_outgoing;
+    Path m_incoming;
+
+  public:
+    /**
+     * @brief Constructs the shim.
+     * @param outgoing Conditions for datagrams the host sends.
+     * @param incoming Conditions for datagrams the host receives.
+     * @param seed Seed for every random decision.
+     */
+    ImpairmentShim(const Impairment& outgoing, const Impairment& incoming,
+                   uint64_t seed = 1) {
+        m_outgoing.config = outgoing;
+        m_incoming.config = incoming;
+        m_outgoing.state = seed;
+        m_incoming.state = seed ^ 0x5851f42d4c957f2dULL;
+    }
+
+    /**
+     * @brief Changes the conditions for datagrams the host sends.
+     */
+    void set_outgoing(const Impairment& outgoing) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_outgoing.config = outgoing;
+    }
+
+    /**
+     * @brief Changes the conditions for datagrams the host receives.
+     */
+    void set_incoming(const Impairment& incoming) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_incoming.config = incoming;
+    }
+
+    /**
+     * @brief Returns the counts for datagrams the host sent.
+     */
+    ImpairmentStats outgoing_stats() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_outgoing.stats;
+    }
+
+    /**
+     * @brief Returns the counts for datagrams the host received.
+     */
+    ImpairmentStats incoming_stats() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_incoming.stats;
+    }
+
+    int send(ShimLink& below, const ENetAddress& address, const void* data,
+             size_t length) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_outgoing.config.active() && m_outgoing.queue.empty()) {
+            m_outgoing.stats.datagrams++;
+            m_outgoing.stats.delivered++;
+            return below.send(address, data, length);
+        }
+        uint64_t now = SocketShim::now();
+        m_outgoing.submit(now, address, data, length);
+        release(below, now);
+        return (int)length;
+    }
+
+    int receive(ShimLink& below, ENetAddress& address, void* data,
+                size_t capacity) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_incoming.config.active() && m_incoming.queue.empty()) {
+            int length = below.receive(address, data, capacity);
+            if (length > 0) {
+                m_incoming.stats.datagrams++;
+                m_incoming.stats.delivered++;
+            }
+            return length;
+        }
+        // take everything the socket has so it is delayed from its arrival
+        uint8 buffer[ENET_PROTOCOL_MAXIMUM_MTU];
+        ENetAddress from;
+        int length;
+        while ((length = below.receive(from, buffer, sizeof(buffer))) > 0)
+            m_incoming.submit(SocketShim::now(), from, buffer, length);
+        if (!m_incoming.due(SocketShim::now()))
+            return length < 0 ? length : 0;
+        auto it = m_incoming.queue.begin();
+        const std::vector<uint8>& datagram = it->second.data;
+        address = it->second.address;
+        length = (int)datagram.size();
+        if (datagram.size() > capacity)
+            length = -2;
+        else
+            memcpy(data, datagram.data(), datagram.size());
+        m_incoming.queue.erase(it);
+        m_incoming.stats.delivered++;
+        return length;
+    }
+
+    void poll(ShimLink& below) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        release(below, SocketShim::now());
+    }
+
+    uint64_t next_deadline() override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return std::min(m_outgoing.deadline(), m_incoming.deadline());
+    }
+
+  private:
+    void release(ShimLink& below, uint64_t now) {
+        while (m_outgoing.due(now)) {
+            auto it = m_outgoing.queue.begin();
+            const Datagram& datagram = it->second;
+            // keep it at the head if the socket would block
+            if (below.send(datagram.address, datagram.data.data(),
+                           datagram.data.size()) == 0)
+                return;
+            m_outgoing.queue.erase(it);
+            m_outgoing.stats.delivered++;
+        }
+    }
+};
+
+class MemoryNetwork;
+
+/**
+ * @brief A host's attachment to a MemoryNetwork, replacing its UDP socket.
+ *
+ * Incoming datagrams wait in a bounded lock-free queue that any sending host
+ * may push to; only the owning host pops from it. Datagrams that find the
+ * queue full are dropped, as a socket buffer would.
+ */
+class MemoryPort : public SocketShim {
+  private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        ENetAddress from;
+        uint32 length;
+    };
+
+    MemoryNetwork& m_network;
+    ENetAddress m_address;
+    size_t m_mask;
+    size_t m_max_datagram;
+    std::unique_ptr<Slot[]> m_slots;
+    std::unique_ptr<uint8[]> m_data;
+    std::atomic<size_t> m_enqueue{0};
+    size_t m_dequeue = 0;
+    std::atomic<bool> m_open{true};
+    std::atomic<bool> m_sleeping{false};
+    std::atomic<bool> m_interrupted{false};
+    std::mutex m_wait_mutex;
+    std::condition_variable m_wait_cv;
+    // destinations already resolved, only used under the host lock
+    std::unordered_map<uint64_t, std::weak_ptr<MemoryPort>> m_routes;
+
+    bool ready() const {
+        const Slot& slot = m_slots[m_dequeue & m_mask];
+        return slot.sequence.load(std::memory_order_acquire) == m_dequeue + 1;
+    }
+
+    bool woken() const {
+        return ready() || m_interrupted.load(std::memory_order_relaxed);
+    }
+
+  public:
+    /**
+     * @brief Constructs a port; use `MemoryNetwork::attach()` instead.
+     */
+    MemoryPort(MemoryNetwork& network, const ENetAddress& address,
+               size_t slots, size_t max_datagram)
+        : m_network(network), m_address(address), m_mask(slots - 1),
+          m_max_datagram(max_datagram), m_slots(new Slot[slots]),
+          m_data(new uint8[slots * max_datagram]) {
+        for (size_t i = 0; i < slots; i++)
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the port's virtual address.
+     */
+    Address address() const { return Address(m_address.host, m_address.port); }
+
+    /**
+     * @brief Queues a datagram for this port; callable from any thread.
+     * @return `false` if the datagram was dropped.
+     */
+    bool push(const ENetAddress& from, const void* data, size_t length) {
+        if (length > m_max_datagram ||
+            !m_open.load(std::memory_order_acquire))
+            return false;
+        size_t position = m_enqueue.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &m_slots[position & m_mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence == position) {
+                if (m_enqueue.compare_exchange_weak(position, position + 1,
+                                                    std::memory_order_relaxed))
+                    break;
+            } else if (sequence < position) {
+                return false;
+            } else {
+                position = m_enqueue.load(std::memory_order_relaxed);
+            }
+        }
+        slot->from = from;
+        slot->length = (uint32)length;
+        memcpy(&m_data[(position & m_mask) * m_max_datagram], data, length);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        // pairs with the fence in wait() so a sleeping host is always woken
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(m_wait_mutex);
+            m_wait_cv.notify_one();
+        }
+        return true;
+    }
+
+    int send(ShimLink& below, const ENetAddress& address, const void* data,
+             size_t length) override;
+
+    int receive(ShimLink& below, ENetAddress& address, void* data,
+                size_t capacity) override {
+        (void)below;
+        if (!ready())
+            return 0;
+        Slot& slot = m_slots[m_dequeue & m_mask];
+        int length = slot.length;
+        address = slot.from;
+        if (slot.length > capacity)
+            length = -2;
+        else
+            memcpy(data, &m_data[(m_dequeue & m_mask) * m_max_datagram],
+                   slot.length);
+        slot.sequence.store(m_dequeue + m_mask + 1, std::memory_order_release);
+        m_dequeue++;
+        return length;
+    }
+
+    bool replaces_socket() const override { return true; }
+
+    int wait(enet_uint32* condition, enet_uint32 timeout) override {
+        if (!ready() && timeout > 0) {
+            std::unique_lock<std::mutex> lock(m_wait_mutex);
+            m_sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_wait_cv.wait_for(lock, std::chrono::milliseconds(timeout),
+                               [this] { return woken(); });
+            m_sleeping.store(false, std::memory_order_relaxed);
+        }
+        m_interrupted.store(false, std::memory_order_relaxed);
+        *condition = ready() ? ENET_SOCKET_WAIT_RECEIVE : ENET_SOCKET_WAIT_NONE;
+        return 0;
+    }
+
+    bool interrupt() override {
+        {
+            std::lock_guard<std::mutex> lock(m_wait_mutex);
+            m_interrupted.store(true, std::memory_order_relaxed);
+        }
+        m_wait_cv.notify_one();
+        return true;
+    }
+
+    void detach() override;
+};
+
+/**
+ * @brief An in-process switch that connects hosts without UDP sockets.
+ *
+ * Each attached host gets a virtual address, and its datagrams are copied
+ * straight into the receiving host's `MemoryPort` queue, so no system calls
+ * are made while the hosts run. Hosts should be created without an address
+ * (the client constructor) and connect to each other's virtual addresses.
+ * Any number of hosts may be attached, serviced from any threads.
+ *
+ * The network must outlive the hosts attached to it.
+ */
+class MemoryNetwork {
+  private:
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, std::weak_ptr<MemoryPort>> m_ports;
+    size_t m_slots;
+    size_t m_max_datagram;
+
+  public:
+    /** @brief Datagrams handed to a port. */
+    std::atomic<uint64_t> delivered{0};
+    /** @brief Datagrams dropped because the receiving queue was full. */
+    std::atomic<uint64_t> dropped{0};
+    /** @brief Datagrams sent to an address with no host attached. */
+    std::atomic<uint64_t> unroutable{0};
+
+    /**
+     * @brief Constructs a network.
+     * @param slots Datagrams each host can have queued, rounded up to a power
+     * of two.
+     * @param max_datagram Largest datagram carried; larger ones are dropped.
+     */
+    MemoryNetwork(size_t slots = 256,
+                  size_t max_datagram = ENET_PROTOCOL_MAXIMUM_MTU)
+        : m_slots(1), m_max_datagram(max_datagram) {
+        while (m_slots < slots)
+            m_slots <<= 1;
+    }
+
+    /**
+     * @brief Attaches a host at a virtual address.
+     *
+     * Attach before adding any other shims, since the port must be the lowest
+     * layer.
+     *
+     * @param host The host to attach.
+     * @param address The host's virtual address.
+     * @return The host's port.
+     * @throws std::runtime_error if the address is taken or shims are not
+     * linked in.
+     */
+    std::shared_ptr<MemoryPort> attach(Host& host, const Address& address) {
+        ENetAddress raw;
+        raw.host = address.host();
+        raw.port = address.port();
+        auto port =
+            std::make_shared<MemoryPort>(*this, raw, m_slots, m_max_datagram);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto& entry = m_ports[ShimProtocol::key(raw)];
+            if (!entry.expired())
+                throw std::runtime_error("Memory address already attached");
+            entry = port;
+        }
+        try {
+            host.add_shim(port);
+        } catch (...) {
+            remove(raw, port.get());
+            throw;
+        }
+        return port;
+    }
+
+    /**
+     * @brief Looks up the port at an address.
+     * @return The port, or NULL if no host is attached there.
+     */
+    std::shared_ptr<MemoryPort> find(const ENetAddress& address) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_ports.find(ShimProtocol::key(address));
+        return it == m_ports.end() ? NULL : it->second.lock();
+    }
+
+    /**
+     * @brief Frees an address if it still belongs to `port`; called when a
+     * port is detached.
+     */
+    void remove(const ENetAddress& address, const MemoryPort* port) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_ports.find(ShimProtocol::key(address));
+        if (it != m_ports.end() &&
+            (it->second.expired() || it->second.lock().get() == port))
+            m_ports.erase(it);
+    }
+};
+
+inline int MemoryPort::send(ShimLink& below, const ENetAddress& address,
+                            const void* data, size_t length) {
+    (void)below;
+    uint64_t route = ShimProtocol::key(address);
+    std::shared_ptr<MemoryPort> port;
+    auto it = m_routes.find(route);
+    if (it != m_routes.end())
+        port = it->second.lock();
+    if (!port || !port->m_open.load(std::memory_order_acquire)) {
+        port = m_network.find(address);
+        if (!port) {
+            m_routes.erase(route);
+            m_network.unroutable.fetch_add(1, std::memory_order_relaxed);
+            return (int)length;
+        }
+        m_routes[route] = port;
+    }
+    if (port->push(m_address, data, length))
+        m_network.delivered.fetch_add(1, std::memory_order_relaxed);
+    else
+        m_network.dropped.fetch_add(1, std::memory_order_relaxed);
+    // like UDP, a dropped datagram still counts as sent
+    return (int)length;
+}
+
+inline void MemoryPort::detach() {
+    m_open.store(false, std::memory_order_release);
+    m_network.remove(m_address, this);
+}
+
+/**
+ * @brief Runs hosts on a MemoryNetwork under one VirtualClock in fixed steps.
+ *
+ * Each `step()` services every host with `Host::service_batch()` and then
+ * advances the clock, so timeouts, retransmissions and throttling play out in
+ * simulated time as fast as the hosts can be serviced. Add an
+ * ImpairmentShim to a host after adding it here to simulate a lossy link.
+ *
+ * Hosts must be removed, or outlive the simulation.
+ */
+class Simulation {
+  private:
+    std::shared_ptr<VirtualClock> m_clock;
+    MemoryNetwork m_network;
+    std::vector<Host*> m_hosts;
+
+  public:
+    /**
+     * @brief Constructs a simulation starting at one second of virtual time.
+     * @param slots Datagrams each host can have queued.
+     */
+    Simulation(size_t slots = 256)
+        : m_clock(std::make_shared<VirtualClock>()), m_network(slots) {}
+
+    /**
+     * @brief Returns the simulation's clock.
+     */
+    VirtualClock& clock() { return *m_clock; }
+
+    /**
+     * @brief Returns the simulation's network.
+     */
+    MemoryNetwork& network() { return m_network; }
+
+    /**
+     * @brief Adds a host, created without an address, at a virtual address.
+     * @return The host's port.
+     * @throws std::runtime_error as `MemoryNetwork::attach()`.
+     */
+    std::shared_ptr<MemoryPort> add(Host& host, const Address& address) {
+        host.set_clock(m_clock);
+        auto port = m_network.attach(host, address);
+        m_hosts.push_back(&host);
+        return port;
+    }
+
+    /**
+     * @brief Stops servicing a host.
+     */
+    void remove(Host& host) {
+        m_hosts.erase(std::remove(m_hosts.begin(), m_hosts.end(), &host),
+                      m_hosts.end());
+    }
+
+    /**
+     * @brief Services every host once, then advances the clock.
+     * @param step The simulated time to advance.
+     * @return The number of events dispatched.
+     */
+    size_t step(std::chrono::microseconds step = std::chrono::milliseconds(1)) {
+        size_t events = 0;
+        for (Host* host : m_hosts)
+            events += std::max(host->service_batch(0), 0);
+        m_clock->advance(step);
+        return events;
+    }
+
+    /**
+     * @brief Steps until `duration` of simulated time has passed.
+     * @return The number of events dispatched.
+     */
+    size_t run_for(std::chrono::microseconds duration,
+                   std::chrono::microseconds step = std::chrono::milliseconds(
+                       1)) {
+        size_t events = 0;
+        uint64_t end = m_clock->microseconds() + duration.count();
+        while (m_clock->microseconds() < end)
+            events += this->step(step);
+        return events;
+    }
+};
+
+} // namespace enetcpp
+
+#ifdef ENETCPP_SHIM_IMPLEMENTATION
+
+// Defined by the linker for functions wrapped with --wrap.
+extern "C" int __real_enet_socket_send(ENetSocket, const ENetAddress*,
+                                       const ENetBuffer*, size_t);
+extern "C" int __real_enet_socket_receive(ENetSocket, ENetAddress*,
+                                          ENetBuffer*, size_t);
+extern "C" int __real_enet_socket_wait(ENetSocket, enet_uint32*, enet_uint32);
+extern "C" enet_uint32 __real_enet_time_get(void);
+
+namespace enetcpp {
+
+/**
+ * @brief Records ENet's own socket functions with SocketShims.
+ */
+static inline bool install_socket_shims() {
+    if (!SocketShims::installed())
+        SocketShims::install({__real_enet_socket_send,
+                              __real_enet_socket_receive,
+                              __real_enet_socket_wait});
+    return true;
+}
+
+// installs the functions before main() so Host::add_shim() sees them
+static const bool s_socket_shims_installed = install_socket_shims();
+
+} // namespace enetcpp
+
+extern "C" int __wrap_enet_socket_send(ENetSocket socket,
+                                       const ENetAddress* address,
+                                       const ENetBuffer* buffers,
+                                       size_t count) {
+    enetcpp::install_socket_shims();
+    return enetcpp::SocketShims::send(socket, address, buffers, count);
+}
+
+extern "C" int __wrap_enet_socket_receive(ENetSocket socket,
+                                          ENetAddress* address,
+                                          ENetBuffer* buffers, size_t count) {
+    enetcpp::install_socket_shims();
+    return enetcpp::SocketShims::receive(socket, address, buffers, count);
+}
+
+extern "C" int __wrap_enet_socket_wait(ENetSocket socket,
+                                       enet_uint32* condition,
+                                       enet_uint32 timeout) {
+    enetcpp::install_socket_shims();
+    return enetcpp::SocketShims::wait(socket, condition, timeout);
+}
+
+extern "C" enet_uint32 __wrap_enet_time_get(void) {
+    return enetcpp::SocketShims::time(__real_enet_time_get);
+}
+
+#endif // ENETCPP_SHIM_IMPLEMENTATION
+
+#endif // _ENETCPP_ENETCPP_SHIM_HPP_
@@ -44,11 +44,15 @@ For more information, please refer to <https://unlicense.org>
  *  - @ref enetcpp::Address: Represents a network address.
  *  - @ref enetcpp::Packet: Manages ENet packets for data transmission.
  *  - @ref enetcpp::Peer: Represents a network peer.
+ *  - @ref enetcpp::PeerStats: A snapshot of a peer's network statistics.
  *  - @ref enetcpp::Event: Handles network events, such as connection,
  *    disconnection, and data reception.
  *  - @ref enetcpp::Host: Manages the creation of client and server hosts.
- *  - @ref enetcpp::Logger: A simple logger class to provide tracing and
- *    debugging functionality.
+ *  - @ref enetcpp::HostMetrics: Lock-free counters describing a host.
+ *  - @ref enetcpp::LatencyHistogram: HDR-style histograms used to time the
+ *    service loop, event dispatch and connection thread queues.
+ *  - @ref enetcpp::Logger: A simple asynchronous logger class to provide
+ *    tracing and debugging functionality.
  *
  * @note This wrapper requires the ENet library to be installed and properly
  * linked. See `readme.md` for instructions, or just copy this file into your
@@ -60,14 +64,33 @@ For more information, please refer to <https://unlicense.org>
 #ifndef _ENETCPP_ENETCPP_HPP_
 #define _ENETCPP_ENETCPP_HPP_
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <deque>
 #include <enet/enet.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 namespace enetcpp {
 
 /** @brief Type alias for ENet 8-bit unsigned integer */
@@ -79,6 +102,401 @@ using uint16 = enet_uint16;
 /** @brief Type alias for ENet 32-bit unsigned integer */
 using uint32 = enet_uint32;
 
+/**
+ * @brief Compile-time log level threshold.
+ *
+ * Logger calls above this level (using the numeric values of
+ * `Logger::LogLevel`, so `0` is NONE and `4` is TRACE) are removed entirely by
+ * the compiler. Define it before including this header, e.g.
+ * `-DENETCPP_LOG_LEVEL=1` to keep only MINIMAL messages.
+ */
+#ifndef ENETCPP_LOG_LEVEL
+#define ENETCPP_LOG_LEVEL 4
+#endif
+
+/**
+ * @brief Size in bytes of each thread's log ring (must be a power of two).
+ */
+#ifndef ENETCPP_LOG_RING_SIZE
+#define ENETCPP_LOG_RING_SIZE (1U << 16)
+#endif
+
+/**
+ * @brief Set to `0` to compile out all `Tracer` spans.
+ *
+ * When enabled (the default) spans still cost only a relaxed load until
+ * `Tracer::enable()` is called.
+ */
+#ifndef ENETCPP_TRACE
+#define ENETCPP_TRACE 1
+#endif
+
+/**
+ * @brief One more than the highest socket descriptor that can have shims.
+ */
+#ifndef ENETCPP_SHIM_MAX_SOCKETS
+#define ENETCPP_SHIM_MAX_SOCKETS 65536
+#endif
+
+/**
+ * @brief Single-producer single-consumer ring of binary log records.
+ *
+ * Each logging thread owns one ring. Records are written by the owning thread
+ * and drained by the `LogBackend` thread, so neither side ever takes a lock.
+ * Records never wrap around the end of the buffer; a padding record is
+ * written instead.
+ */
+class LogRing {
+  public:
+    /**
+     * @brief Formats a record's encoded arguments into `out`.
+     */
+    using FormatFn = int (*)(char* out, size_t size, const char* fmt,
+                             const char* args);
+
+    /**
+     * @brief Header preceding every record in the ring.
+     */
+    struct Record {
+        uint32_t size;
+        uint32_t padding;
+        FormatFn format;
+        const char* fmt;
+        const char* tag;
+        time_t time;
+    };
+
+    static constexpr size_t capacity = ENETCPP_LOG_RING_SIZE;
+    static_assert((capacity & (capacity - 1)) == 0,
+                  "ENETCPP_LOG_RING_SIZE must be a power of two");
+
+    /**
+     * @brief Reserves space for a record and lets `writer` fill it in.
+     * @param length The number of bytes the record needs.
+     * @param writer Callable receiving a pointer to the reserved space.
+     * @return `false` (and counts a drop) if the ring is full.
+     */
+    template <typename Writer> bool push(size_t length, Writer&& writer) {
+        length = (length + 7) & ~size_t(7);
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t contiguous = capacity - (head & (capacity - 1));
+        size_t needed = length > contiguous ? contiguous + length : length;
+        if (length > capacity || capacity - (head - tail) < needed) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (length > contiguous) {
+            Record* pad = (Record*)(m_buffer.get() + (head & (capacity - 1)));
+            pad->size = (uint32_t)contiguous;
+            pad->padding = 1;
+            head += contiguous;
+        }
+        writer(m_buffer.get() + (head & (capacity - 1)));
+        m_head.store(head + length, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Consumes every record currently in the ring.
+     * @param reader Callable invoked with each non-padding record.
+     * @return The number of records consumed.
+     */
+    template <typename Reader> size_t drain(Reader&& reader) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t count = 0;
+        while (tail != head) {
+            const Record* record =
+                (const Record*)(m_buffer.get() + (tail & (capacity - 1)));
+            if (!record->padding) {
+                reader(*record);
+                count++;
+            }
+            tail += record->size;
+        }
+        m_tail.store(tail, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * @brief Returns and resets the number of records dropped because the
+     * ring was full.
+     */
+    size_t take_dropped() {
+        return m_dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Checks whether every record pushed so far has been drained.
+     */
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) ==
+               m_tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Marks the ring as no longer written to by its thread.
+     */
+    void retire() { m_retired.store(true, std::memory_order_release); }
+
+    /**
+     * @brief Checks whether the owning thread has exited.
+     */
+    bool retired() const { return m_retired.load(std::memory_order_acquire); }
+
+  private:
+    std::unique_ptr<char[]> m_buffer{new char[capacity]};
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    std::atomic<size_t> m_dropped{0};
+    std::atomic<bool> m_retired{false};
+};
+
+/**
+ * @brief Process-wide background thread that formats and prints log records.
+ *
+ * The backend owns every thread's `LogRing`, keeps a coarse wall clock that
+ * producers read instead of calling `time()`, and performs all `localtime`,
+ * `strftime` and stdio work off the logging threads. It is started by the
+ * first `Logger` and drains any outstanding records when the program exits.
+ * While every ring is empty the backend thread sleeps until a producer wakes
+ * it.
+ */
+class LogBackend {
+  public:
+    /**
+     * @brief Returns the backend, starting it on first use.
+     */
+    static LogBackend& instance() {
+        static LogBackend backend;
+        return backend;
+    }
+
+    /**
+     * @brief Checks whether the backend is accepting records.
+     *
+     * This is `false` before the backend is first used and after it has been
+     * destroyed during static destruction.
+     */
+    static bool running() { return s_running.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Returns the calling thread's ring, registering it if needed.
+     */
+    LogRing& thread_ring() {
+        thread_local ThreadRing ring(*this);
+        return *ring.ring;
+    }
+
+    /**
+     * @brief Returns the cached wall clock, updated by the backend thread.
+     */
+    time_t now() const { return m_now.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the time to stamp a new record with.
+     *
+     * The cached clock is stale while the backend thread sleeps, so the
+     * first record after an idle period reads the clock itself.
+     */
+    time_t stamp() {
+        if (!m_idle.load(std::memory_order_relaxed))
+            return now();
+        time_t current = time(NULL);
+        m_now.store(current, std::memory_order_relaxed);
+        return current;
+    }
+
+    /**
+     * @brief Wakes the backend thread if it is waiting for records.
+     *
+     * Must be called after every push.
+     */
+    void notify() {
+        // pairs with the fence in run(): either the backend sees the record
+        // or this thread sees the backend asleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_idle.load(std::memory_order_relaxed))
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_idle.store(false, std::memory_order_relaxed);
+        }
+        m_wake_cv.notify_one();
+    }
+
+    /**
+     * @brief Prints a record directly from the calling thread.
+     *
+     * Used when the backend is not running, e.g. by loggers that outlive it
+     * during static destruction.
+     */
+    static void write_now(const LogRing::Record& record) {
+        char time_buffer[80];
+        format_time(record.time, time_buffer, sizeof(time_buffer));
+        flockfile(stdout);
+        fprintf(stdout, "[%s] : ", time_buffer);
+        print(record);
+        funlockfile(stdout);
+        fflush(stdout);
+    }
+
+    /**
+     * @brief Formats and prints everything currently queued.
+     *
+     * Called periodically by the backend thread; may also be called from any
+     * thread to make sure earlier records have been written.
+     * @return The number of records printed.
+     */
+    size_t flush() {
+        std::lock_guard<std::mutex> lock(m_drain_mutex);
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            std::lock_guard<std::mutex> rings_lock(m_rings_mutex);
+            rings = m_rings;
+        }
+        size_t written = 0, dropped = 0;
+        for (auto& ring : rings) {
+            written += ring->drain([this](const LogRing::Record& record) {
+                write(record);
+            });
+            dropped += ring->take_dropped();
+        }
+        if (dropped > 0) {
+            print_time(now());
+            fprintf(stdout, "LOGGER: dropped %lu messages\n",
+                    (unsigned long)dropped);
+        }
+        fflush(stdout);
+        std::lock_guard<std::mutex> rings_lock(m_rings_mutex);
+        for (auto it = m_rings.begin(); it != m_rings.end();) {
+            // a retired ring may still hold records pushed after the drain
+            // above, so only drop it once a later pass has emptied it
+            if ((*it)->retired() && (*it)->drain([this](const auto& record) {
+                    write(record);
+                }) == 0) {
+                it = m_rings.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return written;
+    }
+
+  private:
+    struct ThreadRing {
+        std::shared_ptr<LogRing> ring;
+
+        ThreadRing(LogBackend& backend) : ring(std::make_shared<LogRing>()) {
+            std::lock_guard<std::mutex> lock(backend.m_rings_mutex);
+            backend.m_rings.push_back(ring);
+        }
+
+        ~ThreadRing() { ring->retire(); }
+    };
+
+    inline static std::atomic<bool> s_running{false};
+
+    std::mutex m_rings_mutex;
+    std::vector<std::shared_ptr<LogRing>> m_rings;
+    std::mutex m_drain_mutex;
+    std::atomic<time_t> m_now{time(NULL)};
+    time_t m_last_formatted = 0;
+    char m_time_buffer[80] = {0};
+    std::mutex m_wake_mutex;
+    std::condition_variable m_wake_cv;
+    std::atomic<bool> m_idle{false};
+    bool m_should_quit = false;
+    std::thread m_thread;
+
+    LogBackend() {
+        s_running.store(true, std::memory_order_release);
+        m_thread = std::thread(&LogBackend::run, this);
+    }
+
+    ~LogBackend() {
+        s_running.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_should_quit = true;
+        }
+        m_wake_cv.notify_one();
+        m_thread.join();
+        flush();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_wake_mutex);
+        while (!m_should_quit) {
+            m_now.store(time(NULL), std::memory_order_relaxed);
+            lock.unlock();
+            size_t written = flush();
+            lock.lock();
+            // keep draining while producers are busy
+            if (written > 0)
+                continue;
+            m_idle.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (pending()) {
+                m_idle.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            m_wake_cv.wait(lock, [this] {
+                return m_should_quit || !m_idle.load(std::memory_order_relaxed);
+            });
+        }
+    }
+
+    /**
+     * @brief Checks whether any ring holds records.
+     */
+    bool pending() {
+        std::lock_guard<std::mutex> lock(m_rings_mutex);
+        for (auto& ring : m_rings)
+            if (!ring->empty())
+                return true;
+        return false;
+    }
+
+    static void format_time(time_t rawtime, char* out, size_t size) {
+        struct tm timeinfo;
+        localtime_r(&rawtime, &timeinfo);
+        strftime(out, size, "%d-%m-%Y %H:%M:%S", &timeinfo);
+    }
+
+    /**
+     * @brief Prints a timestamp, reformatting it only when the second changes.
+     */
+    void print_time(time_t rawtime) {
+        if (rawtime != m_last_formatted) {
+            format_time(rawtime, m_time_buffer, sizeof(m_time_buffer));
+            m_last_formatted = rawtime;
+        }
+        fprintf(stdout, "[%s] : ", m_time_buffer);
+    }
+
+    void write(const LogRing::Record& record) {
+        print_time(record.time);
+        print(record);
+    }
+
+    static void print(const LogRing::Record& record) {
+        const char* args = (const char*)(&record + 1);
+        char buffer[1024];
+        int length = record.format(buffer, sizeof(buffer), record.fmt, args);
+        fprintf(stdout, "%s: ", record.tag);
+        if (length >= (int)sizeof(buffer)) {
+            std::string large(length + 1, '\0');
+            record.format(&large[0], large.size(), record.fmt, args);
+            fputs(large.c_str(), stdout);
+        } else if (length > 0) {
+            fwrite(buffer, 1, length, stdout);
+        }
+        fputc('\n', stdout);
+    }
+};
+
 /**
  * @brief A simple logger class for logging and tracing within the ENetCPP
  * wrapper.
@@ -87,6 +505,12 @@ using uint32 = enet_uint32;
  * DEBUG, INFO, MINIMAL). It provides methods for logging messages with
  * timestamps to help trace ENet operations.
  *
+ * Logging is asynchronous: the calling thread only copies the format string
+ * pointer and the binary arguments into its own lock-free `LogRing`, and the
+ * `LogBackend` thread does the formatting and printing. Format strings must
+ * therefore outlive the call (string literals do); `const char*` arguments
+ * are copied. Levels above `ENETCPP_LOG_LEVEL` are compiled out.
+ *
  * Logging levels:
  *  - TRACE: Logs detailed debug information.
  *  - DEBUG: Logs general debug information.
@@ -100,9 +524,15 @@ class Logger {
 
     /**
      * @brief Constructs a Logger with the given log level.
+     *
+     * Starts the `LogBackend` unless logging is compiled out, so that the
+     * backend outlives any static Logger.
      * @param loglevel The log level to use (defaults to INFO).
      */
-    Logger(LogLevel loglevel = INFO) : m_loglevel(loglevel) {}
+    Logger(LogLevel loglevel = INFO) : m_loglevel(loglevel) {
+        if constexpr (ENETCPP_LOG_LEVEL > NONE)
+            LogBackend::instance();
+    }
 
     /**
      * @brief Sets the log level for the logger.
@@ -116,7 +546,7 @@ class Logger {
      * @param args Arguments for the format string.
      */
     template <typename... Args> void trace(const char* fmt, Args... args) {
-        log(TRACE, "TRACE", fmt, args...);
+        log<TRACE>("TRACE", fmt, args...);
     }
 
     /**
@@ -125,7 +555,7 @@ class Logger {
      * @param args Arguments for the format string.
      */
     template <typename... Args> void debug(const char* fmt, Args... args) {
-        log(DEBUG, "DEBUG", fmt, args...);
+        log<DEBUG>("DEBUG", fmt, args...);
     }
 
     /**
@@ -134,7 +564,7 @@ class Logger {
      * @param args Arguments for the format string.
      */
     template <typename... Args> void info(const char* fmt, Args... args) {
-        log(INFO, "INFO", fmt, args...);
+        log<INFO>("INFO", fmt, args...);
     }
 
     /**
@@ -143,33 +573,117 @@ class Logger {
      * @param args Arguments for the format string.
      */
     template <typename... Args> void minimal(const char* fmt, Args... args) {
-        log(MINIMAL, "MINIMAL", fmt, args...);
+        log<MINIMAL>("MINIMAL", fmt, args...);
+    }
+
+    /**
+     * @brief Blocks until every message logged so far has been printed.
+     */
+    static void flush() {
+        if (LogBackend::running())
+            LogBackend::instance().flush();
     }
 
   private:
     LogLevel m_loglevel;
 
-    /**
-     * @brief Prints the current timestamp to the log.
-     */
-    void print_time() {
-        time_t rawtime;
-        struct tm* timeinfo;
-        char buffer[80];
-        time(&rawtime);
-        timeinfo = localtime(&rawtime);
-        strftime(buffer, sizeof(buffer), "%d-%m-%Y %H:%M:%S", timeinfo);
-        printf("[%s] : ", buffer);
+    template <typename T> struct Decoded {
+        using type = T;
+    };
+
+    template <typename T> struct Decoded<T*> {
+        using type = typename std::conditional<
+            std::is_same<typename std::remove_cv<T>::type, char>::value,
+            const char*, T*>::type;
+    };
+
+    template <typename T>
+    static constexpr bool is_string =
+        std::is_same<typename Decoded<T>::type, const char*>::value;
+
+    template <typename T> static size_t encoded_size(const T& arg) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "log arguments must be trivially copyable or C strings");
+        if constexpr (is_string<T>) {
+            return sizeof(uint32_t) + strlen(arg ? arg : "(null)") + 1;
+        } else {
+            return sizeof(T);
+        }
+    }
+
+    template <typename T> static char* encode(char* out, const T& arg) {
+        if constexpr (is_string<T>) {
+            const char* str = arg ? arg : "(null)";
+            uint32_t length = (uint32_t)strlen(str) + 1;
+            memcpy(out, &length, sizeof(length));
+            memcpy(out + sizeof(length), str, length);
+            return out + sizeof(length) + length;
+        } else {
+            memcpy(out, &arg, sizeof(T));
+            return out + sizeof(T);
+        }
+    }
+
+    template <typename T>
+    static typename Decoded<T>::type decode(const char*& in) {
+        if constexpr (is_string<T>) {
+            uint32_t length;
+            memcpy(&length, in, sizeof(length));
+            const char* str = in + sizeof(length);
+            in += sizeof(length) + length;
+            return str;
+        } else {
+            T value;
+            memcpy(&value, in, sizeof(T));
+            in += sizeof(T);
+            return value;
+        }
     }
 
     template <typename... Args>
-    void log(LogLevel level, const char* tag, const char* fmt, Args... args) {
-        if (m_loglevel < level)
-            return;
-        print_time();
-        printf("%s: ", tag);
-        printf(fmt, args...);
-        printf("\n");
+    static int format(char* out, size_t size, const char* fmt,
+                      const char* args) {
+        (void)args;
+        // braced initialisation guarantees left-to-right decoding
+        std::tuple<typename Decoded<Args>::type...> values{
+            decode<Args>(args)...};
+        return std::apply(
+            [&](auto... decoded) { return snprintf(out, size, fmt, decoded...); },
+            values);
+    }
+
+    template <LogLevel level, typename... Args>
+    void log(const char* tag, const char* fmt, Args... args) {
+        if constexpr (level <= ENETCPP_LOG_LEVEL) {
+            if (m_loglevel < level)
+                return;
+            size_t length = sizeof(LogRing::Record);
+            ((length += encoded_size(args)), ...);
+            auto fill = [&](char* out, time_t time) {
+                LogRing::Record* record = (LogRing::Record*)out;
+                record->size = (uint32_t)((length + 7) & ~size_t(7));
+                record->padding = 0;
+                record->format = &Logger::format<Args...>;
+                record->fmt = fmt;
+                record->tag = tag;
+                record->time = time;
+                char* cursor = (char*)(record + 1);
+                ((cursor = encode(cursor, args)), ...);
+                (void)cursor;
+            };
+            if (!LogBackend::running()) {
+                // the backend has been destroyed, so print synchronously
+                std::unique_ptr<char[]> record(new char[length]);
+                fill(record.get(), time(NULL));
+                LogBackend::write_now(*(LogRing::Record*)record.get());
+                return;
+            }
+            LogBackend& backend = LogBackend::instance();
+            backend.thread_ring().push(length, [&](char* out) {
+                fill(out, backend.stamp());
+            });
+            backend.notify();
+        }
     }
 };
 
@@ -328,6 +842,75 @@ class Packet {
     ENetPacket* get() { return m_packet; }
 };
 
+/**
+ * @brief Snapshot of the network statistics ENet tracks for a peer.
+ *
+ * Values are copied out of the `ENetPeer` at the time of the snapshot. Times
+ * are in milliseconds; loss and throttle are scaled to the range [0, 1].
+ */
+struct PeerStats {
+    /** @brief The peer's address. */
+    Address address;
+    /** @brief The peer's slot index within its host. */
+    uint16 id = 0;
+    /** @brief The ENet connection state. */
+    ENetPeerState state = ENET_PEER_STATE_DISCONNECTED;
+    /** @brief Smoothed round trip time. */
+    uint32 round_trip_time = 0;
+    /** @brief Mean deviation of the round trip time. */
+    uint32 round_trip_time_variance = 0;
+    /** @brief Lowest round trip time seen in the current throttle interval. */
+    uint32 lowest_round_trip_time = 0;
+    /** @brief Smoothed fraction of reliable packets lost. */
+    double packet_loss = 0;
+    /** @brief Mean deviation of the packet loss. */
+    double packet_loss_variance = 0;
+    /** @brief Fraction of unreliable packets ENet currently lets through. */
+    double packet_throttle = 0;
+    /** @brief Bytes of reliable data sent but not yet acknowledged. */
+    uint32 reliable_data_in_transit = 0;
+    /** @brief Number of commands queued but not yet sent. */
+    size_t outgoing_commands = 0;
+    /** @brief Reliable window size in bytes negotiated with the peer. */
+    uint32 window_size = 0;
+    /** @brief Largest datagram sent to the peer, in bytes; see
+     * `PathMtuDiscovery`. */
+    uint32 mtu = 0;
+    /** @brief Incoming bandwidth the peer declared, 0 if unlimited. */
+    uint32 incoming_bandwidth = 0;
+    /** @brief Outgoing bandwidth the peer declared, 0 if unlimited. */
+    uint32 outgoing_bandwidth = 0;
+
+    PeerStats() {}
+
+    /**
+     * @brief Copies the statistics out of an ENetPeer.
+     * @param peer The peer to snapshot.
+     */
+    PeerStats(const ENetPeer* peer)
+        : address(peer->address.host, peer->address.port),
+          id(peer->incomingPeerID), state(peer->state),
+          round_trip_time(peer->roundTripTime),
+          round_trip_time_variance(peer->roundTripTimeVariance),
+          lowest_round_trip_time(peer->lowestRoundTripTime),
+          packet_loss((double)peer->packetLoss / ENET_PEER_PACKET_LOSS_SCALE),
+          packet_loss_variance((double)peer->packetLossVariance /
+                               ENET_PEER_PACKET_LOSS_SCALE),
+          packet_throttle((double)peer->packetThrottle /
+                          ENET_PEER_PACKET_THROTTLE_SCALE),
+          reliable_data_in_transit(peer->reliableDataInTransit),
+          window_size(peer->windowSize), mtu(peer->mtu),
+          incoming_bandwidth(peer->incomingBandwidth),
+          outgoing_bandwidth(peer->outgoingBandwidth) {
+        ENetPeer* mutable_peer = const_cast<ENetPeer*>(peer);
+        outgoing_commands = enet_list_size(&mutable_peer->outgoingCommands);
+#if ENET_VERSION >= ENET_VERSION_CREATE(1, 3, 18)
+        outgoing_commands +=
+            enet_list_size(&mutable_peer->outgoingSendReliableCommands);
+#endif
+    }
+};
+
 /**
  * @brief Wrapper class for ENetPeer.
  *
@@ -358,15 +941,33 @@ class Peer {
     /**
      * @brief Sends a packet to the peer.
      * @param packet Reference to the Packet to send.
+     * @param channel The channel to send on.
      * @throws std::runtime_error if the packet send fails.
      */
-    void send(Packet& packet) {
-        if (enet_peer_send(m_peer, 0, packet.get()) == 0) {
+    void send(Packet& packet, uint8 channel = 0) {
+        if (enet_peer_send(m_peer, channel, packet.get()) == 0) {
             packet.release_ownership();
             return;
         }
         throw std::runtime_error("Packet send failed");
     }
+
+    /**
+     * @brief Takes a snapshot of the peer's network statistics.
+     *
+     * This reads the ENetPeer without locking the host, so only call it from
+     * the thread servicing the host. From other threads use
+     * `Host::peer_stats()`.
+     *
+     * @return The peer's current statistics.
+     */
+    PeerStats stats() const { return PeerStats(m_peer); }
+
+    /**
+     * @brief Returns the underlying ENetPeer pointer.
+     * @return A pointer to the ENetPeer.
+     */
+    ENetPeer* get() { return m_peer; }
 };
 
 /**
@@ -420,6 +1021,17 @@ class Event {
      */
     uint8 channel() const { return m_event.channelID; }
 
+    /**
+     * @brief Retrieves the data word of a connection or disconnection.
+     *
+     * For connections this is the `data` the connection was initiated with,
+     * on both ends; for disconnections the `data` the remote end passed when
+     * disconnecting.
+     *
+     * @return The data word.
+     */
+    uint32 data() const { return m_event.data; }
+
     /**
      * @brief Retrieves the peer associated with the event.
      * @return A reference to the Peer object.
@@ -473,123 +1085,2328 @@ class EventReceive : public Event {
 };
 
 /**
- * @brief Wrapper class for ENetHost.
+ * @brief Counts the allocations ENet makes through its memory callbacks.
  *
- * Manages the creation of ENet hosts, both for servers and clients.
+ * Counting is enabled by passing `true` to `initialize()`, which installs
+ * `malloc` and `free` wrappers with `enet_initialize_with_callbacks`.
  */
-class Host {
-  private:
-    Address m_address;
-    ENetHost* m_host;
-    bool m_is_server;
-    Logger m_logger;
-
+class AllocationTracker {
+  public:
     /**
-     * @brief Dispatches an event to the appropriate handler.
-     * @tparam EventType The type of event to handle.
-     * @param event_ The ENetEvent to dispatch.
+     * @brief Number of allocations made by ENet so far.
      */
-    template <class EventType> void dispatch(ENetEvent event_) {
-        EventType event(event_);
-        this->on_event(event);
+    static uint64_t allocations() {
+        return s_allocations.load(std::memory_order_relaxed);
     }
 
-  protected:
-    std::mutex m_mutex;
+    /**
+     * @brief Number of frees made by ENet so far.
+     */
+    static uint64_t frees() { return s_frees.load(std::memory_order_relaxed); }
 
-  public:
-    Logger& logger() { return m_logger; }
+    /**
+     * @brief Total number of bytes ENet has requested so far.
+     */
+    static uint64_t bytes() { return s_bytes.load(std::memory_order_relaxed); }
 
     /**
-     * @brief Constructs a server Host with the specified address and
-     * configuration.
-     * @param address The server address.
-     * @param peer_count The maximum number of peers.
-     * @param channel_limit The maximum number of channels.
-     * @param incoming_bandwidth The incoming bandwidth limit.
-     * @param outgoing_bandwidth The outgoing bandwidth limit.
-     * @throws std::runtime_error if the host creation fails.
+     * @brief Checks whether allocation counting was enabled.
      */
-    Host(Address address, size_t peer_count, size_t channel_limit = 1U,
-         uint32 incoming_bandwith = 0U, uint32 outgoing_bandwidth = 0U,
-         Logger logger = Logger())
-        : m_address(address), m_is_server(true), m_logger(logger) {
-        m_logger.trace("creating ENet server host");
-        m_host = enet_host_create(m_address.get(), peer_count, channel_limit,
-                                  incoming_bandwith, outgoing_bandwidth);
-        if (m_host == NULL) {
-            throw std::runtime_error("Failed to create an ENet server host");
-        }
-    }
+    static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
 
     /**
-     * @brief Constructs a client Host with the specified configuration.
-     * @param peer_count The maximum number of peers.
-     * @param channel_limit The maximum number of channels.
-     * @param incoming_bandwidth The incoming bandwidth limit.
-     * @param outgoing_bandwidth The outgoing bandwidth limit.
-     * @throws std::runtime_error if the host creation fails.
+     * @brief Returns the callbacks that count allocations.
      */
-    Host(size_t peer_count, size_t channel_limit = 1U,
-         uint32 incoming_bandwith = 0U, uint32 outgoing_bandwidth = 0U,
-         Logger logger = Logger())
-        : m_is_server(false), m_logger(logger) {
-        m_logger.trace("creating ENet client host");
-        m_host = enet_host_create(NULL, peer_count, channel_limit,
-                                  incoming_bandwith, outgoing_bandwidth);
-        if (m_host == NULL) {
-            throw std::runtime_error("Failed to create an ENet client host");
-        }
+    static ENetCallbacks callbacks() {
+        ENetCallbacks callbacks = {&AllocationTracker::allocate,
+                                   &AllocationTracker::release, NULL};
+        return callbacks;
     }
 
     /**
-     * @brief Destructor for Host.
-     *
-     * FLushes the host and then destroys the underlying ENetHost object.
+     * @brief Marks allocation counting as enabled.
      */
-    ~Host() {
-        m_logger.trace("destroying ENet host");
-        flush();
-        enet_host_destroy(m_host);
+    static void enable() { s_enabled.store(true, std::memory_order_relaxed); }
+
+  private:
+    inline static std::atomic<uint64_t> s_allocations{0};
+    inline static std::atomic<uint64_t> s_frees{0};
+    inline static std::atomic<uint64_t> s_bytes{0};
+    inline static std::atomic<bool> s_enabled{false};
+
+    static void* ENET_CALLBACK allocate(size_t size) {
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+        s_bytes.fetch_add(size, std::memory_order_relaxed);
+        return malloc(size);
+    }
+
+    static void ENET_CALLBACK release(void* memory) {
+        if (memory != NULL)
+            s_frees.fetch_add(1, std::memory_order_relaxed);
+        free(memory);
     }
+};
+
+/**
+ * @brief Immutable, mergeable copy of a LatencyHistogram.
+ *
+ * Values are in nanoseconds. Percentiles are reported as the upper edge of
+ * the bucket they fall in, so they are accurate to within
+ * `1 / LatencyHistogram::sub_buckets`.
+ */
+class HistogramSnapshot {
+  private:
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_min = UINT64_MAX;
+    uint64_t m_max = 0;
 
+    friend class LatencyHistogram;
+
+  public:
     /**
-     * @brief Services the host to check for network events.
-     * @param timeout The maximum time to wait for an event, in milliseconds -
-     * locks the mutex for `timeout` seconds.
-     * @return The result of the ENet service call.
+     * @brief Adds another snapshot's samples to this one.
+     * @param other The snapshot to merge.
+     */
+    void merge(const HistogramSnapshot& other) {
+        if (m_counts.size() < other.m_counts.size())
+            m_counts.resize(other.m_counts.size(), 0);
+        for (size_t i = 0; i < other.m_counts.size(); i++)
+            m_counts[i] += other.m_counts[i];
+        m_count += other.m_count;
+        m_sum += other.m_sum;
+        m_min = std::min(m_min, other.m_min);
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    /**
+     * @brief Number of recorded samples.
+     */
+    uint64_t count() const { return m_count; }
+
+    /**
+     * @brief Sum of all recorded samples.
+     */
+    uint64_t sum() const { return m_sum; }
+
+    /**
+     * @brief Smallest recorded sample, 0 if empty.
+     */
+    uint64_t min() const { return m_count ? m_min : 0; }
+
+    /**
+     * @brief Largest recorded sample.
+     */
+    uint64_t max() const { return m_max; }
+
+    /**
+     * @brief Mean of the recorded samples, 0 if empty.
+     */
+    double mean() const { return m_count ? (double)m_sum / m_count : 0; }
+
+    /**
+     * @brief Returns the value below which a fraction of samples fall.
+     * @param quantile The fraction, between 0 and 1 (e.g. 0.99).
+     * @return The value in nanoseconds, 0 if empty.
+     */
+    uint64_t percentile(double quantile) const;
+
+    /** @brief The median. */
+    uint64_t p50() const { return percentile(0.5); }
+
+    /** @brief The 99th percentile. */
+    uint64_t p99() const { return percentile(0.99); }
+
+    /** @brief The 99.9th percentile. */
+    uint64_t p999() const { return percentile(0.999); }
+};
+
+/**
+ * @brief Low-overhead HDR-style latency histogram.
+ *
+ * Buckets are log-linear: each power of two is split into `sub_buckets`
+ * linear buckets, giving a constant relative precision from 1ns up to 2^41ns
+ * (about 36.6 minutes) in a fixed ~18KB array. Recording is a couple of
+ * shifts and a relaxed atomic increment, so it is safe from any thread, but
+ * each recording thread should own its own histogram to avoid sharing cache
+ * lines; use `snapshot()` and `HistogramSnapshot::merge()` to combine them.
+ */
+class LatencyHistogram {
+  public:
+    /** @brief log2 of the number of linear buckets per power of two. */
+    static constexpr unsigned sub_bucket_bits = 6;
+    /** @brief Number of linear buckets per power of two. */
+    static constexpr uint64_t sub_buckets = 1ULL << sub_bucket_bits;
+    /** @brief Largest power of two that is tracked; larger values clamp. */
+    static constexpr unsigned max_exponent = 40;
+    /** @brief Total number of buckets. */
+    static constexpr size_t bucket_count =
+        (max_exponent - sub_bucket_bits + 2) * sub_buckets;
+
+    /**
+     * @brief Returns the bucket a value falls in.
+     */
+    static size_t bucket(uint64_t value) {
+        if (value >= (2ULL << max_exponent))
+            value = (2ULL << max_exponent) - 1;
+        if (value < sub_buckets)
+            return (size_t)value;
+#if defined(__GNUC__) || defined(__clang__)
+        unsigned msb = 63 - __builtin_clzll(value);
+#else
+        unsigned msb = 0;
+        for (uint64_t rest = value >> 1; rest; rest >>= 1)
+            msb++;
+#endif
+        unsigned shift = msb - sub_bucket_bits;
+        return (size_t)((shift + 1) * sub_buckets +
+                        ((value >> shift) - sub_buckets));
+    }
+
+    /**
+     * @brief Returns the largest value that falls in a bucket.
+     */
+    static uint64_t bucket_upper(size_t index) {
+        if (index < sub_buckets)
+            return index;
+        uint64_t shift = index / sub_buckets - 1;
+        uint64_t sub = index % sub_buckets + sub_buckets;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    /**
+     * @brief Records a sample.
+     * @param nanoseconds The latency to record.
+     */
+    void record(uint64_t nanoseconds) {
+        m_counts[bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (nanoseconds > max &&
+               !m_max.compare_exchange_weak(max, nanoseconds,
+                                            std::memory_order_relaxed)) {
+        }
+        uint64_t min = m_min.load(std::memory_order_relaxed);
+        while (nanoseconds < min &&
+               !m_min.compare_exchange_weak(min, nanoseconds,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * @brief Records the time elapsed since `start`.
+     * @param start A time point from `std::chrono::steady_clock`.
+     */
+    void record_since(std::chrono::steady_clock::time_point start) {
+        record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count());
+    }
+
+    /**
+     * @brief Copies the histogram without stopping writers.
+     *
+     * Samples recorded concurrently may or may not be included.
+     *
+     * @return The snapshot.
+     */
+    HistogramSnapshot snapshot() const {
+        HistogramSnapshot out;
+        out.m_counts.resize(bucket_count);
+        for (size_t i = 0; i < bucket_count; i++) {
+            out.m_counts[i] = m_counts[i].load(std::memory_order_relaxed);
+            out.m_count += out.m_counts[i];
+        }
+        out.m_sum = m_sum.load(std::memory_order_relaxed);
+        out.m_min = m_min.load(std::memory_order_relaxed);
+        out.m_max = m_max.load(std::memory_order_relaxed);
+        return out;
+    }
+
+  private:
+    std::atomic<uint64_t> m_counts[bucket_count] = {};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_min{UINT64_MAX};
+    std::atomic<uint64_t> m_max{0};
+};
+
+inline uint64_t HistogramSnapshot::percentile(double quantile) const {
+    if (m_count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(quantile * m_count + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, m_count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < m_counts.size(); i++) {
+        seen += m_counts[i];
+        if (seen >= rank)
+            return std::min(LatencyHistogram::bucket_upper(i), m_max);
+    }
+    return m_max;
+}
+
+/**
+ * @brief The stages of packet handling that are timed.
+ */
+enum class LatencyStage {
+    /** @brief Time spent inside `enet_host_service`. */
+    SERVICE,
+    /** @brief Time spent in the host's `on_event` handlers. */
+    DISPATCH,
+    /** @brief Time a packet waits in a `ConnectionThread` queue. */
+    QUEUE_WAIT,
+    /** @brief Time spent in `ConnectionThread::handle`. */
+    HANDLE,
+    COUNT
+};
+
+/**
+ * @brief Returns the lower-case name of a latency stage.
+ */
+inline const char* latency_stage_name(LatencyStage stage) {
+    switch (stage) {
+    case LatencyStage::SERVICE:
+        return "service";
+    case LatencyStage::DISPATCH:
+        return "dispatch";
+    case LatencyStage::QUEUE_WAIT:
+        return "queue_wait";
+    case LatencyStage::HANDLE:
+        return "handle";
+    default:
+        return "unknown";
+    }
+}
+
+/**
+ * @brief One LatencyHistogram per stage, owned by a single thread.
+ */
+class StageHistograms {
+  private:
+    LatencyHistogram m_histograms[(size_t)LatencyStage::COUNT];
+
+  public:
+    /**
+     * @brief Returns the histogram for a stage.
+     */
+    LatencyHistogram& operator[](LatencyStage stage) {
+        return m_histograms[(size_t)stage];
+    }
+
+    /**
+     * @brief Returns the histogram for a stage (const version).
+     */
+    const LatencyHistogram& operator[](LatencyStage stage) const {
+        return m_histograms[(size_t)stage];
+    }
+};
+
+/**
+ * @brief Live counters describing a Host.
+ *
+ * Every field is an atomic that the servicing threads update with relaxed
+ * operations, so readers such as `MetricsRegistry` never have to take the
+ * host lock. The ENet traffic totals are 32-bit and wrap, so they are folded
+ * into 64-bit counters after each `service()` and `flush()`.
+ */
+class HostMetrics {
+  public:
+    /** @brief Bytes sent, from `ENetHost::totalSentData`. */
+    std::atomic<uint64_t> sent_bytes{0};
+    /** @brief Datagrams sent, from `ENetHost::totalSentPackets`. */
+    std::atomic<uint64_t> sent_packets{0};
+    /** @brief Bytes received, from `ENetHost::totalReceivedData`. */
+    std::atomic<uint64_t> received_bytes{0};
+    /** @brief Datagrams received, from `ENetHost::totalReceivedPackets`. */
+    std::atomic<uint64_t> received_packets{0};
+    /** @brief Number of peers currently connected. */
+    std::atomic<uint64_t> connected_peers{0};
+    /** @brief Number of calls to `Host::service()`. */
+    std::atomic<uint64_t> service_calls{0};
+    /** @brief Number of connect events dispatched. */
+    std::atomic<uint64_t> connect_events{0};
+    /** @brief Number of disconnect events dispatched. */
+    std::atomic<uint64_t> disconnect_events{0};
+    /** @brief Number of receive events dispatched. */
+    std::atomic<uint64_t> receive_events{0};
+    /** @brief Total time spent in `on_event` handlers, in nanoseconds. */
+    std::atomic<uint64_t> dispatch_nanoseconds{0};
+    /** @brief Longest single `on_event` handler call, in nanoseconds. */
+    std::atomic<uint64_t> dispatch_max_nanoseconds{0};
+    /** @brief Packets queued on connection threads but not yet handled. */
+    std::atomic<int64_t> queued_packets{0};
+    /** @brief Number of running connection threads. */
+    std::atomic<int64_t> connection_threads{0};
+    /** @brief Datagrams sent compressed by the host's `Compressor`. */
+    std::atomic<uint64_t> compressed_datagrams{0};
+    /** @brief Datagrams sent uncompressed: too small or incompressible. */
+    std::atomic<uint64_t> uncompressed_datagrams{0};
+    /** @brief Size of the compressed datagrams before compression. */
+    std::atomic<uint64_t> compress_input_bytes{0};
+    /** @brief Size of the compressed datagrams after compression. */
+    std::atomic<uint64_t> compress_output_bytes{0};
+    /** @brief Time spent compressing, in nanoseconds. */
+    std::atomic<uint64_t> compress_nanoseconds{0};
+    /** @brief Datagrams decompressed. */
+    std::atomic<uint64_t> decompressed_datagrams{0};
+    /** @brief Compressed datagrams that failed to decompress. */
+    std::atomic<uint64_t> decompress_failures{0};
+    /** @brief Time spent decompressing, in nanoseconds. */
+    std::atomic<uint64_t> decompress_nanoseconds{0};
+
+    /**
+     * @brief Returns the compressed size over the original size of the
+     * datagrams sent compressed, or `1` if none were.
+     */
+    double compression_ratio() const {
+        uint64_t input = compress_input_bytes.load(std::memory_order_relaxed);
+        if (input == 0)
+            return 1.0;
+        return (double)compress_output_bytes.load(std::memory_order_relaxed) /
+               input;
+    }
+
+    /**
+     * @brief Folds the ENet traffic totals into the 64-bit counters.
+     *
+     * Must be called with the host lock held.
+     *
+     * @param host The host to read.
+     */
+    void update(const ENetHost* host) {
+        fold(sent_bytes, m_last_sent_bytes, host->totalSentData);
+        fold(sent_packets, m_last_sent_packets, host->totalSentPackets);
+        fold(received_bytes, m_last_received_bytes, host->totalReceivedData);
+        fold(received_packets, m_last_received_packets,
+             host->totalReceivedPackets);
+        connected_peers.store(host->connectedPeers, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Records the duration of one `on_event` call.
+     * @param nanoseconds The time the handler took.
+     */
+    void record_dispatch(uint64_t nanoseconds) {
+        dispatch_nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        uint64_t max = dispatch_max_nanoseconds.load(std::memory_order_relaxed);
+        while (nanoseconds > max &&
+               !dispatch_max_nanoseconds.compare_exchange_weak(
+                   max, nanoseconds, std::memory_order_relaxed)) {
+        }
+    }
+
+  private:
+    uint32 m_last_sent_bytes = 0;
+    uint32 m_last_sent_packets = 0;
+    uint32 m_last_received_bytes = 0;
+    uint32 m_last_received_packets = 0;
+
+    static void fold(std::atomic<uint64_t>& total, uint32& last,
+                     uint32 current) {
+        // unsigned subtraction handles the 32-bit counter wrapping
+        total.fetch_add((uint32)(current - last), std::memory_order_relaxed);
+        last = current;
+    }
+};
+
+/**
+ * @brief Append-only buffer of completed trace spans, owned by one thread.
+ *
+ * Spans are written into fixed-size chunks by the owning thread only. Each
+ * chunk's count is published with release semantics after the span is
+ * written, so `Tracer` can read the buffer while the owner keeps appending.
+ * Chunks are only freed by `clear()` and the destructor.
+ */
+class TraceBuffer {
+  public:
+    /**
+     * @brief A completed span, with times from `Tracer::now()`.
+     */
+    struct Span {
+        const char* name;
+        uint64_t start;
+        uint64_t duration;
+    };
+
+    /** @brief Number of spans allocated at a time. */
+    static constexpr size_t CHUNK_SIZE = 1024;
+
+    /** @brief Spans kept per thread before new ones are dropped. */
+    static constexpr size_t MAX_SPANS = 256 * CHUNK_SIZE;
+
+    TraceBuffer(uint32 id) : m_id(id) {}
+
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+    ~TraceBuffer() { free_chunks(m_head.load(std::memory_order_relaxed)); }
+
+    /**
+     * @brief Appends a span; must only be called by the owning thread.
+     * @param name A string that outlives the tracer (normally a literal).
+     * @param start The start time in nanoseconds.
+     * @param end The end time in nanoseconds.
+     */
+    void push(const char* name, uint64_t start, uint64_t end) {
+        if (m_tail == NULL || m_tail->count.load(std::memory_order_relaxed) ==
+                                  CHUNK_SIZE) {
+            if (m_chunks * CHUNK_SIZE >= MAX_SPANS) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            Chunk* chunk = new Chunk;
+            if (m_tail == NULL)
+                m_head.store(chunk, std::memory_order_release);
+            else
+                m_tail->next.store(chunk, std::memory_order_release);
+            m_tail = chunk;
+            m_chunks++;
+        }
+        size_t count = m_tail->count.load(std::memory_order_relaxed);
+        m_tail->spans[count] = {name, start, end - start};
+        m_tail->count.store(count + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Calls `f` on every span published so far.
+     *
+     * Safe to call while the owning thread is appending.
+     */
+    template <typename F> void for_each(F f) const {
+        const Chunk* chunk = m_head.load(std::memory_order_acquire);
+        while (chunk != NULL) {
+            size_t count = chunk->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++)
+                f(chunk->spans[i]);
+            chunk = chunk->next.load(std::memory_order_acquire);
+        }
+    }
+
+    /**
+     * @brief Discards all spans.
+     *
+     * Not safe while the owning thread may be appending.
+     */
+    void clear() {
+        free_chunks(m_head.exchange(NULL, std::memory_order_acq_rel));
+        m_tail = NULL;
+        m_chunks = 0;
+        m_dropped.store(0, std::memory_order_relaxed);
+    }
+
+    /** @brief The thread id used in the trace. */
+    uint32 id() const { return m_id; }
+
+    /** @brief Number of spans dropped because the buffer was full. */
+    uint64_t dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    /** @brief The thread name shown in the trace (guarded by the Tracer). */
+    std::string name;
+
+  private:
+    struct Chunk {
+        Span spans[CHUNK_SIZE];
+        std::atomic<size_t> count{0};
+        std::atomic<Chunk*> next{NULL};
+    };
+
+    uint32 m_id;
+    std::atomic<Chunk*> m_head{NULL};
+    Chunk* m_tail = NULL;
+    size_t m_chunks = 0;
+    std::atomic<uint64_t> m_dropped{0};
+
+    static void free_chunks(Chunk* chunk) {
+        while (chunk != NULL) {
+            Chunk* next = chunk->next.load(std::memory_order_relaxed);
+            delete chunk;
+            chunk = next;
+        }
+    }
+};
+
+/**
+ * @brief Process-wide, opt-in timeline tracer.
+ *
+ * `TraceSpan` and `TracedLock` record spans into a per-thread `TraceBuffer`
+ * while tracing is enabled; `dump()` writes everything recorded so far in the
+ * Chrome trace event format, which can be opened in `chrome://tracing` or
+ * Perfetto. Buffers of exited threads are kept until `clear()`.
+ */
+class Tracer {
+  public:
+    /**
+     * @brief Returns the tracer.
+     */
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    /**
+     * @brief Checks whether spans are currently being recorded.
+     */
+    static bool enabled() {
+        if constexpr (ENETCPP_TRACE)
+            return s_enabled.load(std::memory_order_relaxed);
+        return false;
+    }
+
+    /**
+     * @brief Starts or stops recording spans.
+     */
+    static void enable(bool enabled = true) {
+        s_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the trace clock, in nanoseconds.
+     */
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /**
+     * @brief Records a span on the calling thread.
+     * @param name A string that outlives the tracer (normally a literal).
+     * @param start The start time from `now()`.
+     * @param end The end time from `now()`.
+     */
+    void record(const char* name, uint64_t start, uint64_t end) {
+        thread_buffer().push(name, start, end);
+    }
+
+    /**
+     * @brief Names the calling thread in the trace.
+     * @param name The name to show.
+     */
+    void set_thread_name(const std::string& name) {
+        TraceBuffer& buffer = thread_buffer();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        buffer.name = name;
+    }
+
+    /**
+     * @brief Renders everything recorded so far as Chrome trace JSON.
+     *
+     * Safe to call while other threads are recording.
+     */
+    std::string dump() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        char line[256];
+        bool first = true;
+        uint64_t dropped = 0;
+        for (const auto& buffer : m_buffers) {
+            std::string name = buffer->name;
+            if (name.empty())
+                name = "thread " + std::to_string(buffer->id());
+            out += first ? "\n" : ",\n";
+            first = false;
+            snprintf(line, sizeof(line),
+                     "{\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                     "\"name\":\"thread_name\",\"args\":{\"name\":\"",
+                     buffer->id());
+            out += line;
+            escape(out, name.c_str());
+            out += "\"}}";
+            buffer->for_each([&](const TraceBuffer::Span& span) {
+                out += ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":";
+                out += std::to_string(buffer->id());
+                out += ",\"name\":\"";
+                escape(out, span.name);
+                snprintf(line, sizeof(line),
+                         "\",\"ts\":%llu.%03u,\"dur\":%llu.%03u}",
+                         (unsigned long long)(span.start / 1000),
+                         (unsigned)(span.start % 1000),
+                         (unsigned long long)(span.duration / 1000),
+                         (unsigned)(span.duration % 1000));
+                out += line;
+            });
+            dropped += buffer->dropped();
+        }
+        out += "\n],\"otherData\":{\"dropped_spans\":";
+        out += std::to_string(dropped);
+        out += "}}\n";
+        return out;
+    }
+
+    /**
+     * @brief Writes the trace JSON to a file.
+     * @param path The file to write.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void dump(const std::string& path) {
+        std::string json = dump();
+        FILE* file = fopen(path.c_str(), "w");
+        if (file == NULL)
+            throw std::runtime_error("Failed to open trace file " + path);
+        size_t written = fwrite(json.data(), 1, json.size(), file);
+        if (fclose(file) != 0 || written != json.size())
+            throw std::runtime_error("Failed to write trace file " + path);
+    }
+
+    /**
+     * @brief Discards all recorded spans and the buffers of exited threads.
+     *
+     * Only call this while no thread is recording, e.g. with tracing disabled
+     * and the hosts quiesced.
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_buffers.begin(); it != m_buffers.end();) {
+            // the owning thread holds the other reference while it is alive
+            if (it->use_count() == 1) {
+                it = m_buffers.erase(it);
+            } else {
+                (*it)->clear();
+                ++it;
+            }
+        }
+    }
+
+  private:
+    inline static std::atomic<bool> s_enabled{false};
+
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<TraceBuffer>> m_buffers;
+    uint32 m_next_id = 1;
+
+    Tracer() {}
+
+    TraceBuffer& thread_buffer() {
+        thread_local std::shared_ptr<TraceBuffer> buffer = [this] {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto out = std::make_shared<TraceBuffer>(m_next_id++);
+            m_buffers.push_back(out);
+            return out;
+        }();
+        return *buffer;
+    }
+
+    static void escape(std::string& out, const char* string) {
+        for (; *string; string++) {
+            unsigned char c = (unsigned char)*string;
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += (char)c;
+            } else if (c < 0x20) {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", c);
+                out += code;
+            } else {
+                out += (char)c;
+            }
+        }
+    }
+};
+
+/**
+ * @brief Records the lifetime of a scope as a span while tracing is enabled.
+ */
+class TraceSpan {
+  private:
+    const char* m_name;
+    uint64_t m_start = 0;
+
+  public:
+    /**
+     * @brief Starts the span.
+     * @param name A string that outlives the tracer (normally a literal).
+     */
+    explicit TraceSpan(const char* name) : m_name(name) {
+        if (Tracer::enabled())
+            m_start = Tracer::now();
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    ~TraceSpan() {
+        if (m_start != 0)
+            Tracer::instance().record(m_name, m_start, Tracer::now());
+    }
+};
+
+/**
+ * @brief A `std::lock_guard` replacement that traces contended waits.
+ *
+ * While tracing is enabled a `try_lock()` is attempted first, and only when it
+ * fails is the time spent blocked recorded as a span, so uncontended locking
+ * does not fill the trace.
+ */
+class TracedLock {
+  private:
+    std::mutex& m_mutex;
+
+  public:
+    /**
+     * @brief Locks the mutex.
+     * @param mutex The mutex to lock.
+     * @param name The span name used if the lock has to wait.
+     */
+    TracedLock(std::mutex& mutex, const char* name) : m_mutex(mutex) {
+        if (!Tracer::enabled()) {
+            m_mutex.lock();
+        } else if (!m_mutex.try_lock()) {
+            TraceSpan span(name);
+            m_mutex.lock();
+        }
+    }
+
+    TracedLock(const TracedLock&) = delete;
+    TracedLock& operator=(const TracedLock&) = delete;
+
+    /**
+     * @brief Unlocks the mutex.
+     */
+    ~TracedLock() { m_mutex.unlock(); }
+};
+
+/**
+ * @brief A time source for ENet.
+ *
+ * ENet reads the time through `enet_time_get`, which is wrapped at link time
+ * together with the socket functions. While a Host is inside ENet it makes
+ * its clock the calling thread's active clock, so each host can run on its
+ * own time. Hosts without a clock use ENet's wall clock.
+ */
+class Clock {
+  public:
+    virtual ~Clock() {}
+
+    /**
+     * @brief Returns the current time in microseconds.
+     */
+    virtual uint64_t microseconds() = 0;
+
+    /**
+     * @brief Returns the current time in milliseconds, as `enet_time_get`.
+     */
+    uint32 milliseconds() { return (uint32)(microseconds() / 1000); }
+
+    /**
+     * @brief Checks whether the clock is simulated.
+     *
+     * Socket waits on hosts with a virtual clock never block; they call
+     * `sleep()` instead.
+     */
+    virtual bool is_virtual() const { return false; }
+
+    /**
+     * @brief Lets `milliseconds` of simulated time pass, for virtual clocks.
+     */
+    virtual void sleep(uint32 milliseconds) { (void)milliseconds; }
+
+    /**
+     * @brief Returns the calling thread's active clock, or NULL.
+     */
+    static Clock* active() { return s_active; }
+
+  private:
+    friend class ClockScope;
+    inline static thread_local Clock* s_active = NULL;
+};
+
+/**
+ * @brief Makes a clock the calling thread's active clock for a scope.
+ */
+class ClockScope {
+  private:
+    Clock* m_previous;
+
+  public:
+    /**
+     * @brief Activates `clock`; NULL leaves the current clock active.
+     */
+    explicit ClockScope(Clock* clock) : m_previous(Clock::s_active) {
+        if (clock != NULL)
+            Clock::s_active = clock;
+    }
+
+    ClockScope(const ClockScope&) = delete;
+    ClockScope& operator=(const ClockScope&) = delete;
+
+    ~ClockScope() { Clock::s_active = m_previous; }
+};
+
+/**
+ * @brief A clock that only moves when told to.
+ *
+ * Share one VirtualClock between hosts and `advance()` it to run a
+ * simulation in fixed steps, without sleeping. With `auto_advance` set,
+ * every socket wait instead moves time forward by its timeout, which suits
+ * a single host serviced with a timeout.
+ */
+class VirtualClock : public Clock {
+  private:
+    std::atomic<uint64_t> m_now;
+    bool m_auto_advance;
+
+  public:
+    /**
+     * @brief Constructs the clock.
+     * @param start The initial time in microseconds; ENet treats some zero
+     * times as unset, so the default starts at one second.
+     * @param auto_advance Whether socket waits advance the clock.
+     */
+    VirtualClock(uint64_t start = 1000000, bool auto_advance = false)
+        : m_now(start), m_auto_advance(auto_advance) {}
+
+    uint64_t microseconds() override {
+        return m_now.load(std::memory_order_acquire);
+    }
+
+    bool is_virtual() const override { return true; }
+
+    void sleep(uint32 milliseconds) override {
+        if (m_auto_advance)
+            advance(std::chrono::milliseconds(milliseconds));
+    }
+
+    /**
+     * @brief Moves time forward.
+     */
+    void advance(std::chrono::microseconds step) {
+        m_now.fetch_add(step.count(), std::memory_order_acq_rel);
+    }
+};
+
+/**
+ * @brief The layer below a SocketShim: the next shim down, or the socket.
+ */
+class ShimLink {
+  public:
+    /**
+     * @brief Sends one datagram.
+     * @return The number of bytes sent, `0` if it would block, or `-1` on
+     * error, as for `enet_socket_send`.
+     */
+    virtual int send(const ENetAddress& address, const void* data,
+                     size_t length) = 0;
+
+    /**
+     * @brief Receives one datagram.
+     * @return The datagram length, `0` if none is ready, or a negative value
+     * on error, as for `enet_socket_receive`.
+     */
+    virtual int receive(ENetAddress& address, void* data, size_t capacity) = 0;
+
+    /**
+     * @brief Checks whether this is the host's UDP socket itself rather than
+     * another shim, so that a shim may write to the socket directly, e.g.
+     * with ancillary data.
+     */
+    virtual bool reaches_socket() const { return false; }
+
+  protected:
+    ~ShimLink() {}
+};
+
+/**
+ * @brief A layer between ENet and a host's UDP socket.
+ *
+ * Shims see every datagram a host sends and receives, one at a time, and may
+ * drop, delay, duplicate or rewrite them. They are attached with
+ * `Host::add_shim()` and are only called with the host lock held, so a shim
+ * attached to a single host needs no locking of its own.
+ *
+ * Socket calls are only routed through shims when the library is built with
+ * the `ENETCPP_SOCKET_SHIM` CMake option, which wraps ENet's socket functions
+ * at link time.
+ */
+class SocketShim {
+  public:
+    virtual ~SocketShim() {}
+
+    /**
+     * @brief Returns the shim clock, in microseconds.
+     *
+     * This is the host's Clock when it has one.
+     */
+    static uint64_t now() {
+        if (Clock* clock = Clock::active())
+            return clock->microseconds();
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /**
+     * @brief Handles a datagram ENet is sending; passes it down by default.
+     */
+    virtual int send(ShimLink& below, const ENetAddress& address,
+                     const void* data, size_t length) {
+        return below.send(address, data, length);
+    }
+
+    /**
+     * @brief Produces the next datagram for ENet; reads from below by default.
+     */
+    virtual int receive(ShimLink& below, ENetAddress& address, void* data,
+                        size_t capacity) {
+        return below.receive(address, data, capacity);
+    }
+
+    /**
+     * @brief Releases anything that has become due, e.g. delayed datagrams.
+     *
+     * Called before every socket operation on the host.
+     */
+    virtual void poll(ShimLink& below) { (void)below; }
+
+    /**
+     * @brief Returns the `now()` time at which `poll()` or `receive()` next has
+     * work to do, or `UINT64_MAX` if none.
+     *
+     * Socket waits are cut short at this deadline.
+     */
+    virtual uint64_t next_deadline() { return UINT64_MAX; }
+
+    /**
+     * @brief Checks whether this shim stands in for the socket entirely.
+     *
+     * If the lowest shim returns `true`, its `wait()` is used instead of
+     * waiting on the socket.
+     */
+    virtual bool replaces_socket() const { return false; }
+
+    /**
+     * @brief Waits for a datagram, for shims that replace the socket.
+     * @return `0` with `condition` updated, or `-1` on error, as for
+     * `enet_socket_wait`.
+     */
+    virtual int wait(enet_uint32* condition, enet_uint32 timeout) {
+        (void)condition;
+        (void)timeout;
+        return -1;
+    }
+
+    /**
+     * @brief Ends a `wait()` in progress early, for shims that replace the
+     * socket; callable from any thread.
+     * @return `false` if the shim cannot be interrupted.
+     */
+    virtual bool interrupt() { return false; }
+
+    /**
+     * @brief Called when the shim is removed from its host.
+     */
+    virtual void detach() {}
+};
+
+/**
+ * @brief Reads ENet's wire format, for shims that inspect or rewrite the
+ * datagrams of a host.
+ */
+class ShimProtocol {
+  public:
+    /**
+     * @brief Returns a key identifying an address, e.g. in a hash map.
+     */
+    static uint64_t key(const ENetAddress& address) {
+        return (uint64_t)address.host << 16 | address.port;
+    }
+
+    /**
+     * @brief Checks whether a peer is connected, including one that will
+     * disconnect once its queued packets are sent.
+     */
+    static bool live(const ENetPeer* peer) {
+        return peer->state == ENET_PEER_STATE_CONNECTED ||
+               peer->state == ENET_PEER_STATE_DISCONNECT_LATER;
+    }
+
+    /**
+     * @brief Checks whether a peer slot holds a connection in any state,
+     * including connecting and disconnecting.
+     */
+    static bool in_use(const ENetPeer* peer) {
+        return peer->state != ENET_PEER_STATE_DISCONNECTED &&
+               peer->state != ENET_PEER_STATE_ZOMBIE;
+    }
+
+    /**
+     * @brief Returns the size of a datagram's protocol header, checksum
+     * included, or `0` if the datagram is compressed or too short.
+     */
+    static size_t header_size(const ENetHost* host, const uint8* data,
+                              size_t length) {
+        if (length < sizeof(enet_uint16))
+            return 0;
+        uint16_t flags = (uint16_t)(data[0] << 8 | data[1]);
+        if (flags & ENET_PROTOCOL_HEADER_FLAG_COMPRESSED)
+            return 0;
+        size_t header = (flags & ENET_PROTOCOL_HEADER_FLAG_SENT_TIME)
+                            ? sizeof(ENetProtocolHeader)
+                            : sizeof(enet_uint16);
+        if (host->checksum != NULL)
+            header += sizeof(enet_uint32);
+        return header <= length ? header : 0;
+    }
+
+    /**
+     * @brief Returns the length of the data following a command.
+     */
+    static size_t data_length(const ENetProtocol& command) {
+        switch (command.header.command & ENET_PROTOCOL_COMMAND_MASK) {
+        case ENET_PROTOCOL_COMMAND_SEND_RELIABLE:
+            return ENET_NET_TO_HOST_16(command.sendReliable.dataLength);
+        case ENET_PROTOCOL_COMMAND_SEND_UNRELIABLE:
+            return ENET_NET_TO_HOST_16(command.sendUnreliable.dataLength);
+        case ENET_PROTOCOL_COMMAND_SEND_UNSEQUENCED:
+            return ENET_NET_TO_HOST_16(command.sendUnsequenced.dataLength);
+        case ENET_PROTOCOL_COMMAND_SEND_FRAGMENT:
+        case ENET_PROTOCOL_COMMAND_SEND_UNRELIABLE_FRAGMENT:
+            return ENET_NET_TO_HOST_16(command.sendFragment.dataLength);
+        default:
+            return 0;
+        }
+    }
+
+    /**
+     * @brief Calls `visitor` with each command of a datagram in turn, until
+     * it returns `false`.
+     *
+     * Parsing stops where ENet's does, at a zero or truncated command.
+     * @param header The size of the header, from `header_size()`.
+     */
+    template <typename Visitor>
+    static void for_each_command(const uint8* data, size_t header,
+                                 size_t length, Visitor&& visitor) {
+        for (size_t offset = header;
+             offset + sizeof(ENetProtocolCommandHeader) <= length;) {
+            uint8 number = data[offset] & ENET_PROTOCOL_COMMAND_MASK;
+            if (number == ENET_PROTOCOL_COMMAND_NONE ||
+                number >= ENET_PROTOCOL_COMMAND_COUNT)
+                return;
+            size_t size = enet_protocol_command_size(number);
+            if (size == 0 || offset + size > length)
+                return;
+            ENetProtocol command;
+            memcpy(&command, data + offset, size);
+            if (!visitor(command))
+                return;
+            offset += size + data_length(command);
+        }
+    }
+
+    /**
+     * @brief Returns whether commands are part of a handshake: the first
+     * one other than an acknowledgement is a connect or verify connect, or
+     * there are only acknowledgements.
+     *
+     * Those are sent uncompressed, so a host receives the connect `data`
+     * naming the peer's codec before anything it might not be able to
+     * decompress. ENet puts each command in its own buffer, with the
+     * acknowledgements first and the handshake commands right after; a
+     * buffer may also hold several commands.
+     */
+    static bool handshake(const ENetBuffer* buffers, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            const uint8* data = (const uint8*)buffers[i].data;
+            for (size_t offset = 0; offset < buffers[i].dataLength;
+                 offset += sizeof(ENetProtocolAcknowledge)) {
+                if (offset + sizeof(ENetProtocolCommandHeader) >
+                    buffers[i].dataLength)
+                    return false;
+                uint8 command = data[offset] & ENET_PROTOCOL_COMMAND_MASK;
+                if (command != ENET_PROTOCOL_COMMAND_ACKNOWLEDGE)
+                    return command == ENET_PROTOCOL_COMMAND_CONNECT ||
+                           command == ENET_PROTOCOL_COMMAND_VERIFY_CONNECT;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Recomputes the checksum of a datagram after a shim changed it.
+     *
+     * As ENet does, the checksum field is seeded with the sending peer's
+     * connect ID, or `0` before the remote has assigned a peer ID, and the
+     * checksum covers the header and the commands uncompressed.
+     * @param host The host, which must have a checksum set.
+     * @param connect_id The connect ID of the peer the datagram is for.
+     * @param header The header, `header_size()` bytes ending with the
+     * checksum field, which is overwritten.
+     * @param commands The commands, uncompressed.
+     */
+    static void sign(const ENetHost* host, enet_uint32 connect_id,
+                     uint8* header, size_t header_size, const uint8* commands,
+                     size_t length) {
+        uint16_t flags = (uint16_t)(header[0] << 8 | header[1]);
+        enet_uint32 seed = (flags & ENET_PROTOCOL_MAXIMUM_PEER_ID) <
+                                   ENET_PROTOCOL_MAXIMUM_PEER_ID
+                               ? connect_id
+                               : 0;
+        uint8* field = header + header_size - sizeof(enet_uint32);
+        memcpy(field, &seed, sizeof(seed));
+        ENetBuffer buffers[2];
+        buffers[0].data = header;
+        buffers[0].dataLength = header_size;
+        buffers[1].data = (void*)commands;
+        buffers[1].dataLength = length;
+        enet_uint32 checksum = host->checksum(buffers, length > 0 ? 2 : 1);
+        memcpy(field, &checksum, sizeof(checksum));
+    }
+};
+
+/**
+ * @brief Datagrams a shim holds back for one peer, in order.
+ */
+class DatagramQueue {
+  private:
+    std::deque<std::vector<uint8>> m_datagrams;
+    size_t m_bytes = 0;
+
+  public:
+    /**
+     * @brief Checks whether no datagram is held.
+     */
+    bool empty() const { return m_datagrams.empty(); }
+
+    /**
+     * @brief Returns the number of datagrams held.
+     */
+    size_t size() const { return m_datagrams.size(); }
+
+    /**
+     * @brief Returns the total length of the datagrams held.
+     */
+    size_t bytes() const { return m_bytes; }
+
+    /**
+     * @brief Returns the oldest datagram.
+     */
+    const std::vector<uint8>& front() const { return m_datagrams.front(); }
+
+    /**
+     * @brief Holds a copy of a datagram.
+     */
+    void push(const void* data, size_t length) {
+        const uint8* bytes = (const uint8*)data;
+        m_datagrams.emplace_back(bytes, bytes + length);
+        m_bytes += length;
+    }
+
+    /**
+     * @brief Sends the oldest datagram to `address` below and forgets it.
+     * @return Its length.
+     */
+    size_t release(ShimLink& below, const ENetAddress& address) {
+        std::vector<uint8>& datagram = m_datagrams.front();
+        size_t length = datagram.size();
+        below.send(address, datagram.data(), length);
+        m_bytes -= length;
+        m_datagrams.pop_front();
+        return length;
+    }
+
+    /**
+     * @brief Sends every datagram held, e.g. once there is nothing left to
+     * pace for.
+     */
+    void flush(ShimLink& below, const ENetAddress& address) {
+        while (!empty())
+            release(below, address);
+    }
+};
+
+/**
+ * @brief State a shim keeps per peer of its host, one slot per peer.
+ *
+ * There are `Host::peer_capacity()` slots whatever the host's window trim,
+ * so a peer's index into them stays valid. A slot holds the state of one
+ * connection, told apart by the peer's connect ID: `of()` starts it afresh
+ * for a peer that has reconnected, and `sweep()` ends the connections of
+ * peers that have disconnected or reconnected. Tracked connections can be
+ * found by address.
+ *
+ * Like the shims using it, it must only be used with the host lock held.
+ */
+template <typename State> class PeerSlots {
+  private:
+    struct Slot {
+        bool used = false;
+        enet_uint32 connect_id = 0;
+        ENetAddress address;
+        State state;
+    };
+
+    ENetHost* m_host;
+    std::vector<Slot> m_slots;
+    std::unordered_map<uint64_t, size_t> m_by_address;
+
+    void end(size_t index) {
+        Slot& slot = m_slots[index];
+        auto it = m_by_address.find(ShimProtocol::key(slot.address));
+        // another slot may have taken the address over
+        if (it != m_by_address.end() && it->second == index)
+            m_by_address.erase(it);
+        slot = Slot();
+    }
+
+  public:
+    /** @brief Index returned for a connection that is not tracked. */
+    static constexpr size_t NONE = SIZE_MAX;
+
+    /**
+     * @brief Constructs the slots of a host.
+     * @param host The host's ENetHost.
+     * @param capacity The host's `Host::peer_capacity()`.
+     */
+    PeerSlots(ENetHost* host, size_t capacity)
+        : m_host(host), m_slots(capacity) {}
+
+    /**
+     * @brief Returns the number of slots.
+     */
+    size_t size() const { return m_slots.size(); }
+
+    /**
+     * @brief Returns the state in a slot.
+     */
+    State& operator[](size_t index) { return m_slots[index].state; }
+
+    /**
+     * @brief Returns the state in a slot.
+     */
+    const State& operator[](size_t index) const {
+        return m_slots[index].state;
+    }
+
+    /**
+     * @brief Returns the address of the connection in a slot.
+     */
+    const ENetAddress& address(size_t index) const {
+        return m_slots[index].address;
+    }
+
+    /**
+     * @brief Returns the connect ID of the connection in a slot.
+     */
+    enet_uint32 connect_id(size_t index) const {
+        return m_slots[index].connect_id;
+    }
+
+    /**
+     * @brief Checks whether the slot of `peer` holds its current connection.
+     */
+    bool current(const ENetPeer* peer) const {
+        size_t index = peer - m_host->peers;
+        return index < m_slots.size() && m_slots[index].used &&
+               m_slots[index].connect_id == peer->connectID;
+    }
+
+    /**
+     * @brief Returns the state of `peer`'s current connection, starting it
+     * if the peer has connected since.
+     */
+    State& of(ENetPeer* peer) {
+        size_t index = peer - m_host->peers;
+        if (!current(peer)) {
+            if (m_slots[index].used)
+                end(index);
+            Slot& slot = m_slots[index];
+            slot.used = true;
+            slot.connect_id = peer->connectID;
+            slot.address = peer->address;
+            m_by_address[ShimProtocol::key(slot.address)] = index;
+        }
+        return m_slots[index].state;
+    }
+
+    /**
+     * @brief Returns the slot of the tracked connection to `address`, or
+     * `NONE`.
+     */
+    size_t find(const ENetAddress& address) const {
+        auto it = m_by_address.find(ShimProtocol::key(address));
+        return it == m_by_address.end() ? NONE : it->second;
+    }
+
+    /**
+     * @brief Like `find()`, but also looks through the host's peers for a
+     * connection to `address` not tracked yet, and starts tracking it.
+     */
+    size_t lookup(const ENetAddress& address) {
+        size_t index = find(address);
+        if (index != NONE)
+            return index;
+        for (size_t i = 0; i < m_host->peerCount && i < m_slots.size(); i++) {
+            ENetPeer* peer = &m_host->peers[i];
+            if (ShimProtocol::in_use(peer) &&
+                peer->address.host == address.host &&
+                peer->address.port == address.port) {
+                of(peer);
+                return i;
+            }
+        }
+        return NONE;
+    }
+
+    /**
+     * @brief Ends the connections of peers that have disconnected or
+     * reconnected, calling `ended(index)` on each slot before clearing it.
+     */
+    template <typename Ended> void sweep(Ended&& ended) {
+        for (size_t i = 0; i < m_slots.size(); i++) {
+            if (!m_slots[i].used)
+                continue;
+            const ENetPeer* peer = &m_host->peers[i];
+            if (ShimProtocol::in_use(peer) &&
+                peer->connectID == m_slots[i].connect_id)
+                continue;
+            ended(i);
+            end(i);
+        }
+    }
+
+    /**
+     * @brief Calls `visitor(index)` for the slot of every tracked
+     * connection.
+     */
+    template <typename Visitor> void for_each(Visitor&& visitor) {
+        for (auto& entry : m_by_address)
+            visitor(entry.second);
+    }
+};
+
+/**
+ * @brief ENet's own socket functions, called beneath the last shim.
+ */
+struct SocketFunctions {
+    int (*send)(ENetSocket, const ENetAddress*, const ENetBuffer*, size_t);
+    int (*receive)(ENetSocket, ENetAddress*, ENetBuffer*, size_t);
+    int (*wait)(ENetSocket, enet_uint32*, enet_uint32);
+};
+
+/**
+ * @brief The shims attached to one socket, with index 0 closest to ENet.
+ */
+class ShimStack {
+  private:
+    ENetSocket m_socket;
+    SocketFunctions m_real;
+    std::vector<std::shared_ptr<SocketShim>> m_layers;
+
+    class Link : public ShimLink {
+      private:
+        ShimStack& m_stack;
+        size_t m_index;
+
+      public:
+        Link(ShimStack& stack, size_t index) : m_stack(stack), m_index(index) {}
+
+        int send(const ENetAddress& address, const void* data,
+                 size_t length) override {
+            if (m_index < m_stack.m_layers.size()) {
+                Link below(m_stack, m_index + 1);
+                return m_stack.m_layers[m_index]->send(below, address, data,
+                                                       length);
+            }
+            ENetBuffer buffer;
+            buffer.data = (void*)data;
+            buffer.dataLength = length;
+            return m_stack.m_real.send(m_stack.m_socket, &address, &buffer, 1);
+        }
+
+        int receive(ENetAddress& address, void* data,
+                    size_t capacity) override {
+            if (m_index < m_stack.m_layers.size()) {
+                Link below(m_stack, m_index + 1);
+                return m_stack.m_layers[m_index]->receive(below, address, data,
+                                                          capacity);
+            }
+            ENetBuffer buffer;
+            buffer.data = data;
+            buffer.dataLength = capacity;
+            return m_stack.m_real.receive(m_stack.m_socket, &address, &buffer,
+                                          1);
+        }
+
+        bool reaches_socket() const override {
+            return m_index >= m_stack.m_layers.size();
+        }
+    };
+
+  public:
+    ShimStack(ENetSocket socket, const SocketFunctions& real)
+        : m_socket(socket), m_real(real) {}
+
+    ~ShimStack() {
+        for (auto& layer : m_layers)
+            layer->detach();
+    }
+
+    /**
+     * @brief Adds a shim above the existing ones, closest to ENet.
+     */
+    void push(std::shared_ptr<SocketShim> shim) {
+        m_layers.insert(m_layers.begin(), std::move(shim));
+    }
+
+    /**
+     * @brief Checks whether any shims are attached.
+     */
+    bool empty() const { return m_layers.empty(); }
+
+    /**
+     * @brief Lets every shim release due work.
+     */
+    void poll() {
+        for (size_t i = 0; i < m_layers.size(); i++) {
+            Link below(*this, i + 1);
+            m_layers[i]->poll(below);
+        }
+    }
+
+    /**
+     * @brief Replaces `enet_socket_send` for this socket.
+     */
+    int send(const ENetAddress* address, const ENetBuffer* buffers,
+             size_t count) {
+        poll();
+        uint8 datagram[ENET_PROTOCOL_MAXIMUM_MTU];
+        size_t length = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (length + buffers[i].dataLength > sizeof(datagram))
+                return -1;
+            memcpy(datagram + length, buffers[i].data, buffers[i].dataLength);
+            length += buffers[i].dataLength;
+        }
+        return Link(*this, 0).send(*address, datagram, length);
+    }
+
+    /**
+     * @brief Replaces `enet_socket_receive` for this socket.
+     */
+    int receive(ENetAddress* address, ENetBuffer* buffers, size_t count) {
+        poll();
+        if (count == 1)
+            return Link(*this, 0).receive(*address, buffers[0].data,
+                                          buffers[0].dataLength);
+        uint8 datagram[ENET_PROTOCOL_MAXIMUM_MTU];
+        int length = Link(*this, 0).receive(*address, datagram,
+                                            sizeof(datagram));
+        size_t offset = 0;
+        for (size_t i = 0; i < count && length > 0 && offset < (size_t)length;
+             i++) {
+            size_t part = std::min(buffers[i].dataLength, length - offset);
+            memcpy(buffers[i].data, datagram + offset, part);
+            offset += part;
+        }
+        return length > 0 && offset < (size_t)length ? -2 : length;
+    }
+
+    /**
+     * @brief Shortens a wait timeout so it ends at the next shim deadline.
+     * @return The timeout in milliseconds, `0` if a deadline has passed.
+     */
+    enet_uint32 limit(enet_uint32 timeout) {
+        uint64_t deadline = UINT64_MAX;
+        for (auto& layer : m_layers)
+            deadline = std::min(deadline, layer->next_deadline());
+        if (deadline == UINT64_MAX)
+            return timeout;
+        uint64_t now = SocketShim::now();
+        if (deadline <= now)
+            return 0;
+        // round up so the wait ends at or after the deadline
+        uint64_t milliseconds = (deadline - now + 999) / 1000;
+        return milliseconds < timeout ? (enet_uint32)milliseconds : timeout;
+    }
+
+    /**
+     * @brief Replaces `enet_socket_wait` for this socket, returning early with
+     * `ENET_SOCKET_WAIT_RECEIVE` when a shim deadline passes.
+     */
+    int wait(enet_uint32* condition, enet_uint32 timeout) {
+        poll();
+        uint64_t deadline = UINT64_MAX;
+        for (auto& layer : m_layers)
+            deadline = std::min(deadline, layer->next_deadline());
+        if (deadline <= SocketShim::now()) {
+            *condition = ENET_SOCKET_WAIT_RECEIVE;
+            return 0;
+        }
+        timeout = limit(timeout);
+        int rc = !m_layers.empty() && m_layers.back()->replaces_socket()
+                     ? m_layers.back()->wait(condition, timeout)
+                     : m_real.wait(m_socket, condition, timeout);
+        if (rc == 0 && *condition == ENET_SOCKET_WAIT_NONE &&
+            deadline <= SocketShim::now())
+            *condition = ENET_SOCKET_WAIT_RECEIVE;
+        return rc;
+    }
+
+    /**
+     * @brief Interrupts the wait of a shim that replaces the socket.
+     * @return `false` if there is no such shim or it cannot be interrupted.
+     */
+    bool interrupt() {
+        return !m_layers.empty() && m_layers.back()->replaces_socket() &&
+               m_layers.back()->interrupt();
+    }
+};
+
+/**
+ * @brief Routes ENet's socket calls to the ShimStack of each socket.
+ *
+ * The link-time wrappers in `enetcpp-shim.hpp` call `send()`, `receive()` and
+ * `wait()` here and `install()` the real ENet functions on startup.
+ */
+class SocketShims {
+  public:
+    /** @brief Sockets with descriptors at or above this cannot be shimmed. */
+    static constexpr size_t MAX_SOCKETS = ENETCPP_SHIM_MAX_SOCKETS;
+
+    /**
+     * @brief Records ENet's own socket functions; called by the wrappers.
+     */
+    static void install(const SocketFunctions& real) {
+        s_real = real;
+        s_installed.store(true, std::memory_order_release);
+    }
+
+    /**
+     * @brief Checks whether the wrappers are linked in.
+     */
+    static bool installed() {
+        return s_installed.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Returns ENet's own socket functions.
+     */
+    static const SocketFunctions& real() { return s_real; }
+
+    /**
+     * @brief Routes a socket through a stack.
+     * @throws std::runtime_error if the wrappers are not linked in or the
+     * descriptor is out of range.
+     */
+    static void attach(ENetSocket socket, ShimStack* stack) {
+        if (!installed())
+            throw std::runtime_error("Socket shims are not linked in, build "
+                                     "with ENETCPP_SOCKET_SHIM");
+        if (socket < 0 || (size_t)socket >= MAX_SOCKETS)
+            throw std::runtime_error("Socket descriptor out of shim range");
+        s_stacks[socket].store(stack, std::memory_order_release);
+    }
+
+    /**
+     * @brief Stops routing a socket through its stack.
+     */
+    static void detach(ENetSocket socket) {
+        if (socket >= 0 && (size_t)socket < MAX_SOCKETS)
+            s_stacks[socket].store(NULL, std::memory_order_release);
+    }
+
+    /**
+     * @brief Returns the stack for a socket, or NULL.
+     */
+    static ShimStack* find(ENetSocket socket) {
+        if (socket < 0 || (size_t)socket >= MAX_SOCKETS)
+            return NULL;
+        return s_stacks[socket].load(std::memory_order_acquire);
+    }
+
+    static int send(ENetSocket socket, const ENetAddress* address,
+                    const ENetBuffer* buffers, size_t count) {
+        ShimStack* stack = find(socket);
+        if (stack == NULL || address == NULL)
+            return s_real.send(socket, address, buffers, count);
+        return stack->send(address, buffers, count);
+    }
+
+    static int receive(ENetSocket socket, ENetAddress* address,
+                       ENetBuffer* buffers, size_t count) {
+        ShimStack* stack = find(socket);
+        if (stack == NULL || address == NULL)
+            return s_real.receive(socket, address, buffers, count);
+        return stack->receive(address, buffers, count);
+    }
+
+    static int wait(ENetSocket socket, enet_uint32* condition,
+                    enet_uint32 timeout) {
+        ShimStack* stack = find(socket);
+        Clock* clock = Clock::active();
+        if (clock == NULL || !clock->is_virtual()) {
+            if (stack == NULL)
+                return s_real.wait(socket, condition, timeout);
+            return stack->wait(condition, timeout);
+        }
+        // simulated time: poll, let the clock pass the wait, then poll again
+        enet_uint32 requested = *condition;
+        int rc = stack ? stack->wait(condition, 0)
+                       : s_real.wait(socket, condition, 0);
+        if (rc != 0 || *condition != ENET_SOCKET_WAIT_NONE || timeout == 0)
+            return rc;
+        clock->sleep(stack ? stack->limit(timeout) : timeout);
+        *condition = requested;
+        return stack ? stack->wait(condition, 0)
+                     : s_real.wait(socket, condition, 0);
+    }
+
+    /**
+     * @brief Replaces `enet_time_get`, reading the active Clock if any.
+     */
+    static enet_uint32 time(enet_uint32 (*real)(void)) {
+        Clock* clock = Clock::active();
+        return clock ? clock->milliseconds() : real();
+    }
+
+  private:
+    inline static SocketFunctions s_real{};
+    inline static std::atomic<bool> s_installed{false};
+    inline static std::atomic<ShimStack*> s_stacks[MAX_SOCKETS]{};
+};
+
+/**
+ * @brief Checksums a host can put on its datagrams, see
+ * `Host::enable_checksum()`.
+ */
+enum class ChecksumKind {
+    /** No checksum, ENet's default. */
+    NONE,
+    /** CRC-32 as computed by `enet_crc32`, so plain ENet peers can read it. */
+    CRC32,
+    /** CRC-32C (Castagnoli), computed with CPU instructions where available. */
+    CRC32C
+};
+
+/**
+ * @brief CRC-32 and CRC-32C over ENet's datagram buffers.
+ *
+ * Both are reflected CRCs computed eight bytes at a time with slicing-by-8
+ * tables, where `enet_crc32` goes one byte at a time. CRC-32C additionally
+ * uses the SSE4.2 `crc32` instruction on x86-64 CPUs that have it, detected
+ * at runtime, and the ARMv8 CRC instructions when compiled for them.
+ */
+class Checksum {
+  private:
+    using Table = uint32[8][256];
+
+    template <uint32 POLYNOMIAL> static const Table& table() {
+        static const struct Tables {
+            Table table;
+            Tables() {
+                for (uint32 i = 0; i < 256; i++) {
+                    uint32 crc = i;
+                    for (int bit = 0; bit < 8; bit++)
+                        crc = (crc >> 1) ^ (POLYNOMIAL & (0U - (crc & 1)));
+                    table[0][i] = crc;
+                }
+                for (uint32 i = 0; i < 256; i++)
+                    for (int k = 1; k < 8; k++)
+                        table[k][i] = (table[k - 1][i] >> 8) ^
+                                      table[0][table[k - 1][i] & 0xFF];
+            }
+        } tables;
+        return tables.table;
+    }
+
+    static uint32 load32(const uint8* p) {
+        return (uint32)p[0] | (uint32)p[1] << 8 | (uint32)p[2] << 16 |
+               (uint32)p[3] << 24;
+    }
+
+    template <uint32 POLYNOMIAL>
+    static uint32 software(uint32 crc, const void* data, size_t length) {
+        const Table& t = table<POLYNOMIAL>();
+        const uint8* p = (const uint8*)data;
+        for (; length >= 8; p += 8, length -= 8) {
+            uint32 lo = load32(p) ^ crc, hi = load32(p + 4);
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+                  t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+                  t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        }
+        for (; length > 0; p++, length--)
+            crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+        return crc;
+    }
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __attribute__((target("sse4.2"))) static uint32
+    hardware(uint32 crc, const void* data, size_t length) {
+        const uint8* p = (const uint8*)data;
+        uint64_t crc64 = crc;
+        for (; length >= 8; p += 8, length -= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            crc64 = __builtin_ia32_crc32di(crc64, word);
+        }
+        crc = (uint32)crc64;
+        for (; length > 0; p++, length--)
+            crc = __builtin_ia32_crc32qi(crc, *p);
+        return crc;
+    }
+
+    static bool detect_hardware() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    static uint32 hardware(uint32 crc, const void* data, size_t length) {
+        const uint8* p = (const uint8*)data;
+        for (; length >= 8; p += 8, length -= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            crc = __crc32cd(crc, word);
+        }
+        for (; length > 0; p++, length--)
+            crc = __crc32cb(crc, *p);
+        return crc;
+    }
+
+    static bool detect_hardware() { return true; }
+#else
+    static uint32 hardware(uint32 crc, const void* data, size_t length) {
+        return software<0x82F63B78>(crc, data, length);
+    }
+
+    static bool detect_hardware() { return false; }
+#endif
+
+    template <uint32 (*UPDATE)(uint32, const void*, size_t)>
+    static enet_uint32 ENET_CALLBACK over_buffers(const ENetBuffer* buffers,
+                                                  size_t buffer_count) {
+        uint32 crc = 0xFFFFFFFF;
+        for (size_t i = 0; i < buffer_count; i++)
+            crc = UPDATE(crc, buffers[i].data, buffers[i].dataLength);
+        return ENET_HOST_TO_NET_32(~crc);
+    }
+
+  public:
+    /**
+     * @brief Returns whether `crc32c()` uses CPU instructions.
+     */
+    static bool crc32c_accelerated() {
+        static const bool accelerated = detect_hardware();
+        return accelerated;
+    }
+
+    /**
+     * @brief Continues a CRC-32 (polynomial `0xEDB88320`, reflected).
+     *
+     * Pass `0xFFFFFFFF` to start and complement the result to finish.
+     */
+    static uint32 crc32(uint32 crc, const void* data, size_t length) {
+        return software<0xEDB88320>(crc, data, length);
+    }
+
+    /**
+     * @brief Continues a CRC-32C (polynomial `0x82F63B78`, reflected) with the
+     * portable table implementation.
+     */
+    static uint32 crc32c_portable(uint32 crc, const void* data,
+                                  size_t length) {
+        return software<0x82F63B78>(crc, data, length);
+    }
+
+    /**
+     * @brief Continues a CRC-32C, with CPU instructions when available.
+     *
+     * Pass `0xFFFFFFFF` to start and complement the result to finish.
+     */
+    static uint32 crc32c(uint32 crc, const void* data, size_t length) {
+        return crc32c_accelerated() ? hardware(crc, data, length)
+                                    : crc32c_portable(crc, data, length);
+    }
+
+    /**
+     * @brief Returns the `ENetHost::checksum` callback for `kind`, or `NULL`
+     * for `ChecksumKind::NONE`.
+     */
+    static ENetChecksumCallback callback(ChecksumKind kind) {
+        switch (kind) {
+        case ChecksumKind::CRC32:
+            return over_buffers<crc32>;
+        case ChecksumKind::CRC32C:
+            return crc32c_accelerated() ? over_buffers<hardware>
+                                        : over_buffers<crc32c_portable>;
+        default:
+            return NULL;
+        }
+    }
+};
+
+/**
+ * @brief A datagram codec for `Host::set_compressor()`.
+ *
+ * ENet compresses each datagram after its protocol header, so both ends of a
+ * connection must use the same codec. Implementations may be shared by
+ * several hosts and are called from the threads servicing them, so they must
+ * not keep per-call state in members.
+ */
+class Compressor {
+  public:
+    virtual ~Compressor() = default;
+
+    /**
+     * @brief Returns the codec's name.
+     */
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Returns an id identifying the codec and its settings, or `0`
+     * if ends need not agree on one.
+     *
+     * A host with a non-zero id sends it as the `data` of its connections
+     * and refuses incoming connections that do not carry it, see
+     * `Host::set_compressor()`.
+     */
+    virtual uint32 id() const { return 0; }
+
+    /**
+     * @brief Compresses `length` bytes into `out`.
+     * @return The compressed size, or `0` if it would not fit in
+     * `out_limit` bytes.
+     */
+    virtual size_t compress(const uint8* in, size_t length, uint8* out,
+                            size_t out_limit) = 0;
+
+    /**
+     * @brief Decompresses `length` bytes into `out`.
+     * @return The decompressed size, or `0` if the input is malformed or
+     * would not fit in `out_limit` bytes.
+     */
+    virtual size_t decompress(const uint8* in, size_t length, uint8* out,
+                              size_t out_limit) = 0;
+};
+
+/**
+ * @brief Wrapper class for ENetHost.
+ *
+ * Manages the creation of ENet hosts, both for servers and clients.
+ */
+class Host {
+  private:
+    Address m_address;
+    ENetHost* m_host;
+    bool m_is_server;
+    Logger m_logger;
+    HostMetrics m_metrics;
+    StageHistograms m_latency;
+    std::mutex m_latency_mutex;
+    std::vector<const StageHistograms*> m_thread_latency;
+    HistogramSnapshot m_retired_latency[(size_t)LatencyStage::COUNT];
+    std::unique_ptr<ShimStack> m_shims;
+    std::shared_ptr<Clock> m_clock;
+    std::atomic<bool> m_waiting{false};
+    std::mutex m_wake_mutex;
+    ENetSocket m_wake_socket = ENET_SOCKET_NULL;
+    ENetAddress m_wake_address;
+    size_t m_peer_capacity = 0;
+    size_t m_trim_spare = 0;
+    std::atomic<uint32> m_codec_id{0};
+
+    /**
+     * @brief The `ENetCompressor` context installed by `set_compressor()`,
+     * owned by ENet and freed through `destroy()`.
+     */
+    struct CompressorBinding {
+        std::shared_ptr<Compressor> codec;
+        size_t threshold;
+        HostMetrics* metrics;
+        std::vector<uint8> scratch;
+
+        static uint64_t since(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                .count();
+        }
+
+        static size_t ENET_CALLBACK compress(void* context,
+                                             const ENetBuffer* buffers,
+                                             size_t buffer_count,
+                                             size_t in_limit, uint8* out,
+                                             size_t out_limit) {
+            CompressorBinding* self = (CompressorBinding*)context;
+            if (self->threshold == SIZE_MAX)
+                return 0;
+            HostMetrics& m = *self->metrics;
+            auto relaxed = std::memory_order_relaxed;
+            if (in_limit < self->threshold ||
+                ShimProtocol::handshake(buffers, buffer_count)) {
+                m.uncompressed_datagrams.fetch_add(1, relaxed);
+                return 0;
+            }
+            auto start = std::chrono::steady_clock::now();
+            // ENet hands over the commands as separate buffers
+            const uint8* in = (const uint8*)buffers[0].data;
+            if (buffer_count > 1) {
+                self->scratch.resize(in_limit);
+                size_t length = 0;
+                for (size_t i = 0; i < buffer_count && length < in_limit;
+                     i++) {
+                    size_t part =
+                        std::min(buffers[i].dataLength, in_limit - length);
+                    memcpy(self->scratch.data() + length, buffers[i].data,
+                           part);
+                    length += part;
+                }
+                in = self->scratch.data();
+            }
+            size_t size = self->codec->compress(in, in_limit, out, out_limit);
+            m.compress_nanoseconds.fetch_add(since(start), relaxed);
+            if (size == 0 || size >= in_limit) {
+                m.uncompressed_datagrams.fetch_add(1, relaxed);
+                return 0;
+            }
+            m.compressed_datagrams.fetch_add(1, relaxed);
+            m.compress_input_bytes.fetch_add(in_limit, relaxed);
+            m.compress_output_bytes.fetch_add(size, relaxed);
+            return size;
+        }
+
+        static size_t ENET_CALLBACK decompress(void* context, const uint8* in,
+                                               size_t in_limit, uint8* out,
+                                               size_t out_limit) {
+            CompressorBinding* self = (CompressorBinding*)context;
+            auto start = std::chrono::steady_clock::now();
+            size_t size = self->codec->decompress(in, in_limit, out, out_limit);
+            HostMetrics& m = *self->metrics;
+            m.decompress_nanoseconds.fetch_add(since(start),
+                                               std::memory_order_relaxed);
+            if (size == 0)
+                m.decompress_failures.fetch_add(1, std::memory_order_relaxed);
+            else
+                m.decompressed_datagrams.fetch_add(1,
+                                                   std::memory_order_relaxed);
+            return size;
+        }
+
+        static void ENET_CALLBACK destroy(void* context) {
+            delete (CompressorBinding*)context;
+        }
+    };
+
+    /**
+     * @brief Shrinks or grows the peer range ENet walks to the highest slot
+     * in use plus the spare slots of `set_window_trim()`; called with the
+     * lock held.
+     */
+    void trim_window() {
+        if (m_trim_spare == 0)
+            return;
+        size_t top = m_host->peerCount;
+        while (top > 0 &&
+               m_host->peers[top - 1].state == ENET_PEER_STATE_DISCONNECTED)
+            top--;
+        m_host->peerCount = std::min(m_peer_capacity, top + m_trim_spare);
+    }
+
+    /**
+     * @brief Marks the host as about to block in `enet_host_service`.
+     *
+     * The fence pairs with the one in `notify()`: either ENet sees the work
+     * queued before the notification, or `notify()` sees the flag and wakes
+     * the wait.
+     */
+    void begin_wait(uint32 timeout) {
+        if (timeout == 0)
+            return;
+        m_waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void end_wait() { m_waiting.store(false, std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the data to connect with: `data`, or the codec id.
+     */
+    uint32 connect_data(uint32 data) const {
+        return data != 0 ? data : m_codec_id.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Refuses an incoming connection whose data does not name this
+     * host's codec; returns whether it did.
+     */
+    bool refuse_codec(ENetEvent& event) {
+        uint32 id = m_codec_id.load(std::memory_order_relaxed);
+        if (id == 0 || event.data == id)
+            return false;
+        m_logger.minimal("refusing %x:%u, its codec %x is not %x",
+                         event.peer->address.host, event.peer->address.port,
+                         event.data, id);
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        enet_peer_disconnect_now(event.peer, id);
+        return true;
+    }
+
+    /**
+     * @brief Dispatches an event to the appropriate handler.
+     * @tparam EventType The type of event to handle.
+     * @param event_ The ENetEvent to dispatch.
+     * @param name The trace span name.
+     */
+    template <class EventType>
+    void dispatch(ENetEvent event_, const char* name) {
+        TraceSpan span(name);
+        auto start = std::chrono::steady_clock::now();
+        {
+            EventType event(event_);
+            this->on_event(event);
+        }
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+        m_metrics.record_dispatch(elapsed);
+        m_latency[LatencyStage::DISPATCH].record(elapsed);
+    }
+
+    /**
+     * @brief Counts, logs and dispatches an event returned by ENet.
+     * @param event The event.
+     */
+    void handle_event(ENetEvent& event) {
+        switch (event.type) {
+        case ENET_EVENT_TYPE_CONNECT:
+            if (refuse_codec(event))
+                break;
+            m_logger.info("%x:%u connected", event.peer->address.host,
+                          event.peer->address.port);
+            m_metrics.connect_events.fetch_add(1, std::memory_order_relaxed);
+            dispatch<EventConnect>(event, "dispatch connect");
+            break;
+        case ENET_EVENT_TYPE_DISCONNECT:
+            m_logger.info("%x:%u disconnected", event.peer->address.host,
+                          event.peer->address.port);
+            m_metrics.disconnect_events.fetch_add(1,
+                                                  std::memory_order_relaxed);
+            dispatch<EventDisconnect>(event, "dispatch disconnect");
+            break;
+        case ENET_EVENT_TYPE_RECEIVE:
+            m_logger.info("received %lu bytes from %x:%u",
+                          event.packet->dataLength, event.peer->address.host,
+                          event.peer->address.port);
+            m_metrics.receive_events.fetch_add(1, std::memory_order_relaxed);
+            dispatch<EventReceive>(event, "dispatch receive");
+            break;
+        default:
+            break;
+        }
+    }
+
+  protected:
+    std::mutex m_mutex;
+
+  public:
+    Logger& logger() { return m_logger; }
+
+    /**
+     * @brief Returns the host's live counters.
+     *
+     * The counters can be read from any thread without locking the host.
+     *
+     * @return A reference to the HostMetrics.
+     */
+    HostMetrics& metrics() { return m_metrics; }
+
+    /**
+     * @brief Registers histograms recorded by another thread.
+     *
+     * Their samples are included in `latency()` until they are removed with
+     * `remove_latency()`, after which they are kept in a merged total.
+     *
+     * @param histograms The histograms, which must outlive the registration.
+     */
+    void add_latency(const StageHistograms& histograms) {
+        std::lock_guard<std::mutex> lock(m_latency_mutex);
+        m_thread_latency.push_back(&histograms);
+    }
+
+    /**
+     * @brief Unregisters histograms added with `add_latency()`, folding their
+     * samples into the host's totals.
+     * @param histograms The histograms to remove.
+     */
+    void remove_latency(const StageHistograms& histograms) {
+        std::lock_guard<std::mutex> lock(m_latency_mutex);
+        for (auto it = m_thread_latency.begin(); it != m_thread_latency.end();
+             ++it) {
+            if (*it == &histograms) {
+                for (size_t i = 0; i < (size_t)LatencyStage::COUNT; i++)
+                    m_retired_latency[i].merge(
+                        histograms[(LatencyStage)i].snapshot());
+                m_thread_latency.erase(it);
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the latency distribution of a stage across all threads.
+     *
+     * This does not lock the host and can be called from any thread.
+     *
+     * @param stage The stage to report.
+     * @return The merged histogram, in nanoseconds.
+     */
+    HistogramSnapshot latency(LatencyStage stage) {
+        HistogramSnapshot out = m_latency[stage].snapshot();
+        std::lock_guard<std::mutex> lock(m_latency_mutex);
+        out.merge(m_retired_latency[(size_t)stage]);
+        for (const StageHistograms* histograms : m_thread_latency)
+            out.merge((*histograms)[stage].snapshot());
+        return out;
+    }
+
+    /**
+     * @brief Constructs a server Host with the specified address and
+     * configuration.
+     * @param address The server address.
+     * @param peer_count The maximum number of peers.
+     * @param channel_limit The maximum number of channels.
+     * @param incoming_bandwidth The incoming bandwidth limit.
+     * @param outgoing_bandwidth The outgoing bandwidth limit.
+     * @throws std::runtime_error if the host creation fails, or `peer_count`
+     * is above ENet's limit of 4095 (see `ShardedHost`).
+     */
+    Host(Address address, size_t peer_count, size_t channel_limit = 1U,
+         uint32 incoming_bandwith = 0U, uint32 outgoing_bandwidth = 0U,
+         Logger logger = Logger())
+        : m_address(address), m_is_server(true), m_logger(logger) {
+        m_logger.trace("creating ENet server host");
+        if (peer_count > ENET_PROTOCOL_MAXIMUM_PEER_ID)
+            throw std::runtime_error("ENet hosts hold at most 4095 peers, "
+                                     "use ShardedHost for more");
+        m_host = enet_host_create(m_address.get(), peer_count, channel_limit,
+                                  incoming_bandwith, outgoing_bandwidth);
+        if (m_host == NULL) {
+            throw std::runtime_error("Failed to create an ENet server host");
+        }
+        m_peer_capacity = m_host->peerCount;
+    }
+
+    /**
+     * @brief Constructs a client Host with the specified configuration.
+     * @param peer_count The maximum number of peers.
+     * @param channel_limit The maximum number of channels.
+     * @param incoming_bandwidth The incoming bandwidth limit.
+     * @param outgoing_bandwidth The outgoing bandwidth limit.
+     * @throws std::runtime_error if the host creation fails.
+     */
+    Host(size_t peer_count, size_t channel_limit = 1U,
+         uint32 incoming_bandwith = 0U, uint32 outgoing_bandwidth = 0U,
+         Logger logger = Logger())
+        : m_is_server(false), m_logger(logger) {
+        m_logger.trace("creating ENet client host");
+        if (peer_count > ENET_PROTOCOL_MAXIMUM_PEER_ID)
+            throw std::runtime_error("ENet hosts hold at most 4095 peers, "
+                                     "use ShardedHost for more");
+        m_host = enet_host_create(NULL, peer_count, channel_limit,
+                                  incoming_bandwith, outgoing_bandwidth);
+        if (m_host == NULL) {
+            throw std::runtime_error("Failed to create an ENet client host");
+        }
+        m_peer_capacity = m_host->peerCount;
+    }
+
+    /**
+     * @brief Destructor for Host.
+     *
+     * FLushes the host and then destroys the underlying ENetHost object.
+     */
+    ~Host() {
+        m_logger.trace("destroying ENet host");
+        flush();
+        clear_shims();
+        if (m_wake_socket != ENET_SOCKET_NULL)
+            enet_socket_destroy(m_wake_socket);
+        m_host->peerCount = m_peer_capacity;
+        enet_host_destroy(m_host);
+    }
+
+    /**
+     * @brief Services the host to check for network events.
+     * @param timeout The maximum time to wait for an event, in milliseconds -
+     * locks the mutex for `timeout` seconds.
+     * @return The result of the ENet service call.
      */
     int service(uint32 timeout = 0) {
+        TraceSpan span("Host::service");
         m_logger.trace("servicing ENet host");
         ENetEvent event;
         int rc;
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
+            TracedLock lock(m_mutex, "wait Host::m_mutex");
+            ClockScope clock(m_clock.get());
+            TraceSpan service_span("enet_host_service");
+            auto start = std::chrono::steady_clock::now();
+            begin_wait(timeout);
             rc = enet_host_service(m_host, &event, timeout);
+            end_wait();
+            trim_window();
+            m_latency[LatencyStage::SERVICE].record_since(start);
+            m_metrics.update(m_host);
         }
-        if (rc > 0) {
-            switch (event.type) {
-            case ENET_EVENT_TYPE_CONNECT:
-                m_logger.info("%x:%u connected", event.peer->address.host,
-                              event.peer->address.port);
-                dispatch<EventConnect>(event);
-                break;
-            case ENET_EVENT_TYPE_DISCONNECT:
-                m_logger.info("%x:%u disconnected", event.peer->address.host,
-                              event.peer->address.port);
-                dispatch<EventDisconnect>(event);
-                break;
-            case ENET_EVENT_TYPE_RECEIVE:
-                m_logger.info(
-                    "received %lu bytes from %x:%u", event.packet->dataLength,
-                    event.peer->address.host, event.peer->address.port);
-                dispatch<EventReceive>(event);
-                break;
-            default:
-                break;
+        m_metrics.service_calls.fetch_add(1, std::memory_order_relaxed);
+        if (rc > 0)
+            handle_event(event);
+        return rc;
+    }
+
+    /**
+     * @brief Services the host and dispatches every event that is ready.
+     *
+     * Events are collected in batches under a single lock and dispatched
+     * after it is released, so draining a busy host takes far fewer lock
+     * round trips than calling `service()` per event.
+     *
+     * @param timeout The maximum time to wait for the first event, in
+     * milliseconds.
+     * @param max_events The maximum number of events to dispatch.
+     * @return The number of events dispatched, or a negative value if ENet
+     * failed before any were.
+     */
+    int service_batch(uint32 timeout = 0, size_t max_events = SIZE_MAX) {
+        TraceSpan span("Host::service_batch");
+        m_logger.trace("servicing ENet host");
+        ENetEvent events[32];
+        size_t total = 0;
+        while (total < max_events) {
+            size_t limit = std::min(max_events - total, sizeof(events) /
+                                                            sizeof(events[0]));
+            size_t count = 0;
+            int rc;
+            {
+                TracedLock lock(m_mutex, "wait Host::m_mutex");
+                ClockScope clock(m_clock.get());
+                TraceSpan service_span("enet_host_service");
+                auto start = std::chrono::steady_clock::now();
+                begin_wait(total == 0 ? timeout : 0);
+                rc = enet_host_service(m_host, &events[0],
+                                       total == 0 ? timeout : 0);
+                end_wait();
+                if (rc > 0) {
+                    count = 1;
+                    while (count < limit &&
+                           enet_host_check_events(m_host, &events[count]) > 0)
+                        count++;
+                }
+                trim_window();
+                m_latency[LatencyStage::SERVICE].record_since(start);
+                m_metrics.update(m_host);
             }
+            m_metrics.service_calls.fetch_add(1, std::memory_order_relaxed);
+            if (rc < 0)
+                return total > 0 ? (int)total : rc;
+            for (size_t i = 0; i < count; i++)
+                handle_event(events[i]);
+            total += count;
+            if (count < limit)
+                break;
         }
-        return rc;
+        return (int)total;
     }
 
     /**
@@ -599,7 +3416,8 @@ class Host {
      *
      * @param address The remote Address to connect to.
      * @param channels The number of channels to use.
-     * @param data Optional data to associate with the connection.
+     * @param data Optional data to associate with the connection, by default
+     * the compressor's id (see `set_compressor()`).
      * @param timeout The time to wait for a connection.
      * @return A Peer representing the connection.
      * @throws std::runtime_error if the connection fails.
@@ -607,17 +3425,24 @@ class Host {
     Peer connect(Address address, size_t channels = 1, uint32 data = 0,
                  uint32 timeout = 5000) {
         m_logger.debug("Connecting to %x:%u", address.host(), address.port());
+        TraceSpan span("Host::connect");
         ENetPeer* peer;
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            peer = enet_host_connect(m_host, address.get(), channels, data);
+            TracedLock lock(m_mutex, "wait Host::m_mutex");
+            ClockScope clock(m_clock.get());
+            m_host->peerCount = m_peer_capacity;
+            peer = enet_host_connect(m_host, address.get(), channels,
+                                     connect_data(data));
+            trim_window();
             if (peer == NULL) {
                 throw std::runtime_error(
                     "No available peers for initiating an ENet connection.");
             }
+            peer->eventData = connect_data(data);
             ENetEvent event;
-            if (!((enet_host_service(m_host, &event, timeout) > 0) &&
-                  (event.type == ENET_EVENT_TYPE_CONNECT))) {
+            int serviced = enet_host_service(m_host, &event, timeout);
+            m_metrics.update(m_host);
+            if (!((serviced > 0) && (event.type == ENET_EVENT_TYPE_CONNECT))) {
                 enet_peer_reset(peer);
                 throw std::runtime_error("Connection failed");
             }
@@ -627,15 +3452,238 @@ class Host {
         return Peer(peer);
     }
 
+    /**
+     * @brief Starts connecting to a remote address without waiting for it.
+     *
+     * The connection completes during a later `service()`, which dispatches
+     * an EventConnect, or an EventDisconnect if it times out.
+     *
+     * This is thread safe.
+     *
+     * @param address The remote Address to connect to.
+     * @param channels The number of channels to use.
+     * @param data Optional data to associate with the connection, by default
+     * the compressor's id (see `set_compressor()`).
+     * @return A Peer representing the pending connection.
+     * @throws std::runtime_error if no peer is available.
+     */
+    Peer connect_async(Address address, size_t channels = 1, uint32 data = 0) {
+        m_logger.debug("Connecting to %x:%u", address.host(), address.port());
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        ClockScope clock(m_clock.get());
+        m_host->peerCount = m_peer_capacity;
+        ENetPeer* peer = enet_host_connect(m_host, address.get(), channels,
+                                           connect_data(data));
+        trim_window();
+        if (peer == NULL) {
+            throw std::runtime_error(
+                "No available peers for initiating an ENet connection.");
+        }
+        // ENet reports this on the connect event, matching the remote end
+        peer->eventData = connect_data(data);
+        return Peer(peer);
+    }
+
+    /**
+     * @brief Inserts a shim between ENet and this host's socket.
+     *
+     * Each shim is added above the previous ones, so the most recent shim is
+     * the first to see outgoing datagrams and the last to see incoming ones.
+     *
+     * This is thread safe.
+     *
+     * @param shim The shim to add.
+     * @throws std::runtime_error if the library was built without
+     * `ENETCPP_SOCKET_SHIM`.
+     */
+    void add_shim(std::shared_ptr<SocketShim> shim) {
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        if (!m_shims) {
+            m_shims.reset(new ShimStack(m_host->socket, SocketShims::real()));
+            try {
+                SocketShims::attach(m_host->socket, m_shims.get());
+            } catch (...) {
+                m_shims.reset();
+                throw;
+            }
+        }
+        m_shims->push(std::move(shim));
+    }
+
+    /**
+     * @brief Sets the time source ENet uses for this host.
+     *
+     * With a virtual clock, socket waits return immediately and ENet only
+     * sees time pass when the clock is advanced, so use `connect_async()`
+     * rather than the blocking `connect()`. Set the clock before connecting
+     * peers, since ENet stores absolute times in them.
+     *
+     * This is thread safe.
+     *
+     * @param clock The clock, or NULL for ENet's wall clock.
+     * @throws std::runtime_error if the library was built without
+     * `ENETCPP_SOCKET_SHIM`, which also wraps `enet_time_get`.
+     */
+    void set_clock(std::shared_ptr<Clock> clock) {
+        if (clock && !SocketShims::installed())
+            throw std::runtime_error("Host clocks are not linked in, build "
+                                     "with ENETCPP_SOCKET_SHIM");
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        m_clock = std::move(clock);
+    }
+
+    /**
+     * @brief Removes every shim, returning the host to its plain socket.
+     *
+     * Datagrams still held by the shims are discarded. This is thread safe.
+     */
+    void clear_shims() {
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        if (m_shims) {
+            SocketShims::detach(m_host->socket);
+            m_shims.reset();
+        }
+    }
+
+    /**
+     * @brief Wakes a thread blocked in `service()` or `service_batch()`.
+     *
+     * Call this after queueing packets from another thread so a host blocked
+     * with a long timeout sends them right away. It only costs an atomic load
+     * unless the host is blocked. A blocked ENet flushes its queued packets
+     * and, on an in-memory transport, returns; on a UDP socket it keeps
+     * waiting for the rest of its timeout.
+     *
+     * This is thread safe, but must not race with `clear_shims()`.
+     */
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_waiting.load(std::memory_order_relaxed))
+            return;
+        ShimStack* stack = SocketShims::find(m_host->socket);
+        if (stack && stack->interrupt())
+            return;
+        // wake the socket wait with an empty datagram, which ENet ignores
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        if (m_wake_socket == ENET_SOCKET_NULL) {
+            if (enet_socket_get_address(m_host->socket, &m_wake_address) != 0)
+                return;
+            if (m_wake_address.host == ENET_HOST_ANY)
+                m_wake_address.host = ENET_HOST_TO_NET_32(0x7F000001);
+            m_wake_socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+            if (m_wake_socket == ENET_SOCKET_NULL)
+                return;
+        }
+        ENetBuffer buffer;
+        buffer.data = NULL;
+        buffer.dataLength = 0;
+        enet_socket_send(m_wake_socket, &m_wake_address, &buffer, 1);
+    }
+
+    /**
+     * @brief Returns how long `service()` may block before ENet has timed
+     * work to do.
+     *
+     * ENet only retransmits, pings and throttles when it is serviced, so a
+     * host that blocks longer than this delays that work. Socket shims with
+     * timed work, such as datagrams held back by a pacer, shorten it too.
+     * Walks every peer, so it is meant for idle hosts about to block.
+     *
+     * This is thread safe.
+     *
+     * @param limit The longest timeout to return, in milliseconds.
+     * @return The timeout in milliseconds, `0` if ENet has work now.
+     */
+    uint32 next_timeout(uint32 limit) {
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        ClockScope clock(m_clock.get());
+        if (!enet_list_empty(&m_host->dispatchQueue))
+            return 0;
+        uint32 now = enet_time_get();
+        uint32 timeout = m_shims ? m_shims->limit(limit) : limit;
+        auto until = [&](uint32 deadline) {
+            int32_t remaining = (int32_t)(deadline - now);
+            timeout = std::min(timeout, remaining > 0 ? (uint32)remaining : 0);
+        };
+        until(m_host->bandwidthThrottleEpoch +
+              ENET_HOST_BANDWIDTH_THROTTLE_INTERVAL);
+        for (size_t i = 0; i < m_host->peerCount && timeout > 0; i++) {
+            ENetPeer* peer = &m_host->peers[i];
+            if (peer->state == ENET_PEER_STATE_DISCONNECTED ||
+                peer->state == ENET_PEER_STATE_ZOMBIE)
+                continue;
+#if ENET_VERSION >= ENET_VERSION_CREATE(1, 3, 18)
+            if (!enet_list_empty(&peer->acknowledgements) ||
+                !enet_list_empty(&peer->outgoingCommands) ||
+                !enet_list_empty(&peer->outgoingSendReliableCommands))
+                return 0;
+#else
+            if (!enet_list_empty(&peer->acknowledgements) ||
+                !enet_list_empty(&peer->outgoingReliableCommands) ||
+                !enet_list_empty(&peer->outgoingUnreliableCommands))
+                return 0;
+#endif
+            if (!enet_list_empty(&peer->sentReliableCommands))
+                until(peer->nextTimeout);
+            else if (peer->state == ENET_PEER_STATE_CONNECTED ||
+                     peer->state == ENET_PEER_STATE_DISCONNECT_LATER)
+                until(peer->lastReceiveTime + peer->pingInterval);
+        }
+        return timeout;
+    }
+
     /**
      * @brief Flushes any queued packets to the network.
      */
     void flush() {
+        TraceSpan span("Host::flush");
         m_logger.trace("flushing ENet host");
-        std::lock_guard<std::mutex> lock(m_mutex);
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        ClockScope clock(m_clock.get());
         enet_host_flush(m_host);
+        trim_window();
+        m_metrics.update(m_host);
+    }
+
+    /**
+     * @brief Trims the range of peer slots ENet walks to the highest slot in
+     * use plus `spare` free ones.
+     *
+     * ENet walks every peer slot up to `peerCount` on each service and
+     * flush, whether or not it is connected. With a window trim the host
+     * lowers `peerCount` to the highest slot in use plus `spare` free slots,
+     * adjusting it after every service, flush and connect. ENet fills the
+     * lowest free slot first, so while peers stay packed at the start the
+     * walks cost about as much as the connected peers rather than the
+     * `peer_count` the host was created with.
+     *
+     * This is not a list of active peers: connected but idle peers, and free
+     * slots below the highest one in use, are still walked. Once peers have
+     * disconnected from the low slots, the trim only shrinks again as the
+     * high slots empty.
+     *
+     * The trim is off by default. Connection requests arriving while all
+     * `spare` slots are taken within a single service are dropped, and the
+     * remote host retries them after its retransmit timeout, so size `spare`
+     * for the largest connection burst expected per service.
+     *
+     * This is thread safe.
+     *
+     * @param spare The free slots to keep above the highest one in use, or `0`
+     * to let ENet walk every slot (the default).
+     */
+    void set_window_trim(size_t spare) {
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        m_trim_spare = spare;
+        m_host->peerCount = m_peer_capacity;
+        trim_window();
     }
 
+    /**
+     * @brief Returns the number of peer slots the host was created with.
+     */
+    size_t peer_capacity() const { return m_peer_capacity; }
+
     /**
      * @brief Broadcasts a packet to all connected peers.
      *
@@ -650,7 +3698,7 @@ class Host {
     void broadcast(Packet& packet, uint8 channel = 0) {
         m_logger.trace("broadcasting %lu bytes from ENet host",
                        packet.length());
-        std::lock_guard<std::mutex> lock(m_mutex);
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
         enet_host_broadcast(m_host, channel, packet.get());
         packet.release_ownership();
     }
@@ -668,7 +3716,7 @@ class Host {
      * second.
      */
     void bandwidth_limit(uint32 incoming_bandwith, uint32 outgoing_bandwidth) {
-        std::lock_guard<std::mutex> lock(m_mutex);
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
         enet_host_bandwidth_limit(m_host, incoming_bandwith,
                                   outgoing_bandwidth);
     }
@@ -681,7 +3729,8 @@ class Host {
      * managing network congestion.
      */
     void bandwidth_throttle() {
-        std::lock_guard<std::mutex> lock(m_mutex);
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        ClockScope clock(m_clock.get());
         enet_host_bandwidth_throttle(m_host);
     }
 
@@ -695,10 +3744,127 @@ class Host {
      * @param channel_limit The maximum number of channels.
      */
     void channel_limit(size_t channel_limit) {
-        std::lock_guard<std::mutex> lock(m_mutex);
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
         enet_host_channel_limit(m_host, channel_limit);
     }
 
+    /**
+     * @brief Compresses the datagrams the host sends with `compressor`.
+     *
+     * ENet compresses whole datagrams after their protocol header and sends
+     * the original whenever compression does not make it smaller. Both ends
+     * of every connection must use the same codec: a host without it drops
+     * compressed datagrams. The `compress_*` and `decompress_*` fields of
+     * `metrics()` count the results.
+     *
+     * Handshake datagrams are never compressed. If the codec has a non-zero
+     * `Compressor::id()`, connections started by this host carry it as their
+     * `data` unless given other data, and incoming connections with other
+     * data are refused: they are disconnected with the id as the disconnect
+     * data, without an `EventConnect`.
+     *
+     * This is thread safe.
+     *
+     * @param compressor The codec, or `nullptr` to stop compressing.
+     * @param threshold Datagrams with fewer bytes than this after the header
+     * are sent without trying to compress them; `SIZE_MAX` makes the host
+     * only decompress, for when a shim such as `AdaptiveCompressor`
+     * compresses instead.
+     */
+    void set_compressor(std::shared_ptr<Compressor> compressor,
+                        size_t threshold = 64) {
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        m_codec_id.store(compressor ? compressor->id() : 0);
+        if (!compressor) {
+            enet_host_compress(m_host, NULL);
+            return;
+        }
+        ENetCompressor binding;
+        binding.context = new CompressorBinding{std::move(compressor),
+                                                threshold, &m_metrics, {}};
+        binding.compress = CompressorBinding::compress;
+        binding.decompress = CompressorBinding::decompress;
+        binding.destroy = CompressorBinding::destroy;
+        enet_host_compress(m_host, &binding);
+    }
+
+    /**
+     * @brief Compresses the datagrams the host sends with ENet's built-in
+     * range coder, which plain ENet peers can read.
+     *
+     * This is thread safe.
+     *
+     * @throws std::runtime_error if the range coder cannot be created.
+     */
+    void compress_with_range_coder() {
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        m_codec_id.store(0);
+        if (enet_host_compress_with_range_coder(m_host) != 0)
+            throw std::runtime_error("Failed to create the range coder");
+    }
+
+    /**
+     * @brief Puts a checksum on every datagram the host sends and drops
+     * received datagrams whose checksum does not match.
+     *
+     * ENet adds the checksum to the protocol header, so both ends of every
+     * connection must use the same kind. `ChecksumKind::CRC32` matches plain
+     * ENet's `enet_crc32`; `ChecksumKind::CRC32C` is cheaper where the CPU
+     * computes it, see `Checksum`.
+     *
+     * This is thread safe.
+     *
+     * @param kind The checksum, or `ChecksumKind::NONE` to disable it.
+     */
+    void enable_checksum(ChecksumKind kind = ChecksumKind::CRC32C) {
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        m_host->checksum = Checksum::callback(kind);
+    }
+
+    /**
+     * @brief Takes a snapshot of a peer's network statistics.
+     *
+     * This is thread safe.
+     *
+     * @param peer The peer to snapshot.
+     * @return The peer's current statistics.
+     */
+    PeerStats peer_stats(Peer peer) {
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        return peer.stats();
+    }
+
+    /**
+     * @brief Collects statistics for every peer that is not disconnected.
+     *
+     * All peers are read in a single pass under the host lock, so the
+     * snapshots are consistent with each other. This is thread safe.
+     *
+     * @param out Vector the snapshots are written to; it is cleared first so
+     * its capacity can be reused between calls.
+     * @return The number of peers collected.
+     */
+    size_t peer_stats(std::vector<PeerStats>& out) {
+        out.clear();
+        TracedLock lock(m_mutex, "wait Host::m_mutex");
+        for (ENetPeer* peer = m_host->peers;
+             peer < &m_host->peers[m_host->peerCount]; ++peer) {
+            if (peer->state != ENET_PEER_STATE_DISCONNECTED)
+                out.emplace_back(peer);
+        }
+        return out.size();
+    }
+
+    /**
+     * @brief Collects statistics for every peer that is not disconnected.
+     * @return The snapshots, see `peer_stats(std::vector<PeerStats>&)`.
+     */
+    std::vector<PeerStats> peer_stats() {
+        std::vector<PeerStats> out;
+        peer_stats(out);
+        return out;
+    }
+
     /**
      * @brief Retrieves the underlying ENetHost pointer.
      *
@@ -748,13 +3914,23 @@ class Host {
  * registers `enet_deinitialize` to be called automatically when the
  * program exits, ensuring that resources are cleaned up properly.
  *
+ * @param track_allocations If `true`, ENet's allocations are counted by
+ * `AllocationTracker`.
  * @throws std::runtime_error If ENet initialization fails.
  *
  * @note This function should be called before any ENet operations are
  * performed.
  */
-static inline void initialize() {
-    if (enet_initialize() != 0) {
+static inline void initialize(bool track_allocations = false) {
+    int rc;
+    if (track_allocations) {
+        ENetCallbacks callbacks = AllocationTracker::callbacks();
+        rc = enet_initialize_with_callbacks(ENET_VERSION, &callbacks);
+        AllocationTracker::enable();
+    } else {
+        rc = enet_initialize();
+    }
+    if (rc != 0) {
         throw std::runtime_error("An error occurred while initializing ENet.");
     }
     atexit(enet_deinitialize);
@@ -0,0 +1,4 @@
+// Link-time wrappers that route ENet's socket calls through
+// enetcpp::SocketShims. Built into enet-cpp when ENETCPP_SOCKET_SHIM is ON.
+#define ENETCPP_SHIM_IMPLEMENTATION
+#include <enetcpp/enetcpp-shim.hpp>
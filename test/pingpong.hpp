@@ -7,6 +7,7 @@
 class PingPong : public enetcpp::Host {
   private:
     int m_count = 10;
+    bool m_quiet = false;
 
   public:
     using enetcpp::Host::Host;
@@ -15,9 +16,22 @@ class PingPong : public enetcpp::Host {
 
     int count() { return m_count; }
 
+    void set_quiet(bool quiet) { m_quiet = quiet; }
+
+    void on_event(enetcpp::EventConnect& event) {
+        if (!m_quiet)
+            enetcpp::Host::on_event(event);
+    }
+
+    void on_event(enetcpp::EventDisconnect& event) {
+        if (!m_quiet)
+            enetcpp::Host::on_event(event);
+    }
+
     void on_event(enetcpp::EventReceive& event) {
         std::string data((char*)event.packet().data(), event.packet().length());
-        std::cout << data << std::endl;
+        if (!m_quiet)
+            std::cout << data << std::endl;
         enetcpp::Packet packet(data.data(), data.size());
         event.peer().send(packet);
         m_count--;